@@ -0,0 +1,211 @@
+#include "db.h"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#define TINYSQL_HAVE_SSE42
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#define TINYSQL_HAVE_ARM_CRC32
+#endif
+
+/*
+ * Page checksums.
+ *
+ * Pages carry the CRC32C (Castagnoli) of everything after their checksum
+ * field, see the page header layout in db.h. x86-64 CPUs with SSE4.2 and
+ * ARMv8 CPUs with the CRC32 extension compute it with a single instruction
+ * per 8 bytes; elsewhere a table does a byte at a time. Which kernel runs is
+ * decided once, from what the CPU supports.
+ *
+ * The instruction takes a few cycles to produce its result but can start
+ * every cycle, so the hardware kernels cut their input into three blocks of
+ * CRC32C_BLOCK_SIZE bytes and run one CRC over each side by side. The CRC
+ * of the blocks back to back is then that of the first shifted over the
+ * length of a block, combined with that of the second, shifted in turn and
+ * combined with the third; the shift is linear, so it is done with tables.
+ */
+
+/* The CRC32C polynomial, bit reversed */
+#define CRC32C_POLYNOMIAL 0x82f63b78
+
+/* A third of the 4 KiB page past its checksum, less what is left over */
+#define CRC32C_BLOCK_SIZE 1360
+
+static uint32_t crc32c_table[256];
+// Shifts a CRC over CRC32C_BLOCK_SIZE zero bytes, a byte of it at a time
+static uint32_t crc32c_shift_table[4][256];
+
+static uint32_t crc32c_software(uint32_t crc, const uint8_t *data,
+                                size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    crc = crc32c_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+/* What crc becomes over CRC32C_BLOCK_SIZE zero bytes */
+static uint32_t crc32c_shift(uint32_t crc) {
+  return crc32c_shift_table[0][crc & 0xff] ^
+         crc32c_shift_table[1][(crc >> 8) & 0xff] ^
+         crc32c_shift_table[2][(crc >> 16) & 0xff] ^
+         crc32c_shift_table[3][crc >> 24];
+}
+
+static uint64_t load_uint64(const uint8_t *data) {
+  uint64_t value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+#ifdef TINYSQL_HAVE_SSE42
+__attribute__((target("sse4.2"))) static uint32_t
+crc32c_sse42(uint32_t crc, const uint8_t *data, size_t length) {
+  while (length >= 3 * CRC32C_BLOCK_SIZE) {
+    uint64_t crc0 = crc;
+    uint64_t crc1 = 0;
+    uint64_t crc2 = 0;
+    for (size_t i = 0; i < CRC32C_BLOCK_SIZE; i += 8) {
+      crc0 = _mm_crc32_u64(crc0, load_uint64(data + i));
+      crc1 = _mm_crc32_u64(crc1, load_uint64(data + CRC32C_BLOCK_SIZE + i));
+      crc2 =
+          _mm_crc32_u64(crc2, load_uint64(data + 2 * CRC32C_BLOCK_SIZE + i));
+    }
+    crc = crc32c_shift(crc32c_shift(crc0) ^ crc1) ^ crc2;
+    data += 3 * CRC32C_BLOCK_SIZE;
+    length -= 3 * CRC32C_BLOCK_SIZE;
+  }
+
+  uint64_t crc64 = crc;
+  for (; length >= 8; data += 8, length -= 8) {
+    crc64 = _mm_crc32_u64(crc64, load_uint64(data));
+  }
+  crc = crc64;
+  for (; length > 0; data++, length--) {
+    crc = _mm_crc32_u8(crc, *data);
+  }
+  return crc;
+}
+#endif
+
+#ifdef TINYSQL_HAVE_ARM_CRC32
+__attribute__((target("+crc"))) static uint32_t
+crc32c_arm(uint32_t crc, const uint8_t *data, size_t length) {
+  while (length >= 3 * CRC32C_BLOCK_SIZE) {
+    uint32_t crc0 = crc;
+    uint32_t crc1 = 0;
+    uint32_t crc2 = 0;
+    for (size_t i = 0; i < CRC32C_BLOCK_SIZE; i += 8) {
+      crc0 = __crc32cd(crc0, load_uint64(data + i));
+      crc1 = __crc32cd(crc1, load_uint64(data + CRC32C_BLOCK_SIZE + i));
+      crc2 = __crc32cd(crc2, load_uint64(data + 2 * CRC32C_BLOCK_SIZE + i));
+    }
+    crc = crc32c_shift(crc32c_shift(crc0) ^ crc1) ^ crc2;
+    data += 3 * CRC32C_BLOCK_SIZE;
+    length -= 3 * CRC32C_BLOCK_SIZE;
+  }
+
+  for (; length >= 8; data += 8, length -= 8) {
+    crc = __crc32cd(crc, load_uint64(data));
+  }
+  for (; length > 0; data++, length--) {
+    crc = __crc32cb(crc, *data);
+  }
+  return crc;
+}
+#endif
+
+typedef uint32_t (*Crc32cKernel)(uint32_t crc, const uint8_t *data,
+                                 size_t length);
+
+static Crc32cKernel crc32c_kernel = NULL;
+static const char *crc32c_kernel_name = NULL;
+// Built from more than one thread's first checksum otherwise
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+static void crc32c_init() {
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t crc = i;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (crc & 1 ? CRC32C_POLYNOMIAL : 0);
+    }
+    crc32c_table[i] = crc;
+  }
+
+  // Shifting is linear, so each table entry is made of single bits' shifts
+  static const uint8_t zeros[CRC32C_BLOCK_SIZE];
+  uint32_t bit_shifts[32];
+  for (int bit = 0; bit < 32; bit++) {
+    bit_shifts[bit] = crc32c_software(1u << bit, zeros, CRC32C_BLOCK_SIZE);
+  }
+  for (int byte = 0; byte < 4; byte++) {
+    for (uint32_t value = 0; value < 256; value++) {
+      uint32_t shift = 0;
+      for (int bit = 0; bit < 8; bit++) {
+        if (value & (1u << bit)) {
+          shift ^= bit_shifts[byte * 8 + bit];
+        }
+      }
+      crc32c_shift_table[byte][value] = shift;
+    }
+  }
+
+  crc32c_kernel = crc32c_software;
+  crc32c_kernel_name = "software";
+#ifdef TINYSQL_HAVE_SSE42
+  if (__builtin_cpu_supports("sse4.2")) {
+    crc32c_kernel = crc32c_sse42;
+    crc32c_kernel_name = "sse4.2";
+  }
+#endif
+#if defined(TINYSQL_HAVE_ARM_CRC32) && defined(HWCAP_CRC32)
+  if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+    crc32c_kernel = crc32c_arm;
+    crc32c_kernel_name = "armv8";
+  }
+#endif
+}
+
+/**
+ * Compute the CRC32C of a run of bytes.
+ *
+ * @param data the bytes
+ * @param length the number of bytes
+ *
+ * @return the checksum
+ */
+uint32_t crc32c(const void *data, size_t length) {
+  pthread_once(&crc32c_once, crc32c_init);
+  return ~crc32c_kernel(~0u, data, length);
+}
+
+const char *crc32c_name() {
+  pthread_once(&crc32c_once, crc32c_init);
+  return crc32c_kernel_name;
+}
+
+/* Set a page's checksum, just before it is written to the file */
+void page_set_checksum(void *page, uint32_t page_size) {
+  *(uint32_t *)(page + PAGE_CHECKSUM_OFFSET) =
+      crc32c(page + PAGE_HEADER_SIZE, page_size - PAGE_HEADER_SIZE);
+}
+
+/*
+ * Whether a page read from the file is intact: its checksum matches, or it
+ * is all zeros, a page of the file that was never written
+ */
+bool page_checksum_matches(const void *page, uint32_t page_size) {
+  uint32_t checksum = *(const uint32_t *)(page + PAGE_CHECKSUM_OFFSET);
+  if (checksum ==
+      crc32c(page + PAGE_HEADER_SIZE, page_size - PAGE_HEADER_SIZE)) {
+    return true;
+  }
+
+  const uint8_t *bytes = page;
+  for (uint32_t i = 0; i < page_size; i++) {
+    if (bytes[i] != 0) {
+      return false;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,319 @@
+#include "db.h"
+
+/*
+ * Page compression.
+ *
+ * With compression on, pages are compressed on their way to the database
+ * file and expanded again as they are read back into the buffer pool; the
+ * buffer pool, the WAL and the tree only ever see whole pages. A compressed
+ * page still takes its slot of the file, but the blocks past its compressed
+ * bytes are handed back to the file system (see io_punch_hole()), so the
+ * file takes up less space on disk and reading the page reads fewer blocks.
+ * That happens a block at a time, so a page is only compressed if that
+ * frees at least PAGE_COMPRESSION_BLOCK_SIZE bytes of its slot, which takes
+ * pages larger than a block.
+ *
+ * Before compression the keys of a node are replaced by their differences
+ * from the key before. Keys of a node are close together, so the
+ * differences are small numbers in mostly zero bytes, where keys themselves
+ * would have hardly any bytes in common. Whether a page is a node, and how
+ * many keys it holds, is read from parts of the page this leaves alone, so
+ * expanding the page undoes it exactly, for whatever page it was done to.
+ *
+ * The compressor is a plain LZ77 coder writing the sequences of LZ4's block
+ * format: a token with the lengths of a run of literals and of the match
+ * after it, the literals, and the match as a distance back into what has
+ * been produced so far. A hash table of recent positions finds matches; it
+ * is not exhaustive, but pages are small and mostly rows of text.
+ */
+
+/* Shortest match worth coding */
+#define LZ_MIN_MATCH 4
+/* Positions remembered by the compressor's hash table */
+#define LZ_HASH_BITS 12
+/* Bytes at the end of the input always coded as literals, as LZ4 requires */
+#define LZ_LAST_LITERALS 5
+/* No match starts within this many bytes of the end of the input */
+#define LZ_MATCH_LIMIT 12
+/* The farthest a match can reach back */
+#define LZ_MAX_OFFSET 65535
+
+static uint32_t load_uint32(const uint8_t *data) {
+  uint32_t value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+static uint32_t lz_hash(uint32_t value) {
+  return (value * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Write what is left of a length past its token's nibble */
+static uint8_t *lz_write_length(uint8_t *output, uint32_t length) {
+  for (; length >= 255; length -= 255) {
+    *output++ = 255;
+  }
+  *output++ = length;
+  return output;
+}
+
+/* Read what is left of a length past its token's nibble */
+static bool lz_read_length(const uint8_t **input, const uint8_t *input_end,
+                           uint32_t *length) {
+  uint8_t byte;
+  do {
+    if (*input == input_end) {
+      return false;
+    }
+    byte = *(*input)++;
+    *length += byte;
+  } while (byte == 255);
+  return true;
+}
+
+/*
+ * Write one sequence, of literal_length literals and then match_length
+ * bytes matched offset back, or of literals alone if match_length is 0.
+ * Returns the end of the sequence, or NULL if it does not fit before
+ * output_end.
+ */
+static uint8_t *lz_write_sequence(uint8_t *output, uint8_t *output_end,
+                                  const uint8_t *literals,
+                                  uint32_t literal_length, uint32_t offset,
+                                  uint32_t match_length) {
+  // Token, lengths and offset
+  size_t most = 1 + literal_length / 255 + 1 + literal_length + 2 +
+                match_length / 255 + 1;
+  if (most > (size_t)(output_end - output)) {
+    return NULL;
+  }
+
+  uint32_t match_code = match_length ? match_length - LZ_MIN_MATCH : 0;
+  uint8_t *token = output++;
+  *token = (literal_length < 15 ? literal_length : 15) << 4 |
+           (match_code < 15 ? match_code : 15);
+  if (literal_length >= 15) {
+    output = lz_write_length(output, literal_length - 15);
+  }
+  memcpy(output, literals, literal_length);
+  output += literal_length;
+  if (match_length == 0) {
+    return output;
+  }
+
+  *output++ = offset & 0xff;
+  *output++ = offset >> 8;
+  if (match_code >= 15) {
+    output = lz_write_length(output, match_code - 15);
+  }
+  return output;
+}
+
+/*
+ * Compress length bytes of input into at most capacity bytes of output.
+ * Returns the compressed size, or 0 if it would not fit.
+ */
+static uint32_t lz_compress(const uint8_t *input, uint32_t length,
+                            uint8_t *output, uint32_t capacity) {
+  uint32_t table[1 << LZ_HASH_BITS];
+  memset(table, 0, sizeof(table));
+
+  const uint8_t *end = input + length;
+  const uint8_t *anchor = input; // Start of the literals not yet written
+  const uint8_t *position = input + 1;
+  uint8_t *output_end = output + capacity;
+  uint8_t *next = output;
+
+  while (length > LZ_MATCH_LIMIT && position < end - LZ_MATCH_LIMIT) {
+    uint32_t value = load_uint32(position);
+    uint32_t hash = lz_hash(value);
+    const uint8_t *candidate = input + table[hash];
+    table[hash] = position - input;
+    if (position - candidate > LZ_MAX_OFFSET ||
+        load_uint32(candidate) != value) {
+      position++;
+      continue;
+    }
+
+    const uint8_t *match_end = position + LZ_MIN_MATCH;
+    const uint8_t *reference = candidate + LZ_MIN_MATCH;
+    while (match_end < end - LZ_LAST_LITERALS && *match_end == *reference) {
+      match_end++;
+      reference++;
+    }
+
+    next = lz_write_sequence(next, output_end, anchor, position - anchor,
+                             position - candidate, match_end - position);
+    if (next == NULL) {
+      return 0;
+    }
+    position = anchor = match_end;
+  }
+
+  next = lz_write_sequence(next, output_end, anchor, end - anchor, 0, 0);
+  return next ? next - output : 0;
+}
+
+/*
+ * Expand length bytes of input into exactly capacity bytes of output.
+ * Returns false if the input is not a valid compressed run of that size.
+ */
+static bool lz_decompress(const uint8_t *input, uint32_t length,
+                          uint8_t *output, uint32_t capacity) {
+  const uint8_t *input_end = input + length;
+  uint8_t *next = output;
+  uint8_t *output_end = output + capacity;
+
+  while (input < input_end) {
+    uint8_t token = *input++;
+    uint32_t literal_length = token >> 4;
+    if (literal_length == 15 &&
+        !lz_read_length(&input, input_end, &literal_length)) {
+      return false;
+    }
+    if (literal_length > (size_t)(input_end - input) ||
+        literal_length > (size_t)(output_end - next)) {
+      return false;
+    }
+    memcpy(next, input, literal_length);
+    input += literal_length;
+    next += literal_length;
+    if (input == input_end) {
+      break; // The last sequence has literals only
+    }
+
+    if (input_end - input < 2) {
+      return false;
+    }
+    uint32_t offset = input[0] | input[1] << 8;
+    input += 2;
+    uint32_t match_length = token & 15;
+    if (match_length == 15 &&
+        !lz_read_length(&input, input_end, &match_length)) {
+      return false;
+    }
+    match_length += LZ_MIN_MATCH;
+    if (offset == 0 || offset > (size_t)(next - output) ||
+        match_length > (size_t)(output_end - next)) {
+      return false;
+    }
+    // Byte by byte, as a match may overlap the bytes it produces
+    const uint8_t *reference = next - offset;
+    for (uint32_t i = 0; i < match_length; i++) {
+      next[i] = reference[i];
+    }
+    next += match_length;
+  }
+  return next == output_end;
+}
+
+/* The number of keys a node holds, or 0 if the page is not one */
+static uint32_t page_num_keys(void *page, uint32_t page_size) {
+  uint32_t count;
+  switch (get_node_type(page)) {
+  case (NODE_INTERNAL):
+    count = *internal_node_num_keys(page);
+    return count <= (page_size - INTERNAL_NODE_HEADER_SIZE) /
+                        INTERNAL_NODE_CELL_SIZE
+               ? count
+               : 0;
+  case (NODE_LEAF):
+    count = *leaf_node_num_cells(page);
+    return count <= (page_size - LEAF_NODE_HEADER_SIZE) / LEAF_NODE_SLOT_SIZE
+               ? count
+               : 0;
+  default:
+    return 0;
+  }
+}
+
+static uint32_t *page_key(void *page, uint32_t key_num) {
+  return get_node_type(page) == NODE_INTERNAL ? internal_node_key(page, key_num)
+                                              : leaf_node_key(page, key_num);
+}
+
+/*
+ * Replace the keys of a node by their differences from the key before, or
+ * the differences by the keys. Pages that are not nodes are left alone.
+ */
+static void page_delta_keys(void *page, uint32_t page_size, bool encode) {
+  uint32_t count = page_num_keys(page, page_size);
+  if (encode) {
+    for (uint32_t i = count; i > 1; i--) {
+      *page_key(page, i - 1) -= *page_key(page, i - 2);
+    }
+  } else {
+    for (uint32_t i = 1; i < count; i++) {
+      *page_key(page, i) += *page_key(page, i - 1);
+    }
+  }
+}
+
+/**
+ * Compress a page for writing to the file.
+ *
+ * @param page the page
+ * @param stored a page sized buffer for the compressed page, which is
+ * filled up with zeros
+ * @param page_size the size of both
+ *
+ * @return the bytes of stored in use, or 0 if compressing the page would not
+ * free at least PAGE_COMPRESSION_BLOCK_SIZE bytes of it, in which case the
+ * page should be written as it is
+ */
+uint32_t page_compress(const void *page, void *stored, uint32_t page_size) {
+  if (page_size < 2 * PAGE_COMPRESSION_BLOCK_SIZE) {
+    return 0;
+  }
+
+  void *keys_delta_encoded = malloc(page_size);
+  memcpy(keys_delta_encoded, page, page_size);
+  page_delta_keys(keys_delta_encoded, page_size, true);
+  uint32_t size =
+      lz_compress(keys_delta_encoded + PAGE_HEADER_SIZE,
+                  page_size - PAGE_HEADER_SIZE,
+                  stored + PAGE_COMPRESSED_HEADER_SIZE,
+                  page_size - PAGE_COMPRESSION_BLOCK_SIZE -
+                      PAGE_COMPRESSED_HEADER_SIZE);
+  free(keys_delta_encoded);
+  if (size == 0) {
+    return 0;
+  }
+
+  *(uint32_t *)(stored + PAGE_COMPRESSED_MARKER_OFFSET) =
+      PAGE_COMPRESSED_MARKER;
+  *(uint32_t *)(stored + PAGE_COMPRESSED_SIZE_OFFSET) = size;
+  size += PAGE_COMPRESSED_HEADER_SIZE;
+  memset(stored + size, 0, page_size - size);
+  return size;
+}
+
+/* Whether a page read from the file is compressed */
+bool page_is_compressed(const void *page) {
+  return *(const uint32_t *)(page + PAGE_COMPRESSED_MARKER_OFFSET) ==
+         PAGE_COMPRESSED_MARKER;
+}
+
+/*
+ * Expand a compressed page read from the file in place. Returns false if
+ * it does not expand to a whole page.
+ */
+bool page_decompress(void *page, uint32_t page_size) {
+  uint32_t size = *(uint32_t *)(page + PAGE_COMPRESSED_SIZE_OFFSET);
+  if (size > page_size - PAGE_COMPRESSED_HEADER_SIZE) {
+    return false;
+  }
+
+  void *expanded = malloc(page_size);
+  bool valid = lz_decompress(page + PAGE_COMPRESSED_HEADER_SIZE, size,
+                             expanded + PAGE_HEADER_SIZE,
+                             page_size - PAGE_HEADER_SIZE);
+  if (valid) {
+    // The checksum, of the compressed page, is set afresh on the next write
+    memcpy(expanded, page, PAGE_HEADER_SIZE);
+    page_delta_keys(expanded, page_size, false);
+    memcpy(page, expanded, page_size);
+  }
+  free(expanded);
+  return valid;
+}
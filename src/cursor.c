@@ -6,22 +6,56 @@ void *cursor_value(Cursor *cursor) {
   return leaf_node_value(page, cursor->cell_num);
 }
 
-void cursor_advance(Cursor *cursor) {
-  uint32_t page_num = cursor->page_num;
-  void *node = get_page(cursor->table->pager, page_num);
+uint32_t cursor_key(Cursor *cursor) {
+  void *page = get_page(cursor->table->pager, cursor->page_num);
+  return *(uint32_t *)leaf_node_key(page, cursor->cell_num);
+}
 
-  cursor->cell_num += 1;
-  if (cursor->cell_num >= (*leaf_node_num_cells(node))) {
-    cursor->end_of_table = true;
+/*
+ * If the cursor points one past the last cell of its leaf, move it to the
+ * first cell of the next non-empty leaf, following the sibling pointers.
+ * Sets end_of_table when the rightmost leaf is exhausted.
+ */
+static void cursor_skip_exhausted_leaves(Cursor *cursor) {
+  void *node = get_page(cursor->table->pager, cursor->page_num);
+
+  while (cursor->cell_num >= *leaf_node_num_cells(node)) {
+    uint32_t next_page_num = *leaf_node_next_leaf(node);
+    if (next_page_num == 0) {
+      // This was the rightmost leaf
+      cursor->end_of_table = true;
+      return;
+    }
+    cursor->page_num = next_page_num;
+    cursor->cell_num = 0;
+    node = get_page(cursor->table->pager, next_page_num);
+    pager_readahead(cursor->table->pager, next_page_num,
+                    *leaf_node_next_leaf(node));
   }
 }
 
-Cursor *table_start(Table *table) {
-  Cursor *cursor = table_find(table, 0);
+void cursor_advance(Cursor *cursor) {
+  cursor->cell_num += 1;
+  cursor_skip_exhausted_leaves(cursor);
+}
+
+/**
+ * Return a cursor at the first cell whose key is greater than or equal to
+ * the given key, so that a range scan descends from the root only once and
+ * then streams leaves through their sibling pointers.
+ *
+ * @param table the table to be searched
+ * @param key the smallest key of interest
+ * @param cursor the cursor to position, at end of table if no key is large
+ * enough
+ */
+void table_seek(Table *table, uint32_t key, Cursor *cursor) {
+  table_find(table, key, cursor);
 
   void *node = get_page(table->pager, cursor->page_num);
-  uint32_t num_cells = *leaf_node_num_cells(node);
-  cursor->end_of_table = (num_cells == 0);
+  pager_readahead(table->pager, cursor->page_num, *leaf_node_next_leaf(node));
 
-  return cursor;
+  cursor_skip_exhausted_leaves(cursor);
 }
+
+void table_start(Table *table, Cursor *cursor) { table_seek(table, 0, cursor); }
@@ -3,11 +3,15 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
 // Type definitions
@@ -17,17 +21,56 @@ typedef struct {
   ssize_t input_length;
 } InputBuffer;
 
+/* Bytes batch mode reads from its script at a time */
+#define SCRIPT_BLOCK_SIZE (1024 * 1024)
+
+/* A file of statements, read a block at a time in batch mode */
+typedef struct {
+  int file_descriptor;
+  char *data;
+  size_t capacity;
+  size_t length;     // Bytes of data read from the file
+  size_t position;   // Start of the next line in data
+  bool end_of_file;
+  uint32_t line_num; // Of the line read last, counting from 1
+} ScriptReader;
+
 typedef enum {
   EXECUTE_SUCCESS,
   EXECUTE_DUPLICATE_KEY,
-  EXECUTE_TABLE_FULL
+  EXECUTE_KEY_NOT_FOUND,
+  EXECUTE_TABLE_FULL,
+  EXECUTE_IN_TRANSACTION, // begin while a transaction is open
+  EXECUTE_NO_TRANSACTION  // commit without one
 } ExecuteResult;
 
+/* Tries table_lookup() makes before the table lock is needed after all */
+#define TABLE_LOOKUP_ATTEMPTS 4
+
+/* What a lookup without the table lock found, see table_lookup() */
+typedef enum {
+  LOOKUP_FOUND,
+  LOOKUP_NOT_FOUND,
+  LOOKUP_CONFLICT,  // Writes kept getting in the way
+  LOOKUP_NOT_CACHED // A page has to be loaded, under the table lock
+} LookupResult;
+
+/* What query_step() did */
+typedef enum {
+  STEP_ROW,  // A row is ready to be read with the query_column_ functions
+  STEP_DONE, // The statement has run to completion
+  STEP_ERROR // The statement failed, see query_result()
+} StepResult;
+
 typedef enum {
   META_COMMAND_SUCCESS,
+  META_COMMAND_EXIT,
   META_COMMAND_UNRECOGNIZED_COMMAND
 } MetaCommandResult;
 
+/* How running one line of input at the prompt or in a script went */
+typedef enum { LINE_SUCCESS, LINE_ERROR, LINE_EXIT } LineResult;
+
 typedef enum {
   PREPARE_SUCCESS,
   PREPARE_NEGATIVE_ID,
@@ -36,7 +79,22 @@ typedef enum {
   PREPARE_UNRECOGNIZED_STATEMENT
 } PrepareResult;
 
-typedef enum { STATEMENT_INSERT, STATEMENT_SELECT } StatementType;
+typedef enum {
+  IMPORT_SUCCESS,
+  IMPORT_FILE_ERROR,
+  IMPORT_PARSE_ERROR,
+  IMPORT_DUPLICATE_KEY,
+  IMPORT_TABLE_NOT_EMPTY
+} ImportResult;
+
+typedef enum {
+  STATEMENT_INSERT,
+  STATEMENT_SELECT,
+  STATEMENT_DELETE,
+  STATEMENT_UPDATE,
+  STATEMENT_BEGIN,
+  STATEMENT_COMMIT
+} StatementType;
 
 #define COLUMN_USERNAME_SIZE 32
 #define COLUMN_EMAIL_SIZE 255
@@ -47,38 +105,379 @@ typedef struct {
   char email[COLUMN_EMAIL_SIZE + 1];
 } Row;
 
+/* The database holds a single table of rows, named in "insert into" */
+#define TABLE_NAME "users"
+
+typedef enum { COLUMN_ID, COLUMN_USERNAME, COLUMN_EMAIL } Column;
+
+/* The type of a value in a result row */
+typedef enum { COLUMN_TYPE_INTEGER, COLUMN_TYPE_TEXT } ColumnType;
+#define NUM_COLUMNS 3
+
+/* The field a parameter of a prepared statement is bound to */
+typedef enum {
+  PARAMETER_ID,       // row_to_insert.id
+  PARAMETER_USERNAME, // row_to_insert.username
+  PARAMETER_EMAIL,    // row_to_insert.email
+  PARAMETER_KEY,      // key_low and key_high, for "where id = ?"
+  PARAMETER_KEY_LOW,
+  PARAMETER_KEY_HIGH
+} ParameterTarget;
+
+/* Most parameters a statement takes, those of an insert or update */
+#define STATEMENT_MAX_PARAMETERS 3
+
 typedef struct {
   StatementType type;
-  Row row_to_insert; // only used by insert statement
+  Row row_to_insert; // only used by insert and update statements
+  uint32_t key_low;  // only used by select and delete: inclusive key range
+  uint32_t key_high;
+  // only used by select ... in: sorted ids without duplicates, or NULL
+  uint32_t *keys;
+  uint32_t num_keys;
+  // only used by insert into ... values: rows sorted by id, or NULL
+  Row *rows;
+  uint32_t num_rows;
+  // only used by select: the columns to print in order, or the row count
+  Column columns[NUM_COLUMNS];
+  uint32_t num_columns;
+  bool count;
+  // the fields the statement's "?" parameters stand for, in order
+  ParameterTarget parameters[STATEMENT_MAX_PARAMETERS];
+  uint32_t num_parameters;
 } Statement;
 
+/* A statement prepared under a name at the prompt */
+typedef struct {
+  char *name;
+  Statement statement;
+} NamedStatement;
+
+typedef struct {
+  NamedStatement *statements;
+  uint32_t num_statements;
+  uint32_t capacity;
+} StatementCache;
+
+typedef enum {
+  TOKEN_END,
+  TOKEN_WORD,
+  TOKEN_NUMBER,  // Digits with an optional leading minus
+  TOKEN_STRING,  // Without its quotes
+  TOKEN_INVALID, // A string missing its closing quote
+  TOKEN_PARAMETER,
+  TOKEN_LEFT_PAREN,
+  TOKEN_RIGHT_PAREN,
+  TOKEN_COMMA,
+  TOKEN_EQUALS,
+  TOKEN_STAR
+} TokenType;
+
+/* A token points into the text it was read from and is not NUL-terminated */
+typedef struct {
+  TokenType type;
+  const char *start;
+  uint32_t length;
+} Token;
+
+typedef struct {
+  const char *position;
+} Tokenizer;
+
 #define size_of_attribute(Struct, Attribute) sizeof(((Struct *)0)->Attribute)
 
+/*
+ * Serialized Row Layout
+ *
+ * Strings take up only as many bytes as they hold.
+ * -------------------------------------------------------------------
+ * |    Id    | Username length | Username | Email length |  Email   |
+ * | (uint32) |     (uint8)     |  (chars) |   (uint8)    | (chars)  |
+ * -------------------------------------------------------------------
+ */
 static const uint32_t ID_SIZE = size_of_attribute(Row, id);
-static const uint32_t USERNAME_SIZE = size_of_attribute(Row, username);
-static const uint32_t EMAIL_SIZE = size_of_attribute(Row, email);
 static const uint32_t ID_OFFSET = 0;
-static const uint32_t USERNAME_OFFSET = ID_OFFSET + ID_SIZE;
-static const uint32_t EMAIL_OFFSET = USERNAME_OFFSET + USERNAME_SIZE;
-static const uint32_t ROW_SIZE = ID_SIZE + USERNAME_SIZE + EMAIL_SIZE;
+static const uint32_t ROW_FIELD_LENGTH_SIZE = sizeof(uint8_t);
+static const uint32_t ROW_MAX_SIZE = ID_SIZE + 2 * ROW_FIELD_LENGTH_SIZE +
+                                     COLUMN_USERNAME_SIZE + COLUMN_EMAIL_SIZE;
+
+/*
+ * Page size of new databases. Existing databases keep the page size stored in
+ * their header; any power of two in the range below can be chosen with -p.
+ */
+#define PAGER_DEFAULT_PAGE_SIZE 4096
+#define PAGER_MIN_PAGE_SIZE 4096
+#define PAGER_MAX_PAGE_SIZE 65536
+
+/* Default number of page frames in the buffer pool (~1.6 MB of pages) */
+#define PAGER_DEFAULT_MAX_FRAMES 400
+
+/* Smallest slab of page frames the arena maps at a time */
+#define PAGER_ARENA_MIN_SLAB_FRAMES 64
+
+/* Most adjacent dirty pages written back by a single pwritev() */
+#define PAGER_MAX_WRITE_RUN 256
+
+/* Pages a checkpoint copies out of the WAL per batch of writes */
+#define PAGER_CHECKPOINT_BATCH 64
 
-static const uint32_t PAGE_SIZE = 4096;
-#define TABLE_MAX_PAGES 400
+/* Leaves read ahead once a scan is found to walk the file sequentially */
+#define PAGER_DEFAULT_PREFETCH_DEPTH 32
+#define PAGER_MAX_PREFETCH_DEPTH 4096
+
+/* The read-only mapping of the database file grows in steps of this size */
+#define PAGER_MMAP_EXTENT (64 * 1024 * 1024)
 
 #define INVALID_PAGE_NUM UINT32_MAX
+#define INVALID_FRAME_NUM UINT32_MAX
+
+/**
+ * A frame is one slot of the buffer pool. It holds a single page of the
+ * database file along with the bookkeeping needed by the CLOCK eviction
+ * policy.
+ *
+ * Callers hold raw page pointers for the duration of a statement, so a page
+ * handed out to a thread since its last pager_unpin_all() must never be
+ * evicted. Each frame is stamped with the pager's epoch whenever it is handed
+ * out, and stays pinned while that stamp is no older than the epoch some
+ * thread using the pager last unpinned at (see PagerSession).
+ *
+ * Point lookups read pages without the table lock or a pin, and tell from
+ * the frame's version whether the page changed under them: the version is
+ * odd while a statement is writing the page, and moves on whenever the
+ * writer is done with it or the frame is given another page (see
+ * pager_read_optimistic()).
+ */
+typedef struct {
+  void *data;
+  uint32_t page_num; // INVALID_PAGE_NUM when the frame holds no page
+  uint32_t version;
+  uint64_t pin_epoch;
+  bool referenced; // CLOCK reference bit
+  bool dirty;      // Set by pager_mark_dirty(), cleared once written back
+} Frame;
+
+/* Statements committed to the WAL per fdatasync() */
+#define WAL_DEFAULT_COMMITS_PER_SYNC 32
+/* Longest a commit waits for the next fdatasync() to make it durable */
+#define WAL_MAX_SYNC_DELAY_MS 100
+/* Log size, in frames, that triggers a checkpoint at the next commit */
+#define WAL_DEFAULT_AUTO_CHECKPOINT 1000
+
+/*
+ * A page read without the table lock, to be checked with
+ * pager_validate_read() once the reader is done with it
+ */
+typedef struct {
+  void *page;
+  Frame *frame;
+  uint32_t version; // The frame's version when the read began
+} PageRead;
+
+/* Most threads that may be using a pager at the same time */
+#define PAGER_MAX_SESSIONS 64
+/*
+ * Most frames a buffer pool ever holds. The frames are reserved up front so
+ * that they never move under a thread reading them without the latch.
+ */
+#define PAGER_MAX_FRAMES (1 << 22)
+
+/*
+ * A thread using a pager. A session starts with the thread's first page
+ * request and lasts until pager_end_session(), usually at the end of a
+ * statement. Pages handed out to any thread since the oldest pin_epoch of
+ * an active session are pinned.
+ */
+typedef struct {
+  const void *owner;  // Identifies the thread, NULL while the slot is free
+  bool map_reads;     // See pager_begin_read()
+  uint64_t pin_epoch; // The pager's epoch at the last pager_unpin_all()
+  // Read-ahead of the thread's leaf-chain scan, see pager_readahead()
+  uint32_t readahead_last_page_num;
+  uint32_t readahead_end_page_num; // First page past the last hinted window
+} PagerSession;
+
+typedef struct {
+  char *filename;
+  int file_descriptor;
+  uint32_t page_size;
+  uint32_t salt;
+  uint32_t checksum[2]; // Running checksum as of the last frame appended
+  uint32_t num_frames;
+  uint32_t db_num_pages; // Database size recorded by the last commit frame
+  uint32_t committed_frames; // Frames up to and including the last commit
+
+  /* Maps a page number to its newest frame in the log, or INVALID_FRAME_NUM */
+  uint32_t *page_frames;
+  uint32_t page_frames_capacity;
 
+  uint32_t commits_since_sync;
+  uint32_t commits_per_sync;
+  struct timespec last_sync;
+  uint32_t auto_checkpoint;
+
+  uint32_t frames_written;
+  uint32_t syncs;
+} Wal;
+
+typedef enum { IO_BACKEND_POSIX, IO_BACKEND_URING } IoBackendType;
+
+/* Requests io_uring keeps in flight per io_uring_enter() */
+#define IO_URING_ENTRIES 64
+
+/* One vectored read or write of the database file */
 typedef struct {
+  bool write;
+  struct iovec *iov;
+  uint32_t iov_count;
+  off_t offset;
+  ssize_t result; // Bytes transferred, or -errno
+} IoRequest;
+
+typedef struct IoRing IoRing; // Submission and completion queues, see io.c
+
+/**
+ * How the pager reads and writes its file. Either backend may bypass the
+ * page cache with O_DIRECT, which requires buffers, offsets and lengths
+ * aligned to the device's block size; pages from the frame arena and page
+ * sized requests satisfy that.
+ */
+typedef struct {
+  IoBackendType type;
+  int file_descriptor;
+  bool direct;  // O_DIRECT is set on the file
+  IoRing *ring; // NULL unless type is IO_BACKEND_URING
+} IoBackend;
+
+/* A run of page frames mapped in one go by the pager's frame arena */
+typedef struct {
+  void *data;
+  size_t length;
+} ArenaSlab;
+
+typedef struct {
+  char *filename;
   int file_descriptor;
   uint32_t file_length;
   uint32_t num_pages;
-  void *pages[TABLE_MAX_PAGES];
+  Wal *wal; // NULL when the write-ahead log is disabled
+  IoBackend io;
+  bool in_transaction; // Statements are committed together at commit
+
+  /* Page layout, worked out from the header's page size at open time */
+  uint32_t page_size;
+  uint32_t internal_node_max_keys;
+
+  Frame *frames;
+  uint32_t num_frames; // Frames currently allocated
+  uint32_t max_frames; // Configured capacity of the buffer pool
+  uint32_t clock_hand;
+  uint64_t pin_epoch;
+
+  /*
+   * The buffer pool latch. Everything a reader may change in the pager, from
+   * the page table and frames on a cache miss to sessions and statistics, is
+   * only changed with the latch held. A hit on a cached page takes no latch:
+   * it pins the frame and then checks that the frame still holds the page
+   * (see pager_evict_frame()). Statements that write hold their table's lock
+   * exclusively and so never run alongside a reader.
+   */
+  pthread_mutex_t latch;
+  PagerSession sessions[PAGER_MAX_SESSIONS];
+  uint32_t num_sessions; // Session slots handed out so far
+
+  /* Maps a page number to the frame caching it, or INVALID_FRAME_NUM */
+  uint32_t *page_table;
+  uint32_t page_table_capacity;
+  /* Tables outgrown while a reader may still be using them, freed at close */
+  uint32_t **retired_page_tables;
+  uint32_t num_retired_page_tables;
+
+  /* Frames made odd by pager_mark_dirty() since the last pager_end_writes() */
+  uint32_t *written_frames;
+  uint32_t num_written_frames;
+  uint32_t written_frames_capacity;
+
+  /*
+   * Frame data is carved out of anonymous mappings rather than allocated page
+   * by page. Every page buffer is aligned to the system page size, slabs are
+   * never moved (pinned pages stay valid as the pool grows), and buffers of
+   * frames taken out of the pool wait on free_pages to be reused.
+   */
+  ArenaSlab *arena_slabs;
+  uint32_t num_arena_slabs;
+  void **free_pages;
+  uint32_t num_free_pages;
+  uint32_t free_pages_capacity;
+
+  /*
+   * Optional read-only mapping of the database file. While a session's
+   * map_reads is set (for the duration of a read-only statement), get_page
+   * returns it pages that are neither cached nor logged straight from the
+   * mapping.
+   */
+  bool mmap_enabled;
+  void *map;
+  size_t map_length;
+
+  /*
+   * Read-ahead for leaf-chain scans. prefetch_depth is the number of pages
+   * hinted to the kernel once leaves are visited in physical order, and 0
+   * disables read-ahead. Each session keeps track of its own scan.
+   */
+  uint32_t prefetch_depth;
+
+  /* I/O statistics, reported by .stats */
+  uint32_t pages_read;
+  uint32_t pages_mapped; // Page lookups served from the mapping
+  uint32_t pages_prefetched;
+  uint32_t pages_written;
+  uint32_t pages_skipped; // Clean cached pages a flush did not rewrite
+  uint32_t pages_flushed; // Dirty pages written back by the flusher
+  uint32_t checkpoints;
+  uint32_t pages_compressed; // Pages written to the file compressed
+
+  /*
+   * Whether pages are compressed as they are written to the file, see
+   * compress.c. Pages read back that are compressed are expanded either way.
+   */
+  bool compression;
 } Pager;
 
+/* How often the background flusher wakes up, see flusher.c */
+#define FLUSHER_INTERVAL_MS 100
+
 typedef struct {
   Pager *pager;
+  pthread_rwlock_t *table_lock;
+  pthread_t thread;
+  pthread_mutex_t mutex; // Guards pages_per_second and stop
+  pthread_cond_t wake;
+  uint32_t pages_per_second;
+  bool stop;
+  uint32_t next_page_num;  // Where writing dirty pages back carries on from
+  uint32_t frames_written; // The log's frames_written at the last wake-up
+} Flusher;
+
+typedef struct {
+  Pager *pager;
+  // Held shared by selects and exclusively by statements that write
+  pthread_rwlock_t lock;
   uint32_t root_page_num;
+  // Right-most leaf, so appends can skip the descent; INVALID_PAGE_NUM if
+  // not known yet
+  uint32_t last_leaf_page_num;
+  // Threads the REPL splits a select over a range of keys across, see scan.c
+  uint32_t scan_threads;
+  bool scan_ordered; // Whether those selects return their rows in key order
+  Flusher *flusher;  // The background flusher, or NULL if there is none
 } Table;
 
+/*
+ * A position in the table. Cursors are plain values owned by the caller,
+ * usually on the stack: table_find() and friends fill one in rather than
+ * allocating it.
+ */
 typedef struct {
   Table *table;
   uint32_t page_num;
@@ -86,8 +485,90 @@ typedef struct {
   bool end_of_table; // Indicates a position one past the last element
 } Cursor;
 
+/*
+ * A statement being run with query_step(), one result row at a time. A
+ * query either owns its statement, when made by query_prepare(), or runs
+ * one owned by the caller, when started with query_init().
+ */
+typedef struct {
+  Table *table;
+  Statement *statement;
+  Statement prepared; // The statement of a query made by query_prepare()
+  ExecuteResult result;
+  bool started;
+  bool done;
+  bool locked; // A select holds its table's lock from its first step on
+  bool lock_held; // The caller holds it instead, see query_init_locked()
+  Cursor cursor;     // The row of a select, once started
+  uint32_t key;      // The id of the current row
+  void *value;       // The current row, in its page or in row
+  uint32_t next_key; // Of a select ... in, the index of the key to look up
+  uint32_t locked_key; // Of a select ... in, next_key when it took the lock
+  uint32_t count;      // Of a select count(*), the row count
+  /* A row looked up without the table lock, serialized (so no larger) */
+  uint8_t row[sizeof(Row)];
+} Query;
+
+/*
+ * A parallel scan is cut into this many partitions per thread, so that
+ * threads finishing early have more to take, and (in key order) no more than
+ * SCAN_PARTITIONS_AHEAD per thread are scanned ahead of the rows written.
+ */
+#define SCAN_PARTITIONS_PER_THREAD 16
+#define SCAN_PARTITIONS_AHEAD 2
+#define SCAN_MAX_THREADS 32
+
+/* Bytes of result rows a Writer collects before handing them to its file */
+#define WRITER_BUFFER_SIZE (64 * 1024)
+
+/* Buffered output of result rows, see writer.c */
+typedef struct {
+  FILE *file;
+  uint32_t length;
+  char data[WRITER_BUFFER_SIZE];
+} Writer;
+
+/* Formats a row of a parallel scan, see scan_parallel() */
+typedef void (*ScanRowFunction)(Query *query, Writer *writer);
+
 typedef enum { NODE_INTERNAL, NODE_LEAF } NodeType;
 
+/*
+ * Page Header Layout
+ *
+ * Every page of the file, whatever it holds, starts with the CRC32C of the
+ * rest of the page (see checksum.c). It is set each time the page is written
+ * to the file and checked each time it is read back, so a page torn by a
+ * crash part way through its write is caught on the next read. A page of
+ * zeros, never written, passes.
+ * ------------------------------------------------------------
+ * | Checksum | Rest of the page ...                          |
+ * | (uint32) |                                               |
+ * ------------------------------------------------------------
+ */
+static const uint32_t PAGE_CHECKSUM_SIZE = sizeof(uint32_t);
+static const uint32_t PAGE_CHECKSUM_OFFSET = 0;
+static const uint32_t PAGE_HEADER_SIZE = PAGE_CHECKSUM_SIZE;
+
+/*
+ * Compressed Page Layout
+ *
+ * A page written to the file compressed (see compress.c) keeps its page
+ * header, whose checksum then covers the compressed page, zeros included.
+ * The marker cannot start a page as it is: it would be a node of no known
+ * type, or a freelist trunk pointing at a page past the last there can be.
+ * -----------------------------------------------------------------------
+ * | Page   |  Marker  |  Compressed size  | Compressed bytes | Zeros ... |
+ * | Header | (uint32) |     (uint32)      |                  |           |
+ * -----------------------------------------------------------------------
+ */
+static const uint32_t PAGE_COMPRESSED_MARKER = UINT32_MAX;
+static const uint32_t PAGE_COMPRESSED_MARKER_OFFSET = PAGE_HEADER_SIZE;
+static const uint32_t PAGE_COMPRESSED_SIZE_OFFSET = PAGE_HEADER_SIZE + 4;
+static const uint32_t PAGE_COMPRESSED_HEADER_SIZE = PAGE_HEADER_SIZE + 8;
+/* The unit in which a compressed page's slot gives back disk space */
+#define PAGE_COMPRESSION_BLOCK_SIZE 4096
+
 /**
  * Nodes need to store some metadata in a header at the beginning of the page.
  * Every node will store what type of node it is, whether or not it is the root
@@ -97,28 +578,30 @@ typedef enum { NODE_INTERNAL, NODE_LEAF } NodeType;
  * Little space inefficient to use an entire byte per boolean value in the
  * header, but this makes it easier to write code to access those values.
  * ------------------------------------------------------------
- * |            |           |                                 |
- * | Node Type  | Is Root?  |          Parent Pointer         |
- * |  (uint8)   |  (uint8)  |             (uint32)            |
- * |            |           |                                 |
+ * |             |            |           |                   |
+ * | Page Header | Node Type  | Is Root?  |  Parent Pointer   |
+ * |             |  (uint8)   |  (uint8)  |     (uint32)      |
+ * |             |            |           |                   |
  * ------------------------------------------------------------
  */
 
 static const uint32_t NODE_TYPE_SIZE = sizeof(uint8_t);
-static const uint32_t NODE_TYPE_OFFSET = 0;
+static const uint32_t NODE_TYPE_OFFSET = PAGE_HEADER_SIZE;
 static const uint32_t IS_ROOT_SIZE = sizeof(uint8_t);
-static const uint32_t IS_ROOT_OFFSET = NODE_TYPE_SIZE;
+static const uint32_t IS_ROOT_OFFSET = NODE_TYPE_OFFSET + NODE_TYPE_SIZE;
 static const uint32_t PARENT_POINTER_SIZE = sizeof(uint32_t);
 static const uint32_t PARENT_POINTER_OFFSET = IS_ROOT_OFFSET + IS_ROOT_SIZE;
 static const uint32_t COMMON_NODE_HEADER_SIZE =
-    NODE_TYPE_SIZE + IS_ROOT_SIZE + PARENT_POINTER_SIZE;
+    PAGE_HEADER_SIZE + NODE_TYPE_SIZE + IS_ROOT_SIZE + PARENT_POINTER_SIZE;
 
 /**
  * In addition to these common header fields, leaf nodes need to store how many
- * “cells” they contain. A cell is a key/value pair.
- * -------------------------------------------------
- * | Common Node Header | Number of cells (uint32) |
- * -------------------------------------------------
+ * “cells” they contain, their right sibling, and how many bytes of the page
+ * their rows take up. A cell is a key/value pair.
+ * ------------------------------------------------------------------------
+ * | Common Node Header | Number of cells | Next leaf | Content size       |
+ * |                    |    (uint32)     | (uint32)  |   (uint32)         |
+ * ------------------------------------------------------------------------
  */
 
 static const uint32_t LEAF_NODE_NUM_CELLS_SIZE = sizeof(uint32_t);
@@ -126,9 +609,12 @@ static const uint32_t LEAF_NODE_NUM_CELLS_OFFSET = COMMON_NODE_HEADER_SIZE;
 static const uint32_t LEAF_NODE_NEXT_LEAF_SIZE = sizeof(uint32_t);
 static const uint32_t LEAF_NODE_NEXT_LEAF_OFFSET =
     LEAF_NODE_NUM_CELLS_OFFSET + LEAF_NODE_NUM_CELLS_SIZE;
-static const uint32_t LEAF_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE +
-                                              LEAF_NODE_NUM_CELLS_SIZE +
-                                              LEAF_NODE_NEXT_LEAF_SIZE;
+static const uint32_t LEAF_NODE_CONTENT_SIZE_SIZE = sizeof(uint32_t);
+static const uint32_t LEAF_NODE_CONTENT_SIZE_OFFSET =
+    LEAF_NODE_NEXT_LEAF_OFFSET + LEAF_NODE_NEXT_LEAF_SIZE;
+static const uint32_t LEAF_NODE_HEADER_SIZE =
+    COMMON_NODE_HEADER_SIZE + LEAF_NODE_NUM_CELLS_SIZE +
+    LEAF_NODE_NEXT_LEAF_SIZE + LEAF_NODE_CONTENT_SIZE_SIZE;
 
 /*
  * Internal Node Header Layout
@@ -155,50 +641,150 @@ static const uint32_t INTERNAL_NODE_CHILD_SIZE = sizeof(uint32_t);
 static const uint32_t INTERNAL_NODE_CELL_SIZE =
     INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_SIZE;
 
-/* Keep this small for testing */
-static const uint32_t INTERNAL_NODE_MAX_CELLS = 3;
 
 /**
- * The body of a leaf node is an array of cells. Each cell is a key followed by
- * a value (a serialized row).
+ * The body of a leaf node is a slotted page. It starts with an array of
+ * fixed-size slots, one per cell and in key order, while the serialized rows
+ * they point to are packed against the end of the page. Free space is the gap
+ * in between, so rows can be any length.
+ * ----------------------------------------------------------------------
+ * | Header | Slot 0 | Slot 1 | ... |  free space  | ... | Row 1 | Row 0 |
+ * ----------------------------------------------------------------------
+ *
+ * Slot Layout
+ * ---------------------------------------------------------
+ * |  Key (uint32)  | Value offset (uint16) | Value size   |
+ * |                |                       |  (uint16)    |
+ * ---------------------------------------------------------
  */
-
 static const uint32_t LEAF_NODE_KEY_SIZE = sizeof(uint32_t);
 static const uint32_t LEAF_NODE_KEY_OFFSET = 0;
-static const uint32_t LEAF_NODE_VALUE_SIZE = ROW_SIZE;
-static const uint32_t LEAF_NODE_VALUE_OFFSET =
+static const uint32_t LEAF_NODE_VALUE_OFFSET_SIZE = sizeof(uint16_t);
+static const uint32_t LEAF_NODE_VALUE_OFFSET_OFFSET =
     LEAF_NODE_KEY_OFFSET + LEAF_NODE_KEY_SIZE;
-static const uint32_t LEAF_NODE_CELL_SIZE =
-    LEAF_NODE_KEY_SIZE + LEAF_NODE_VALUE_SIZE;
-static const uint32_t LEAF_NODE_SPACE_FOR_CELLS =
-    PAGE_SIZE - LEAF_NODE_HEADER_SIZE;
-static const uint32_t LEAF_NODE_MAX_CELLS =
-    LEAF_NODE_SPACE_FOR_CELLS / LEAF_NODE_CELL_SIZE;
+static const uint32_t LEAF_NODE_VALUE_SIZE_SIZE = sizeof(uint16_t);
+static const uint32_t LEAF_NODE_VALUE_SIZE_OFFSET =
+    LEAF_NODE_VALUE_OFFSET_OFFSET + LEAF_NODE_VALUE_OFFSET_SIZE;
+static const uint32_t LEAF_NODE_SLOT_SIZE = LEAF_NODE_KEY_SIZE +
+                                            LEAF_NODE_VALUE_OFFSET_SIZE +
+                                            LEAF_NODE_VALUE_SIZE_SIZE;
+
+/*
+ * A leaf is full once the next row does not fit in its free space. How many
+ * keys fit in an internal node depends on the page size, so that limit lives
+ * in the Pager (internal_node_max_keys) and is set by pager_open(). Internal
+ * nodes fill their page; building with TINYSQL_SMALL_FANOUT defined keeps
+ * them at three keys, so tests reach internal splits with a few rows.
+ */
+#define SMALL_FANOUT_INTERNAL_NODE_MAX_KEYS 3
 
-static const uint32_t LEAF_NODE_RIGHT_SPLIT_COUNT =
-    (LEAF_NODE_MAX_CELLS + 1) / 2;
-static const uint32_t LEAF_NODE_LEFT_SPLIT_COUNT =
-    (LEAF_NODE_MAX_CELLS + 1) - LEAF_NODE_RIGHT_SPLIT_COUNT;
+/*
+ * Database Header Layout
+ *
+ * Page 0 of the file holds the header, after the page header; the tree
+ * starts at the root page. Version 1 files had no page headers.
+ * ----------------------------------------------------------------------------
+ * | Page   | Magic    | Version  | Page     | Root     | Freelist | Freelist |
+ * | Header | (uint32) | (uint32) | size     | page     | head     | count    |
+ * |        |          |          | (uint32) | (uint32) | (uint32) | (uint32) |
+ * ----------------------------------------------------------------------------
+ */
+static const uint32_t DB_HEADER_MAGIC = 0x74734442; // "tsDB"
+static const uint32_t DB_HEADER_VERSION = 2;
+static const uint32_t DB_HEADER_PAGE_NUM = 0;
+static const uint32_t DB_HEADER_MAGIC_OFFSET = 4;
+static const uint32_t DB_HEADER_VERSION_OFFSET = 8;
+static const uint32_t DB_HEADER_PAGE_SIZE_OFFSET = 12;
+static const uint32_t DB_HEADER_ROOT_PAGE_OFFSET = 16;
+static const uint32_t DB_HEADER_FREELIST_HEAD_OFFSET = 20;
+static const uint32_t DB_HEADER_FREELIST_COUNT_OFFSET = 24;
+static const uint32_t DB_HEADER_SIZE = 28;
 
-/* Keep this small for testing */
-static const uint32_t INTERNAL_NODE_MAX_KEYS = 3;
+/*
+ * Freelist Trunk Page Layout
+ *
+ * Free pages are kept in a chain of trunk pages starting at the header's
+ * freelist head (0 when there are no free pages). Each trunk lists more free
+ * pages; the trunks are free pages themselves and are handed out last.
+ * ------------------------------------------------------------
+ * | Page   | Next trunk | Number of entries | Free page numbers ... |
+ * | Header |  (uint32)  |      (uint32)     |     (uint32 each)     |
+ * ------------------------------------------------------------
+ */
+static const uint32_t FREELIST_TRUNK_NEXT_OFFSET = 4;
+static const uint32_t FREELIST_TRUNK_NUM_ENTRIES_OFFSET = 8;
+static const uint32_t FREELIST_TRUNK_HEADER_SIZE = 12;
+
+/* Share of each node .import fills, leaving room for later inserts */
+#define IMPORT_DEFAULT_FILL_FACTOR 0.9
 
 // Function declarations for input.c
 InputBuffer *new_input_buffer();
 void print_prompt();
 void read_input(InputBuffer *input_buffer);
 void close_input_buffer(InputBuffer *input_buffer);
+ScriptReader *script_open(const char *filename);
+bool script_read_line(ScriptReader *reader, InputBuffer *input_buffer);
+void script_close(ScriptReader *reader);
 
 // Function declarations for pager.c
-Pager *pager_open(const char *filename);
+Pager *pager_open(const char *filename, uint32_t page_size);
+uint32_t *header_root_page_num(void *header);
+uint32_t *header_freelist_head(void *header);
+uint32_t *header_freelist_count(void *header);
+void pager_truncate(Pager *pager, uint32_t num_pages);
 void *get_page(Pager *pager, uint32_t page_num);
+void pager_mark_dirty(Pager *pager, uint32_t page_num);
+void pager_end_writes(Pager *pager);
+bool pager_read_optimistic(Pager *pager, uint32_t page_num, PageRead *read);
+bool pager_validate_read(PageRead *read);
 void pager_flush(Pager *pager, uint32_t page_num);
+void pager_flush_dirty(Pager *pager);
+uint32_t pager_flush_some(Pager *pager, uint32_t page_num,
+                          uint32_t max_pages);
+void pager_commit(Pager *pager);
+void pager_begin_transaction(Pager *pager);
+void pager_commit_transaction(Pager *pager);
+void pager_checkpoint(Pager *pager);
+void pager_set_wal_enabled(Pager *pager, bool enabled);
+void pager_unpin_all(Pager *pager);
+void pager_end_session(Pager *pager);
+void pager_set_mmap_enabled(Pager *pager, bool enabled);
+void pager_begin_read(Pager *pager);
+void pager_prefetch(Pager *pager, uint32_t page_num, uint32_t count);
+void pager_readahead(Pager *pager, uint32_t page_num, uint32_t next_page_num);
+void pager_end_read(Pager *pager);
+void pager_set_max_frames(Pager *pager, uint32_t max_frames);
+void pager_set_io(Pager *pager, IoBackendType type, bool direct);
 void db_close(Table *table);
 
+// Function declarations for io.c
+void io_open(IoBackend *io, int file_descriptor, IoBackendType type,
+             bool direct);
+void io_close(IoBackend *io);
+ssize_t io_read(IoBackend *io, void *buffer, size_t length, off_t offset);
+void io_submit(IoBackend *io, IoRequest *requests, uint32_t count);
+bool io_punch_hole(IoBackend *io, off_t offset, off_t length);
+
+// Function declarations for wal.c
+Wal *wal_open(const char *db_filename, uint32_t page_size);
+uint32_t wal_find_frame(Wal *wal, uint32_t page_num);
+void wal_read_frame(Wal *wal, uint32_t frame_num, void *destination);
+void wal_append_frame(Wal *wal, uint32_t page_num, void *page,
+                      uint32_t commit_num_pages);
+void wal_sync(Wal *wal);
+void wal_commit(Wal *wal);
+void wal_reset(Wal *wal);
+void wal_close(Wal *wal, bool remove_file);
+
 // Function declarations for table.c
-Table *db_open(const char *filename);
-Cursor *table_start(Table *table);
-Cursor *table_find(Table *table, uint32_t key);
+Table *db_open(const char *filename, uint32_t page_size);
+void table_start(Table *table, Cursor *cursor);
+void table_seek(Table *table, uint32_t key, Cursor *cursor);
+void table_find(Table *table, uint32_t key, Cursor *cursor);
+bool table_find_append(Table *table, uint32_t key, Cursor *cursor);
+LookupResult table_lookup(Table *table, uint32_t key, void *row,
+                          uint32_t *row_size);
 void create_new_root(Table *table, uint32_t right_child_page_num);
 
 // Function declarations for node.c
@@ -212,44 +798,141 @@ uint32_t *internal_node_num_keys(void *node);
 uint32_t *internal_node_right_child(void *node);
 uint32_t *internal_node_child(void *node, uint32_t child_num);
 uint32_t *internal_node_key(void *node, uint32_t key_num);
+uint32_t *internal_node_cell(void *node, uint32_t cell_num);
 uint32_t *leaf_node_num_cells(void *node);
 uint32_t *leaf_node_next_leaf(void *node);
+uint32_t *leaf_node_content_size(void *node);
 void *leaf_node_cell(void *node, uint32_t cell_num);
 void *leaf_node_key(void *node, uint32_t cell_num);
+uint16_t *leaf_node_value_offset(void *node, uint32_t cell_num);
+uint16_t *leaf_node_value_size(void *node, uint32_t cell_num);
 void *leaf_node_value(void *node, uint32_t cell_num);
+uint32_t leaf_node_free_space(Pager *pager, void *node);
+void leaf_node_insert_value(Pager *pager, void *node, uint32_t cell_num,
+                            uint32_t key, void *value, uint32_t value_size);
+void leaf_node_remove_cell(Pager *pager, void *node, uint32_t cell_num);
+void leaf_node_delete(Cursor *cursor);
+void leaf_node_update(Cursor *cursor, Row *value);
 void internal_node_split_and_insert(Table *table, uint32_t parent_page_num,
                                     uint32_t child_page_num);
 void internal_node_insert(Table *table, uint32_t parent_page_num,
                           uint32_t child_page_num);
 void update_internal_node_key(void *node, uint32_t old_key, uint32_t new_key);
 uint32_t get_node_max_key(Pager *pager, void *node);
+bool is_node_root(void *node);
 void set_node_root(void *node, bool is_root);
 uint32_t *node_parent(void *node);
 
 // Function declarations for execute.c
 ExecuteResult execute_insert(Statement *statement, Table *table);
-ExecuteResult execute_select(Statement *statement, Table *table);
+ExecuteResult execute_delete(Statement *statement, Table *table);
+ExecuteResult execute_update(Statement *statement, Table *table);
 ExecuteResult execute_statement(Statement *statement, Table *table);
 
+// Function declarations for query.c
+void query_init(Query *query, Table *table, Statement *statement);
+void query_init_locked(Query *query, Table *table, Statement *statement);
+PrepareResult query_prepare(Table *table, const char *text, Query **query);
+PrepareResult query_bind_text(Query *query, uint32_t index, const char *text,
+                              uint32_t length);
+PrepareResult query_bind_int(Query *query, uint32_t index, int value);
+StepResult query_step(Query *query);
+ExecuteResult query_result(Query *query);
+uint32_t query_column_count(Query *query);
+ColumnType query_column_type(Query *query, uint32_t column);
+uint32_t query_column_int(Query *query, uint32_t column);
+const char *query_column_text(Query *query, uint32_t column,
+                              uint32_t *length);
+void query_reset(Query *query);
+void query_finalize(Query *query);
+
 // Function declarations for statement.c
-PrepareResult prepare_insert(InputBuffer *input_buffer, Statement *statement);
-PrepareResult prepare_statement(InputBuffer *input_buffer,
-                                Statement *statement);
+PrepareResult prepare_statement(const char *text, Statement *statement);
+PrepareResult prepare_row(char *id_string, char *username, char *email,
+                          Row *row);
+void statement_free(Statement *statement);
+PrepareResult statement_bind_text(Statement *statement, uint32_t index,
+                                  const char *text, uint32_t length);
+PrepareResult statement_bind_int(Statement *statement, uint32_t index,
+                                 int value);
+void statement_cache_init(StatementCache *cache);
+Statement *statement_cache_find(StatementCache *cache, const char *name,
+                                uint32_t length);
+Statement *statement_cache_add(StatementCache *cache, const char *name,
+                               uint32_t length);
+bool statement_cache_remove(StatementCache *cache, const char *name,
+                            uint32_t length);
+void statement_cache_free(StatementCache *cache);
+
+// Function declarations for tokenizer.c
+void tokenizer_init(Tokenizer *tokenizer, const char *input);
+const char *tokenizer_rest(Tokenizer *tokenizer);
+Token tokenizer_next(Tokenizer *tokenizer);
+Token tokenizer_next_value(Tokenizer *tokenizer);
+bool token_is(Token *token, const char *word);
+
+// Function declarations for freelist.c
+uint32_t get_unused_page_num(Pager *pager);
+void free_page_num(Pager *pager, uint32_t page_num);
+
+// Function declarations for search.c
+uint32_t key_search(const void *keys, uint32_t num_keys, uint32_t key);
+const char *key_search_name();
+
+// Function declarations for checksum.c
+uint32_t crc32c(const void *data, size_t length);
+const char *crc32c_name();
+void page_set_checksum(void *page, uint32_t page_size);
+bool page_checksum_matches(const void *page, uint32_t page_size);
+
+// Function declarations for compress.c
+uint32_t page_compress(const void *page, void *stored, uint32_t page_size);
+bool page_is_compressed(const void *page);
+bool page_decompress(void *page, uint32_t page_size);
+
+// Function declarations for writer.c
+void writer_init(Writer *writer, FILE *file);
+void writer_flush(Writer *writer);
+void writer_bytes(Writer *writer, const void *bytes, uint32_t length);
+void writer_string(Writer *writer, const char *string);
+void writer_uint(Writer *writer, uint32_t value);
+
+// Function declarations for scan.c
+bool scan_is_parallel(Table *table, Statement *statement);
+void scan_parallel(Table *table, Statement *statement, FILE *file,
+                   ScanRowFunction row_function);
+
+// Function declarations for flusher.c
+void flusher_set_rate(Table *table, uint32_t pages_per_second);
+void flusher_stop(Table *table);
+
+// Function declarations for integrity.c
+uint32_t table_integrity_check(Table *table, uint32_t num_threads);
+
+// Function declarations for import.c
+ImportResult table_import(Table *table, const char *filename,
+                          double fill_factor, uint32_t *rows_imported,
+                          uint32_t *error_line);
+void table_vacuum(Table *table);
 
 // Other function declarations
 void print_row(Row *row);
-void serialize_row(Row *source, void *destination);
+uint32_t row_serialized_size(Row *row);
+uint32_t serialize_row(Row *source, void *destination);
 void deserialize_row(void *source, Row *destination);
-void print_constants();
+const char *row_string_column(void *source, Column column, uint8_t *length);
+void print_constants(Pager *pager);
 void print_tree(Pager *pager, uint32_t page_num, uint32_t indentation_level);
 void indent(uint32_t level);
 MetaCommandResult do_meta_command(InputBuffer *input_buffer, Table *table);
 void cursor_advance(Cursor *cursor);
+uint32_t cursor_key(Cursor *cursor);
 void *cursor_value(Cursor *cursor);
-uint32_t get_unused_page_num(Pager *pager);
 
-Cursor *leaf_node_find(Table *table, uint32_t page_num, uint32_t key);
-Cursor *internal_node_find(Table *table, uint32_t page_num, uint32_t key);
+void leaf_node_find(Table *table, uint32_t page_num, uint32_t key,
+                    Cursor *cursor);
+void internal_node_find(Table *table, uint32_t page_num, uint32_t key,
+                        Cursor *cursor);
 uint32_t internal_node_find_child(void *node, uint32_t key);
 
 #endif
\ No newline at end of file
@@ -1,93 +1,159 @@
 #include "db.h"
 
-ExecuteResult execute_insert(Statement *statement, Table *table) {
-  void *node = get_page(table->pager, table->root_page_num);
-  uint32_t num_cells = *(uint32_t *)leaf_node_num_cells(node);
-
-  Row *row_to_insert = &(statement->row_to_insert);
-
-  uint32_t key_to_insert = row_to_insert->id;
-  Cursor *cursor = table_find(table, key_to_insert);
+/*
+ * Position cursor at key, which is larger than any key the cursor was last
+ * positioned at. The search stays in the cursor's leaf while key still
+ * belongs there, so sorted keys that land in the same leaf walk the tree
+ * once between them.
+ */
+static void table_find_next(Table *table, uint32_t key, Cursor *cursor) {
+  if (cursor->page_num != INVALID_PAGE_NUM) {
+    void *node = get_page(table->pager, cursor->page_num);
+    if (get_node_type(node) == NODE_LEAF) {
+      uint32_t num_cells = *leaf_node_num_cells(node);
+      if (*leaf_node_next_leaf(node) == 0 ||
+          (num_cells > 0 &&
+           *(uint32_t *)leaf_node_key(node, num_cells - 1) >= key)) {
+        leaf_node_find(table, cursor->page_num, key, cursor);
+        return;
+      }
+    }
+  }
+  table_find(table, key, cursor);
+}
 
-  // if the position in which the key needs to be inserted lies in between the
-  // cells, check for duplicate keys
-  if (cursor->cell_num < num_cells) {
-    uint32_t key_at_index = *(uint32_t *)leaf_node_key(node, cursor->cell_num);
-    if (key_at_index == key_to_insert) {
+/*
+ * insert into ... values with several rows. The rows are sorted by id, and
+ * all of them are checked before any is inserted, so a duplicate id leaves
+ * the table as it was.
+ */
+static ExecuteResult execute_insert_rows(Statement *statement, Table *table) {
+  Cursor cursor;
+  cursor.page_num = INVALID_PAGE_NUM;
+  for (uint32_t i = 0; i < statement->num_rows; i++) {
+    uint32_t key = statement->rows[i].id;
+    if (i > 0 && statement->rows[i - 1].id == key) {
+      return EXECUTE_DUPLICATE_KEY;
+    }
+    table_find_next(table, key, &cursor);
+    void *node = get_page(table->pager, cursor.page_num);
+    if (cursor.cell_num < *leaf_node_num_cells(node) &&
+        *(uint32_t *)leaf_node_key(node, cursor.cell_num) == key) {
       return EXECUTE_DUPLICATE_KEY;
     }
   }
 
-  leaf_node_insert(cursor, row_to_insert->id, row_to_insert);
-
-  free(cursor);
+  cursor.page_num = INVALID_PAGE_NUM;
+  for (uint32_t i = 0; i < statement->num_rows; i++) {
+    Row *row = &statement->rows[i];
+    table_find_next(table, row->id, &cursor);
+    leaf_node_insert(&cursor, row->id, row);
+  }
 
   return EXECUTE_SUCCESS;
 }
 
-ExecuteResult execute_select(Statement *statement, Table *table) {
-  Cursor *cursor = table_start(table);
+ExecuteResult execute_insert(Statement *statement, Table *table) {
+  if (statement->rows != NULL) {
+    return execute_insert_rows(statement, table);
+  }
+  Row *row_to_insert = &(statement->row_to_insert);
+
+  uint32_t key_to_insert = row_to_insert->id;
+  Cursor cursor;
+  // Increasing ids go straight to the right-most leaf
+  if (!table_find_append(table, key_to_insert, &cursor)) {
+    table_find(table, key_to_insert, &cursor);
+
+    void *node = get_page(table->pager, cursor.page_num);
+    uint32_t num_cells = *leaf_node_num_cells(node);
+
+    // if the position in which the key needs to be inserted lies in between
+    // the cells, check for duplicate keys
+    if (cursor.cell_num < num_cells) {
+      uint32_t key_at_index = *(uint32_t *)leaf_node_key(node, cursor.cell_num);
+      if (key_at_index == key_to_insert) {
+        return EXECUTE_DUPLICATE_KEY;
+      }
+    }
 
-  Row row;
-  while (!(cursor->end_of_table)) {
-    deserialize_row(cursor_value(cursor), &row);
-    print_row(&row);
-    cursor_advance(cursor);
+    if (*leaf_node_next_leaf(node) == 0) {
+      table->last_leaf_page_num = cursor.page_num;
+    }
   }
 
-  free(cursor);
+  leaf_node_insert(&cursor, row_to_insert->id, row_to_insert);
 
   return EXECUTE_SUCCESS;
 }
 
-ExecuteResult execute_statement(Statement *statement, Table *table) {
-  switch (statement->type) {
-  case (STATEMENT_INSERT):
-    return execute_insert(statement, table);
-  case (STATEMENT_SELECT):
-    return execute_select(statement, table);
-  }
+/*
+ * Position cursor at the given key. Returns false if the table does not hold
+ * it.
+ */
+static bool table_find_existing(Table *table, uint32_t key, Cursor *cursor) {
+  table_find(table, key, cursor);
+  void *node = get_page(table->pager, cursor->page_num);
+  return cursor->cell_num < *leaf_node_num_cells(node) &&
+         *(uint32_t *)leaf_node_key(node, cursor->cell_num) == key;
 }
 
-PrepareResult prepare_statement(InputBuffer *input_buffer,
-                                Statement *statement) {
-  if (strncmp(input_buffer->buffer, "insert", 6) == 0) {
-    return prepare_insert(input_buffer, statement);
-  }
-  if (strcmp(input_buffer->buffer, "select") == 0) {
-    statement->type = STATEMENT_SELECT;
-    return PREPARE_SUCCESS;
+ExecuteResult execute_delete(Statement *statement, Table *table) {
+  Cursor cursor;
+  if (!table_find_existing(table, statement->key_low, &cursor)) {
+    return EXECUTE_KEY_NOT_FOUND;
   }
 
-  return PREPARE_UNRECOGNIZED_STATEMENT;
+  leaf_node_delete(&cursor);
+
+  return EXECUTE_SUCCESS;
 }
 
-PrepareResult prepare_insert(InputBuffer *input_buffer, Statement *statement) {
-  statement->type = STATEMENT_INSERT;
+ExecuteResult execute_update(Statement *statement, Table *table) {
+  Row *row_to_update = &(statement->row_to_insert);
+  Cursor cursor;
+  if (!table_find_existing(table, row_to_update->id, &cursor)) {
+    return EXECUTE_KEY_NOT_FOUND;
+  }
 
-  char *keyword = strtok(input_buffer->buffer, " ");
-  char *id_string = strtok(NULL, " ");
-  char *username = strtok(NULL, " ");
-  char *email = strtok(NULL, " ");
+  leaf_node_update(&cursor, row_to_update);
 
-  if (id_string == NULL || username == NULL || email == NULL) {
-    return PREPARE_SYNTAX_ERROR;
-  }
+  return EXECUTE_SUCCESS;
+}
 
-  int id = atoi(id_string);
-  if (id < 0) {
-    return PREPARE_NEGATIVE_ID;
-  }
-  if (strlen(username) > COLUMN_USERNAME_SIZE) {
-    return PREPARE_STRING_TOO_LONG;
-  }
-  if (strlen(email) > COLUMN_EMAIL_SIZE) {
-    return PREPARE_STRING_TOO_LONG;
+ExecuteResult execute_statement(Statement *statement, Table *table) {
+  // Pages handed out to the previous statement may be evicted again
+  pager_unpin_all(table->pager);
+
+  ExecuteResult result = EXECUTE_SUCCESS;
+  switch (statement->type) {
+  case (STATEMENT_INSERT):
+    result = execute_insert(statement, table);
+    break;
+  case (STATEMENT_SELECT):
+    // Selects return rows, and are stepped through with query_step()
+    return EXECUTE_SUCCESS;
+  case (STATEMENT_DELETE):
+    result = execute_delete(statement, table);
+    break;
+  case (STATEMENT_UPDATE):
+    result = execute_update(statement, table);
+    break;
+  case (STATEMENT_BEGIN):
+    if (table->pager->in_transaction) {
+      return EXECUTE_IN_TRANSACTION;
+    }
+    pager_begin_transaction(table->pager);
+    return EXECUTE_SUCCESS;
+  case (STATEMENT_COMMIT):
+    if (!table->pager->in_transaction) {
+      return EXECUTE_NO_TRANSACTION;
+    }
+    pager_commit_transaction(table->pager);
+    return EXECUTE_SUCCESS;
   }
 
-  statement->row_to_insert.id = id;
-  strcpy(statement->row_to_insert.username, username);
-  strcpy(statement->row_to_insert.email, email);
+  pager_commit(table->pager);
 
-  return PREPARE_SUCCESS;
-}
\ No newline at end of file
+  return result;
+}
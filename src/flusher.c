@@ -0,0 +1,138 @@
+#include "db.h"
+
+/*
+ * The background flusher.
+ *
+ * Without it, dirty pages are written back only once they are evicted or
+ * the database is closed, and the log is checkpointed by whichever commit
+ * fills it; the reader evicting a page, the writer committing and .exit all
+ * wait on that I/O. The flusher is a thread that wakes every
+ * FLUSHER_INTERVAL_MS and does some of it ahead of time:
+ *
+ * - Without the WAL it writes back up to its rate's worth of dirty pages,
+ *   sweeping the database in page order, so that most pages are clean by
+ *   the time they are evicted.
+ * - With the WAL, committed pages are never dirty; instead it checkpoints
+ *   the log once it is half way to the size at which a commit would, or
+ *   once no frame has been appended since its last wake-up. Otherwise it
+ *   syncs the log if commits are waiting on it, so that they do not wait
+ *   for the next commit.
+ *
+ * It holds the table's lock shared while it works, which keeps statements
+ * that write out but not selects, and the pager's latch only while it
+ * writes pages, so the pages it writes can neither change nor be evicted
+ * meanwhile. It does nothing inside a transaction.
+ */
+
+/* One round of work, with the table lock held */
+static void flusher_work(Flusher *flusher, uint32_t max_pages) {
+  Pager *pager = flusher->pager;
+  if (pager->in_transaction) {
+    return;
+  }
+
+  Wal *wal = pager->wal;
+  if (wal == NULL) {
+    flusher->next_page_num =
+        pager_flush_some(pager, flusher->next_page_num, max_pages);
+    return;
+  }
+
+  bool idle = wal->frames_written == flusher->frames_written;
+  flusher->frames_written = wal->frames_written;
+  if (wal->num_frames > 0 &&
+      (idle || wal->num_frames >= wal->auto_checkpoint / 2)) {
+    pager_checkpoint(pager);
+  } else {
+    wal_sync(wal);
+  }
+}
+
+static void *flusher_run(void *argument) {
+  Flusher *flusher = argument;
+
+  pthread_mutex_lock(&flusher->mutex);
+  while (!flusher->stop) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += FLUSHER_INTERVAL_MS * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(&flusher->wake, &flusher->mutex, &deadline);
+    if (flusher->stop) {
+      break;
+    }
+    uint32_t max_pages =
+        (uint64_t)flusher->pages_per_second * FLUSHER_INTERVAL_MS / 1000;
+    pthread_mutex_unlock(&flusher->mutex);
+
+    pthread_rwlock_rdlock(flusher->table_lock);
+    flusher_work(flusher, max_pages ? max_pages : 1);
+    pthread_rwlock_unlock(flusher->table_lock);
+
+    pthread_mutex_lock(&flusher->mutex);
+  }
+  pthread_mutex_unlock(&flusher->mutex);
+  return NULL;
+}
+
+/**
+ * Start the background flusher, change its rate, or stop it.
+ *
+ * @param table the table whose pager to flush
+ * @param pages_per_second the most dirty pages to write back a second, or 0
+ * to stop the flusher
+ */
+void flusher_set_rate(Table *table, uint32_t pages_per_second) {
+  if (pages_per_second == 0) {
+    flusher_stop(table);
+    return;
+  }
+
+  Flusher *flusher = table->flusher;
+  if (flusher != NULL) {
+    pthread_mutex_lock(&flusher->mutex);
+    flusher->pages_per_second = pages_per_second;
+    pthread_mutex_unlock(&flusher->mutex);
+    return;
+  }
+
+  flusher = malloc(sizeof(Flusher));
+  flusher->pager = table->pager;
+  flusher->table_lock = &table->lock;
+  pthread_mutex_init(&flusher->mutex, NULL);
+  pthread_cond_init(&flusher->wake, NULL);
+  flusher->pages_per_second = pages_per_second;
+  flusher->stop = false;
+  flusher->next_page_num = 0;
+  flusher->frames_written = 0;
+  if (pthread_create(&flusher->thread, NULL, flusher_run, flusher) != 0) {
+    printf("Error: could not start the flusher thread.\n");
+    exit(EXIT_FAILURE);
+  }
+  table->flusher = flusher;
+}
+
+/*
+ * Stop the flusher, if there is one, waiting for it to finish what it is
+ * doing. The caller must not hold the table lock.
+ */
+void flusher_stop(Table *table) {
+  Flusher *flusher = table->flusher;
+  if (flusher == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&flusher->mutex);
+  flusher->stop = true;
+  pthread_cond_signal(&flusher->wake);
+  pthread_mutex_unlock(&flusher->mutex);
+  pthread_join(flusher->thread, NULL);
+
+  pthread_cond_destroy(&flusher->wake);
+  pthread_mutex_destroy(&flusher->mutex);
+  free(flusher);
+  table->flusher = NULL;
+}
@@ -0,0 +1,90 @@
+#include "db.h"
+
+/*
+ * Free page list.
+ *
+ * Pages that no longer belong to the tree are recorded in the freelist
+ * rooted in the database header (see the trunk page layout in db.h), and new
+ * pages are taken from it before the file is grown.
+ */
+
+static uint32_t *freelist_trunk_next(void *trunk) {
+  return trunk + FREELIST_TRUNK_NEXT_OFFSET;
+}
+
+static uint32_t *freelist_trunk_num_entries(void *trunk) {
+  return trunk + FREELIST_TRUNK_NUM_ENTRIES_OFFSET;
+}
+
+static uint32_t *freelist_trunk_entry(void *trunk, uint32_t entry_num) {
+  return trunk + FREELIST_TRUNK_HEADER_SIZE + entry_num * sizeof(uint32_t);
+}
+
+static uint32_t freelist_trunk_max_entries(Pager *pager) {
+  return (pager->page_size - FREELIST_TRUNK_HEADER_SIZE) / sizeof(uint32_t);
+}
+
+/**
+ * Return a page number for a new page: a recycled free page if there is
+ * one, otherwise the page just past the end of the database file. The
+ * caller must fetch the page and initialize it before asking for another.
+ *
+ * @param pager the pager to allocate from
+ *
+ * @return the page number to use
+ */
+uint32_t get_unused_page_num(Pager *pager) {
+  void *header = get_page(pager, DB_HEADER_PAGE_NUM);
+  uint32_t trunk_page_num = *header_freelist_head(header);
+  if (trunk_page_num == 0) {
+    return pager->num_pages;
+  }
+
+  void *trunk = get_page(pager, trunk_page_num);
+  pager_mark_dirty(pager, DB_HEADER_PAGE_NUM);
+  (*header_freelist_count(header))--;
+
+  uint32_t num_entries = *freelist_trunk_num_entries(trunk);
+  if (num_entries > 0) {
+    pager_mark_dirty(pager, trunk_page_num);
+    *freelist_trunk_num_entries(trunk) = num_entries - 1;
+    return *freelist_trunk_entry(trunk, num_entries - 1);
+  }
+
+  // An empty trunk is handed out itself
+  *header_freelist_head(header) = *freelist_trunk_next(trunk);
+  return trunk_page_num;
+}
+
+/**
+ * Give a page that is no longer part of the tree back to the freelist. The
+ * page is either listed in the first trunk or, when that is full, becomes
+ * the new first trunk.
+ *
+ * @param pager the pager the page belongs to
+ * @param page_num the page to free
+ */
+void free_page_num(Pager *pager, uint32_t page_num) {
+  void *header = get_page(pager, DB_HEADER_PAGE_NUM);
+  uint32_t trunk_page_num = *header_freelist_head(header);
+  pager_mark_dirty(pager, DB_HEADER_PAGE_NUM);
+  (*header_freelist_count(header))++;
+
+  if (trunk_page_num != 0) {
+    void *trunk = get_page(pager, trunk_page_num);
+    uint32_t num_entries = *freelist_trunk_num_entries(trunk);
+    if (num_entries < freelist_trunk_max_entries(pager)) {
+      pager_mark_dirty(pager, trunk_page_num);
+      *freelist_trunk_entry(trunk, num_entries) = page_num;
+      *freelist_trunk_num_entries(trunk) = num_entries + 1;
+      return;
+    }
+  }
+
+  void *page = get_page(pager, page_num);
+  pager_mark_dirty(pager, page_num);
+  memset(page, 0, pager->page_size);
+  *freelist_trunk_next(page) = trunk_page_num;
+  *freelist_trunk_num_entries(page) = 0;
+  *header_freelist_head(header) = page_num;
+}
@@ -0,0 +1,442 @@
+#include "db.h"
+
+/*
+ * Bulk loader behind the .import and .vacuum meta commands.
+ *
+ * Rather than inserting rows one at a time, which re-descends the tree and
+ * splits leaves 50/50 for every full leaf, .import builds the whole B-tree
+ * bottom-up from sorted input. Leaves are packed with rows, in key order, up
+ * to the requested fill factor of their space, and every node's page number
+ * is worked out up front, so each page is
+ * written exactly once and in file order: first all leaves, then each
+ * internal level, and finally the root into the root page.
+ *
+ * The input holds one row per line: an id, a username and an email,
+ * separated by spaces, tabs or commas. Already sorted input is streamed from
+ * the file; otherwise it is read into memory and sorted first.
+ *
+ * .vacuum uses the same builder to copy a table, in key order, into a
+ * scratch database with full leaves, and then copies that back over the
+ * table's file.
+ */
+
+#define IMPORT_MAX_LEVELS 32
+
+static const char *IMPORT_FIELD_SEPARATORS = " \t,\r\n";
+
+typedef struct {
+  FILE *file;     // Streaming from a file that is already sorted,
+  Row *rows;      // from rows sorted in memory,
+  Cursor *cursor; // or from the rows of another table
+  uint32_t next_row;
+  char *line;
+  size_t line_capacity;
+} ImportSource;
+
+/* The number of rows in every leaf, found by packing the rows in key order */
+typedef struct {
+  uint32_t fill_size; // Bytes of a leaf to fill before starting the next
+  uint32_t leaf_size; // Bytes used in the last leaf so far
+  uint32_t *row_counts;
+  uint32_t num_leaves;
+  uint32_t row_counts_capacity;
+} ImportLeaves;
+
+/*
+ * Read the next non-empty line of file into row. Returns false at end of file
+ * and sets *result when the line does not parse.
+ */
+static bool import_read_row(FILE *file, char **line, size_t *line_capacity,
+                            Row *row, PrepareResult *result) {
+  while (getline(line, line_capacity, file) != -1) {
+    char *id_string = strtok(*line, IMPORT_FIELD_SEPARATORS);
+    if (id_string == NULL) {
+      continue;
+    }
+    char *username = strtok(NULL, IMPORT_FIELD_SEPARATORS);
+    char *email = strtok(NULL, IMPORT_FIELD_SEPARATORS);
+
+    *result = prepare_row(id_string, username, email, row);
+    if (*result == PREPARE_SUCCESS &&
+        strtok(NULL, IMPORT_FIELD_SEPARATORS) != NULL) {
+      *result = PREPARE_SYNTAX_ERROR;
+    }
+    return true;
+  }
+  return false;
+}
+
+static void import_source_next(ImportSource *source, Row *row) {
+  if (source->rows) {
+    *row = source->rows[source->next_row++];
+    return;
+  }
+  if (source->cursor) {
+    deserialize_row(cursor_value(source->cursor), row);
+    pager_unpin_all(source->cursor->table->pager);
+    cursor_advance(source->cursor);
+    return;
+  }
+
+  PrepareResult result;
+  import_read_row(source->file, &source->line, &source->line_capacity, row,
+                  &result);
+}
+
+static void import_reset_leaves(ImportLeaves *leaves) {
+  leaves->leaf_size = 0;
+  leaves->num_leaves = 0;
+}
+
+/*
+ * Add the next row in key order to the last leaf, or start a new leaf if it
+ * would fill the last one past fill_size. Every leaf gets at least one row.
+ */
+static void import_pack_row(ImportLeaves *leaves, Row *row) {
+  uint32_t size = LEAF_NODE_SLOT_SIZE + row_serialized_size(row);
+  if (leaves->num_leaves == 0 ||
+      (leaves->leaf_size > 0 && leaves->leaf_size + size > leaves->fill_size)) {
+    if (leaves->num_leaves == leaves->row_counts_capacity) {
+      leaves->row_counts_capacity =
+          leaves->row_counts_capacity ? leaves->row_counts_capacity * 2 : 64;
+      leaves->row_counts = realloc(
+          leaves->row_counts, leaves->row_counts_capacity * sizeof(uint32_t));
+    }
+    leaves->row_counts[leaves->num_leaves++] = 0;
+    leaves->leaf_size = 0;
+  }
+
+  leaves->row_counts[leaves->num_leaves - 1]++;
+  leaves->leaf_size += size;
+}
+
+static int compare_rows_by_id(const void *a, const void *b) {
+  uint32_t id_a = ((const Row *)a)->id;
+  uint32_t id_b = ((const Row *)b)->id;
+  return (id_a > id_b) - (id_a < id_b);
+}
+
+/*
+ * Spread num_items children as evenly as possible over num_nodes parents and
+ * return the index of the parent that item belongs to.
+ */
+static uint32_t import_node_of_item(uint32_t item, uint32_t num_items,
+                                    uint32_t num_nodes) {
+  uint32_t base = num_items / num_nodes;
+  uint32_t extra = num_items % num_nodes;
+  if (item < extra * (base + 1)) {
+    return item / (base + 1);
+  }
+  return extra + (item - extra * (base + 1)) / base;
+}
+
+static uint32_t import_items_in_node(uint32_t node, uint32_t num_items,
+                                     uint32_t num_nodes) {
+  return num_items / num_nodes + (node < num_items % num_nodes ? 1 : 0);
+}
+
+/*
+ * Page number of node i on the given level. The top level is the table's
+ * root page; every other level follows the one below it in the file.
+ */
+static uint32_t import_page_num(Table *table, uint32_t *level_first_page,
+                                uint32_t top_level, uint32_t level,
+                                uint32_t i) {
+  if (level == top_level) {
+    return table->root_page_num;
+  }
+  return level_first_page[level] + i;
+}
+
+static void import_build_tree(Table *table, ImportSource *source,
+                              ImportLeaves *leaves, double fill_factor) {
+  Pager *pager = table->pager;
+
+  // At least three children per node, so that spreading them evenly never
+  // leaves an internal node without a key
+  uint32_t internal_fill = (pager->internal_node_max_keys + 1) * fill_factor;
+  if (internal_fill < 3) {
+    internal_fill = 3;
+  }
+
+  /*
+  Work out the shape of the tree: the number of nodes on every level and
+  the page each level starts at
+  */
+  uint32_t level_nodes[IMPORT_MAX_LEVELS];
+  uint32_t level_first_page[IMPORT_MAX_LEVELS];
+  uint32_t top_level = 0;
+
+  level_nodes[0] = leaves->num_leaves;
+  while (level_nodes[top_level] > 1) {
+    uint32_t children = level_nodes[top_level];
+    top_level++;
+    if (children <= pager->internal_node_max_keys + 1) {
+      level_nodes[top_level] = 1;
+    } else {
+      level_nodes[top_level] = (children + internal_fill - 1) / internal_fill;
+    }
+  }
+
+  // Every page goes past the end of the file, so that each level is
+  // contiguous; the freelist is left alone
+  uint32_t next_page_num = pager->num_pages;
+  for (uint32_t level = 0; level < top_level; level++) {
+    level_first_page[level] = next_page_num;
+    next_page_num += level_nodes[level];
+  }
+
+  /* Max key of every node on the level below the one being written */
+  uint32_t *child_max_keys = malloc(level_nodes[0] * sizeof(uint32_t));
+  uint32_t *node_max_keys = malloc(level_nodes[0] * sizeof(uint32_t));
+
+  /* Leaves */
+  uint32_t parent_nodes = top_level > 0 ? level_nodes[1] : 1;
+  for (uint32_t i = 0; i < level_nodes[0]; i++) {
+    uint32_t page_num =
+        import_page_num(table, level_first_page, top_level, 0, i);
+    void *node = get_page(pager, page_num);
+    pager_mark_dirty(pager, page_num);
+
+    initialize_leaf_node(node);
+    set_node_root(node, top_level == 0);
+    if (top_level > 0) {
+      uint32_t parent = import_node_of_item(i, level_nodes[0], parent_nodes);
+      *node_parent(node) =
+          import_page_num(table, level_first_page, top_level, 1, parent);
+    }
+    if (i + 1 < level_nodes[0]) {
+      *leaf_node_next_leaf(node) =
+          import_page_num(table, level_first_page, top_level, 0, i + 1);
+    }
+
+    Row row;
+    uint8_t serialized[ROW_MAX_SIZE];
+    for (uint32_t cell_num = 0; cell_num < leaves->row_counts[i]; cell_num++) {
+      import_source_next(source, &row);
+      uint32_t value_size = serialize_row(&row, serialized);
+      leaf_node_insert_value(pager, node, cell_num, row.id, serialized,
+                             value_size);
+    }
+    child_max_keys[i] = row.id;
+
+    // The page is complete; let the pool write it back whenever it likes
+    pager_unpin_all(pager);
+  }
+
+  /* Internal levels, bottom-up */
+  for (uint32_t level = 1; level <= top_level; level++) {
+    uint32_t num_children = level_nodes[level - 1];
+    parent_nodes = level < top_level ? level_nodes[level + 1] : 1;
+    uint32_t child = 0;
+
+    for (uint32_t i = 0; i < level_nodes[level]; i++) {
+      uint32_t page_num =
+          import_page_num(table, level_first_page, top_level, level, i);
+      void *node = get_page(pager, page_num);
+      pager_mark_dirty(pager, page_num);
+
+      initialize_internal_node(node);
+      set_node_root(node, level == top_level);
+      if (level < top_level) {
+        uint32_t parent =
+            import_node_of_item(i, level_nodes[level], parent_nodes);
+        *node_parent(node) = import_page_num(table, level_first_page,
+                                             top_level, level + 1, parent);
+      }
+
+      uint32_t num_keys =
+          import_items_in_node(i, num_children, level_nodes[level]) - 1;
+      for (uint32_t key_num = 0; key_num < num_keys; key_num++, child++) {
+        *internal_node_cell(node, key_num) = import_page_num(
+            table, level_first_page, top_level, level - 1, child);
+        *internal_node_key(node, key_num) = child_max_keys[child];
+      }
+      *internal_node_num_keys(node) = num_keys;
+      *internal_node_right_child(node) = import_page_num(
+          table, level_first_page, top_level, level - 1, child);
+      node_max_keys[i] = child_max_keys[child];
+      child++;
+
+      pager_unpin_all(pager);
+    }
+
+    uint32_t *swap = child_max_keys;
+    child_max_keys = node_max_keys;
+    node_max_keys = swap;
+  }
+
+  free(child_max_keys);
+  free(node_max_keys);
+}
+
+/**
+ * Load every row of a file into an empty table, building the B-tree
+ * bottom-up instead of inserting rows one at a time.
+ *
+ * @param table the table to load into; it must be empty
+ * @param filename the file holding one "id username email" row per line
+ * @param fill_factor the share (0, 1] of each node to fill
+ * @param rows_imported set to the number of rows loaded
+ * @param error_line set to the offending line on IMPORT_PARSE_ERROR
+ *
+ * @return IMPORT_SUCCESS, or why nothing was imported
+ */
+ImportResult table_import(Table *table, const char *filename,
+                          double fill_factor, uint32_t *rows_imported,
+                          uint32_t *error_line) {
+  *rows_imported = 0;
+  *error_line = 0;
+
+  void *root = get_page(table->pager, table->root_page_num);
+  if (get_node_type(root) != NODE_LEAF || *leaf_node_num_cells(root) != 0) {
+    return IMPORT_TABLE_NOT_EMPTY;
+  }
+
+  FILE *file = fopen(filename, "r");
+  if (file == NULL) {
+    return IMPORT_FILE_ERROR;
+  }
+
+  ImportSource source = {file, NULL, NULL, 0, NULL, 0};
+  ImportLeaves leaves = {0};
+  leaves.fill_size =
+      (table->pager->page_size - LEAF_NODE_HEADER_SIZE) * fill_factor;
+  Row row;
+  PrepareResult prepare_result;
+  uint32_t num_rows = 0;
+  uint32_t line_num = 0;
+  bool sorted = true;
+  uint32_t previous_id = 0;
+
+  /* First pass: validate every line and check whether input is sorted */
+  while (import_read_row(file, &source.line, &source.line_capacity, &row,
+                         &prepare_result)) {
+    line_num++;
+    if (prepare_result != PREPARE_SUCCESS) {
+      *error_line = line_num;
+      free(leaves.row_counts);
+      free(source.line);
+      fclose(file);
+      return IMPORT_PARSE_ERROR;
+    }
+    if (num_rows > 0 && row.id <= previous_id) {
+      sorted = false;
+    }
+    if (sorted) {
+      import_pack_row(&leaves, &row);
+    }
+    previous_id = row.id;
+    num_rows++;
+  }
+  rewind(file);
+
+  if (!sorted) {
+    /* Second pass: read everything into memory and sort it */
+    source.rows = malloc(num_rows * sizeof(Row));
+    for (uint32_t i = 0; i < num_rows; i++) {
+      import_read_row(file, &source.line, &source.line_capacity,
+                      &source.rows[i], &prepare_result);
+    }
+    qsort(source.rows, num_rows, sizeof(Row), compare_rows_by_id);
+
+    for (uint32_t i = 1; i < num_rows; i++) {
+      if (source.rows[i].id == source.rows[i - 1].id) {
+        free(leaves.row_counts);
+        free(source.rows);
+        free(source.line);
+        fclose(file);
+        return IMPORT_DUPLICATE_KEY;
+      }
+    }
+
+    import_reset_leaves(&leaves);
+    for (uint32_t i = 0; i < num_rows; i++) {
+      import_pack_row(&leaves, &source.rows[i]);
+    }
+  }
+
+  if (num_rows > 0) {
+    import_build_tree(table, &source, &leaves, fill_factor);
+  }
+
+  free(leaves.row_counts);
+  free(source.rows);
+  free(source.line);
+  fclose(file);
+
+  *rows_imported = num_rows;
+  return IMPORT_SUCCESS;
+}
+
+/**
+ * Rebuild a table so that its file is as compact as possible: every leaf is
+ * full, the leaves follow each other in key order right after the root, and
+ * no free pages are left.
+ *
+ * @param table the table to rebuild
+ */
+void table_vacuum(Table *table) {
+  Pager *pager = table->pager;
+  pager_unpin_all(pager);
+
+  /* Work out the new leaves in a first scan */
+  ImportLeaves leaves = {0};
+  leaves.fill_size = pager->page_size - LEAF_NODE_HEADER_SIZE;
+  uint32_t num_rows = 0;
+  Row row;
+  Cursor cursor;
+  table_start(table, &cursor);
+  while (!cursor.end_of_table) {
+    deserialize_row(cursor_value(&cursor), &row);
+    import_pack_row(&leaves, &row);
+    num_rows++;
+    pager_unpin_all(pager);
+    cursor_advance(&cursor);
+  }
+
+  /* Build the new tree in a scratch database from a second scan */
+  char *scratch_filename =
+      malloc(strlen(pager->filename) + strlen("-vacuum") + 1);
+  sprintf(scratch_filename, "%s-vacuum", pager->filename);
+  unlink(scratch_filename);
+  Table *scratch = db_open(scratch_filename, pager->page_size);
+  pager_set_wal_enabled(scratch->pager, false);
+
+  if (num_rows > 0) {
+    table_start(table, &cursor);
+    ImportSource source = {NULL, NULL, &cursor, 0, NULL, 0};
+    import_build_tree(scratch, &source, &leaves, 1.0);
+  }
+  free(leaves.row_counts);
+
+  /* Copy it over the table and cut off whatever is left */
+  pager_unpin_all(pager);
+  pager_unpin_all(scratch->pager);
+  uint32_t num_pages = scratch->pager->num_pages;
+  for (uint32_t page_num = DB_HEADER_PAGE_NUM + 1; page_num < num_pages;
+       page_num++) {
+    void *scratch_page = get_page(scratch->pager, page_num);
+    void *page = get_page(pager, page_num);
+    pager_mark_dirty(pager, page_num);
+    memcpy(page, scratch_page, pager->page_size);
+    pager_unpin_all(pager);
+    pager_unpin_all(scratch->pager);
+  }
+
+  void *header = get_page(pager, DB_HEADER_PAGE_NUM);
+  pager_mark_dirty(pager, DB_HEADER_PAGE_NUM);
+  *header_root_page_num(header) = scratch->root_page_num;
+  *header_freelist_head(header) = 0;
+  *header_freelist_count(header) = 0;
+  table->root_page_num = scratch->root_page_num;
+  table->last_leaf_page_num = INVALID_PAGE_NUM;
+
+  // The scratch pager's session goes with it, not left for close to find
+  pager_end_session(scratch->pager);
+  db_close(scratch);
+  unlink(scratch_filename);
+  free(scratch_filename);
+
+  pager_truncate(pager, num_pages);
+}
@@ -28,4 +28,108 @@ void read_input(InputBuffer *input_buffer) {
 void close_input_buffer(InputBuffer *input_buffer) {
   free(input_buffer->buffer);
   free(input_buffer);
-}
\ No newline at end of file
+}
+/**
+ * Open a script of statements, one per line, for batch mode.
+ *
+ * @param filename the file to read, or "-" for standard input
+ *
+ * @return the reader, or NULL if the file cannot be opened
+ */
+ScriptReader *script_open(const char *filename) {
+  int file_descriptor = STDIN_FILENO;
+  if (strcmp(filename, "-") != 0) {
+    file_descriptor = open(filename, O_RDONLY);
+    if (file_descriptor == -1) {
+      return NULL;
+    }
+  }
+
+  ScriptReader *reader = malloc(sizeof(ScriptReader));
+  reader->file_descriptor = file_descriptor;
+  reader->capacity = SCRIPT_BLOCK_SIZE;
+  reader->data = malloc(reader->capacity);
+  reader->length = 0;
+  reader->position = 0;
+  reader->end_of_file = false;
+  reader->line_num = 0;
+  return reader;
+}
+
+/*
+ * Move the unread tail of the block to its front and read more input behind
+ * it, growing the block when a single line fills it.
+ */
+static void script_fill(ScriptReader *reader) {
+  size_t unread = reader->length - reader->position;
+  memmove(reader->data, reader->data + reader->position, unread);
+  reader->length = unread;
+  reader->position = 0;
+
+  // One byte is always kept spare for the NUL ending a final unended line
+  if (reader->length + 1 == reader->capacity) {
+    reader->capacity *= 2;
+    reader->data = realloc(reader->data, reader->capacity);
+  }
+
+  ssize_t bytes_read;
+  do {
+    bytes_read = read(reader->file_descriptor, reader->data + reader->length,
+                      reader->capacity - reader->length - 1);
+  } while (bytes_read == -1 && errno == EINTR);
+
+  if (bytes_read == -1) {
+    printf("Error reading input\n");
+    exit(EXIT_FAILURE);
+  }
+  if (bytes_read == 0) {
+    reader->end_of_file = true;
+  }
+  reader->length += bytes_read;
+}
+
+/**
+ * Read the next line of a script. Lines are cut out of large blocks of
+ * input in place, so input_buffer is pointed into the reader's block rather
+ * than given a copy; the line stays valid until the next call.
+ *
+ * @param reader the script
+ * @param input_buffer set to the line, without its line ending
+ *
+ * @return false once the script has no lines left
+ */
+bool script_read_line(ScriptReader *reader, InputBuffer *input_buffer) {
+  while (true) {
+    char *start = reader->data + reader->position;
+    size_t unread = reader->length - reader->position;
+    char *newline = memchr(start, '\n', unread);
+
+    if (newline != NULL || (reader->end_of_file && unread > 0)) {
+      size_t line_length = newline != NULL ? (size_t)(newline - start) : unread;
+      reader->position += newline != NULL ? line_length + 1 : line_length;
+      reader->line_num++;
+
+      if (line_length > 0 && start[line_length - 1] == '\r') {
+        line_length--;
+      }
+      start[line_length] = '\0';
+      input_buffer->buffer = start;
+      input_buffer->buffer_length = line_length + 1;
+      input_buffer->input_length = line_length;
+      return true;
+    }
+
+    if (reader->end_of_file) {
+      return false;
+    }
+    script_fill(reader);
+  }
+}
+
+void script_close(ScriptReader *reader) {
+  if (reader->file_descriptor != STDIN_FILENO) {
+    close(reader->file_descriptor);
+  }
+  free(reader->data);
+  free(reader);
+}
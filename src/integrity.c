@@ -0,0 +1,404 @@
+#include "db.h"
+#include <stdarg.h>
+
+/*
+ * Integrity checks.
+ *
+ * The check runs in two passes, each spread over several threads. The
+ * first reads every page of the file, bypassing the buffer pool, and checks
+ * its checksum; threads take INTEGRITY_CHUNK_PAGES pages at a time. Only if
+ * all of them pass does the second walk the tree, as the buffer pool and
+ * the log present it, to check that it is well formed:
+ *
+ * - every node is a leaf or an internal node, points back at its parent and
+ *   holds no more than fits in its page;
+ * - keys increase within each node and lie within the range its parent sets
+ *   aside for it;
+ * - each row lies within its leaf's content area;
+ * - all leaves are at the same depth, and the leaf chain visits them in key
+ *   order, ending at the last.
+ *
+ * The root's subtrees are walked side by side, one per thread at a time.
+ * Problems are printed as they are found.
+ */
+
+/* Pages the first pass reads at a time */
+#define INTEGRITY_CHUNK_PAGES 64
+/* Deeper than any tree of 2^32 keys gets, so only reached by a cycle */
+#define INTEGRITY_MAX_DEPTH 32
+
+/* A walk along the leaves, in key order */
+typedef struct {
+  uint32_t leaf_depth; // Of the first leaf, which the others must match
+  uint32_t first_leaf_page_num; // 0 until a leaf is reached
+  uint32_t last_leaf_page_num;
+  uint32_t last_next_leaf; // Where the last leaf reached says to go next
+} IntegrityWalk;
+
+typedef struct {
+  uint32_t page_num;
+  uint32_t low_key; // The keys it may hold
+  uint32_t high_key;
+  IntegrityWalk walk;
+} IntegritySubtree;
+
+typedef struct {
+  Table *table;
+  pthread_mutex_t mutex; // Guards the fields below, and printing
+  uint32_t num_problems;
+  uint32_t next; // The next chunk of pages, or subtree, for a thread to take
+  uint32_t num_file_pages;
+  IntegritySubtree *subtrees;
+  uint32_t num_subtrees;
+} IntegrityCheck;
+
+static void integrity_problem(IntegrityCheck *check, const char *format,
+                              ...) {
+  pthread_mutex_lock(&check->mutex);
+  check->num_problems++;
+  va_list arguments;
+  va_start(arguments, format);
+  vprintf(format, arguments);
+  va_end(arguments);
+  printf("\n");
+  pthread_mutex_unlock(&check->mutex);
+}
+
+/* The next piece of work for a thread, or false once there is none */
+static bool integrity_take(IntegrityCheck *check, uint32_t count,
+                           uint32_t *num) {
+  pthread_mutex_lock(&check->mutex);
+  *num = check->next;
+  bool taken = *num < count;
+  if (taken) {
+    check->next++;
+  }
+  pthread_mutex_unlock(&check->mutex);
+  return taken;
+}
+
+static void *integrity_check_pages(void *argument) {
+  IntegrityCheck *check = argument;
+  Pager *pager = check->table->pager;
+
+  // Page aligned, as the file may be open for direct I/O
+  size_t buffer_size = (size_t)INTEGRITY_CHUNK_PAGES * pager->page_size;
+  uint8_t *buffer = mmap(NULL, buffer_size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buffer == MAP_FAILED) {
+    printf("Error allocating integrity check buffer: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+
+  uint32_t num_chunks = (check->num_file_pages + INTEGRITY_CHUNK_PAGES - 1) /
+                        INTEGRITY_CHUNK_PAGES;
+  uint32_t chunk_num;
+  while (integrity_take(check, num_chunks, &chunk_num)) {
+    uint32_t first_page_num = chunk_num * INTEGRITY_CHUNK_PAGES;
+    uint32_t count = check->num_file_pages - first_page_num;
+    if (count > INTEGRITY_CHUNK_PAGES) {
+      count = INTEGRITY_CHUNK_PAGES;
+    }
+
+    size_t length = (size_t)count * pager->page_size;
+    ssize_t bytes_read = pread(pager->file_descriptor, buffer, length,
+                               (off_t)first_page_num * pager->page_size);
+    if (bytes_read != (ssize_t)length) {
+      integrity_problem(check, "Pages %d to %d: could not be read.",
+                        first_page_num, first_page_num + count - 1);
+      continue;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+      if (!page_checksum_matches(buffer + (size_t)i * pager->page_size,
+                                 pager->page_size)) {
+        integrity_problem(check, "Page %d: checksum mismatch.",
+                          first_page_num + i);
+      }
+    }
+  }
+
+  munmap(buffer, buffer_size);
+  return NULL;
+}
+
+/* Check that keys increase and lie in [low_key, high_key] */
+static void integrity_check_keys(IntegrityCheck *check, uint32_t page_num,
+                                 uint32_t *keys, uint32_t num_keys,
+                                 uint32_t low_key, uint32_t high_key) {
+  for (uint32_t i = 0; i < num_keys; i++) {
+    if (keys[i] < low_key || keys[i] > high_key) {
+      integrity_problem(check, "Page %d: key %d outside of [%d, %d].",
+                        page_num, keys[i], low_key, high_key);
+    } else if (i > 0 && keys[i] <= keys[i - 1]) {
+      integrity_problem(check, "Page %d: key %d out of order.", page_num,
+                        keys[i]);
+    }
+  }
+}
+
+static void integrity_check_leaf(IntegrityCheck *check, uint32_t page_num,
+                                 void *node, uint32_t low_key,
+                                 uint32_t high_key, uint32_t depth,
+                                 IntegrityWalk *walk) {
+  Pager *pager = check->table->pager;
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  uint32_t content_size = *leaf_node_content_size(node);
+  if (content_size > pager->page_size ||
+      LEAF_NODE_HEADER_SIZE + num_cells * LEAF_NODE_SLOT_SIZE >
+          pager->page_size - content_size) {
+    integrity_problem(check, "Page %d: %d cells overflow the leaf.", page_num,
+                      num_cells);
+    return;
+  }
+
+  uint32_t *keys = malloc((num_cells + 1) * sizeof(uint32_t));
+  uint32_t content_start = pager->page_size - content_size;
+  for (uint32_t i = 0; i < num_cells; i++) {
+    keys[i] = *(uint32_t *)leaf_node_key(node, i);
+    uint32_t offset = *leaf_node_value_offset(node, i);
+    uint32_t size = *leaf_node_value_size(node, i);
+    if (offset < content_start || offset + size > pager->page_size ||
+        size > ROW_MAX_SIZE) {
+      integrity_problem(check, "Page %d: row of key %d out of bounds.",
+                        page_num, keys[i]);
+    }
+  }
+  integrity_check_keys(check, page_num, keys, num_cells, low_key, high_key);
+  free(keys);
+
+  if (walk->first_leaf_page_num == 0) {
+    walk->first_leaf_page_num = page_num;
+    walk->leaf_depth = depth;
+  } else {
+    if (depth != walk->leaf_depth) {
+      integrity_problem(check, "Page %d: leaf at depth %d, others at %d.",
+                        page_num, depth, walk->leaf_depth);
+    }
+    if (walk->last_next_leaf != page_num) {
+      integrity_problem(check, "Page %d: next leaf is %d, expected %d.",
+                        walk->last_leaf_page_num, walk->last_next_leaf,
+                        page_num);
+    }
+  }
+  walk->last_leaf_page_num = page_num;
+  walk->last_next_leaf = *leaf_node_next_leaf(node);
+}
+
+/*
+ * Check the subtree under page_num, whose keys must lie in [low_key,
+ * high_key], at the given depth below the root. parent_page_num is
+ * INVALID_PAGE_NUM for the root itself. Its leaves carry on the walk.
+ */
+static void integrity_check_node(IntegrityCheck *check, uint32_t page_num,
+                                 uint32_t parent_page_num, uint32_t low_key,
+                                 uint32_t high_key, uint32_t depth,
+                                 IntegrityWalk *walk) {
+  Pager *pager = check->table->pager;
+  if (page_num == DB_HEADER_PAGE_NUM || page_num >= pager->num_pages) {
+    integrity_problem(check, "Page %d: child of page %d does not exist.",
+                      page_num, parent_page_num);
+    return;
+  }
+  if (depth > INTEGRITY_MAX_DEPTH) {
+    integrity_problem(check, "Page %d: more than %d levels deep.", page_num,
+                      INTEGRITY_MAX_DEPTH);
+    return;
+  }
+
+  void *node = get_page(pager, page_num);
+  bool is_root = parent_page_num == INVALID_PAGE_NUM;
+  if (is_node_root(node) != is_root) {
+    integrity_problem(check, "Page %d: root flag is %d.", page_num,
+                      is_node_root(node));
+  }
+  if (!is_root && *node_parent(node) != parent_page_num) {
+    integrity_problem(check, "Page %d: parent pointer is %d, expected %d.",
+                      page_num, *node_parent(node), parent_page_num);
+  }
+
+  NodeType type = get_node_type(node);
+  if (type == NODE_LEAF) {
+    integrity_check_leaf(check, page_num, node, low_key, high_key, depth,
+                         walk);
+    pager_unpin_all(pager);
+    return;
+  }
+  if (type != NODE_INTERNAL) {
+    integrity_problem(check, "Page %d: unknown node type %d.", page_num,
+                      type);
+    pager_unpin_all(pager);
+    return;
+  }
+
+  uint32_t num_keys = *internal_node_num_keys(node);
+  if (num_keys > pager->internal_node_max_keys) {
+    integrity_problem(check, "Page %d: %d keys overflow the node.", page_num,
+                      num_keys);
+    pager_unpin_all(pager);
+    return;
+  }
+  // Copied out, so that the node need not stay pinned while its children
+  // are checked
+  uint32_t *keys = malloc((num_keys + 1) * sizeof(uint32_t));
+  uint32_t *children = malloc((num_keys + 1) * sizeof(uint32_t));
+  for (uint32_t i = 0; i < num_keys; i++) {
+    keys[i] = *internal_node_key(node, i);
+    children[i] = *internal_node_cell(node, i);
+  }
+  children[num_keys] = *internal_node_right_child(node);
+  pager_unpin_all(pager);
+
+  integrity_check_keys(check, page_num, keys, num_keys, low_key, high_key);
+  for (uint32_t i = 0; i <= num_keys; i++) {
+    uint32_t child_low_key = i == 0 ? low_key : keys[i - 1] + 1;
+    uint32_t child_high_key = i < num_keys ? keys[i] : high_key;
+    integrity_check_node(check, children[i], page_num, child_low_key,
+                         child_high_key, depth + 1, walk);
+  }
+  free(children);
+  free(keys);
+}
+
+static void *integrity_check_subtrees(void *argument) {
+  IntegrityCheck *check = argument;
+  Table *table = check->table;
+
+  uint32_t num;
+  while (integrity_take(check, check->num_subtrees, &num)) {
+    IntegritySubtree *subtree = &check->subtrees[num];
+    uint32_t parent_page_num = check->num_subtrees == 1 &&
+                                       subtree->page_num == table->root_page_num
+                                   ? INVALID_PAGE_NUM
+                                   : table->root_page_num;
+    integrity_check_node(check, subtree->page_num, parent_page_num,
+                         subtree->low_key, subtree->high_key,
+                         parent_page_num == INVALID_PAGE_NUM ? 0 : 1,
+                         &subtree->walk);
+  }
+
+  pager_end_session(table->pager);
+  return NULL;
+}
+
+static void integrity_run(IntegrityCheck *check, uint32_t num_threads,
+                          void *(*worker)(void *)) {
+  check->next = 0;
+  pthread_t *threads = malloc(num_threads * sizeof(pthread_t));
+  for (uint32_t i = 0; i < num_threads; i++) {
+    if (pthread_create(&threads[i], NULL, worker, check) != 0) {
+      printf("Error: could not start an integrity check thread.\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  for (uint32_t i = 0; i < num_threads; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  free(threads);
+}
+
+/* Split the tree into the root's subtrees, or the root alone if a leaf */
+static void integrity_split(IntegrityCheck *check) {
+  Table *table = check->table;
+  Pager *pager = table->pager;
+  void *root = get_page(pager, table->root_page_num);
+
+  uint32_t num_keys = *internal_node_num_keys(root);
+  if (get_node_type(root) != NODE_INTERNAL ||
+      num_keys > pager->internal_node_max_keys) {
+    // Checked, and reported, as a whole
+    check->num_subtrees = 1;
+    check->subtrees = calloc(1, sizeof(IntegritySubtree));
+    check->subtrees[0].page_num = table->root_page_num;
+    check->subtrees[0].high_key = UINT32_MAX;
+    pager_unpin_all(pager);
+    return;
+  }
+
+  if (!is_node_root(root)) {
+    integrity_problem(check, "Page %d: root flag is 0.",
+                      table->root_page_num);
+  }
+  uint32_t *keys = malloc((num_keys + 1) * sizeof(uint32_t));
+  check->num_subtrees = num_keys + 1;
+  check->subtrees = calloc(num_keys + 1, sizeof(IntegritySubtree));
+  for (uint32_t i = 0; i <= num_keys; i++) {
+    IntegritySubtree *subtree = &check->subtrees[i];
+    if (i < num_keys) {
+      keys[i] = *internal_node_key(root, i);
+      subtree->page_num = *internal_node_cell(root, i);
+      subtree->high_key = keys[i];
+    } else {
+      subtree->page_num = *internal_node_right_child(root);
+      subtree->high_key = UINT32_MAX;
+    }
+    // An out of order key is reported below, and the range left empty
+    subtree->low_key = i == 0 ? 0 : keys[i - 1] + 1;
+  }
+  pager_unpin_all(pager);
+  integrity_check_keys(check, table->root_page_num, keys, num_keys, 0,
+                       UINT32_MAX);
+  free(keys);
+}
+
+/* Check that the subtrees' leaves meet up, from one subtree to the next */
+static void integrity_join_walks(IntegrityCheck *check) {
+  IntegrityWalk *last = NULL;
+  for (uint32_t i = 0; i < check->num_subtrees; i++) {
+    IntegrityWalk *walk = &check->subtrees[i].walk;
+    if (walk->first_leaf_page_num == 0) {
+      continue;
+    }
+    if (last != NULL) {
+      if (walk->leaf_depth != last->leaf_depth) {
+        integrity_problem(check, "Page %d: leaf at depth %d, others at %d.",
+                          walk->first_leaf_page_num, walk->leaf_depth,
+                          last->leaf_depth);
+      }
+      if (last->last_next_leaf != walk->first_leaf_page_num) {
+        integrity_problem(check, "Page %d: next leaf is %d, expected %d.",
+                          last->last_leaf_page_num, last->last_next_leaf,
+                          walk->first_leaf_page_num);
+      }
+    }
+    last = walk;
+  }
+  if (last != NULL && last->last_next_leaf != 0) {
+    integrity_problem(check, "Page %d: last leaf has next leaf %d.",
+                      last->last_leaf_page_num, last->last_next_leaf);
+  }
+}
+
+/**
+ * Check every page's checksum and the shape of the tree, printing each
+ * problem found. The caller holds the table lock exclusively, so that no
+ * page is written meanwhile.
+ *
+ * @param table the table to check
+ * @param num_threads the threads to spread the check over
+ *
+ * @return the number of problems found
+ */
+uint32_t table_integrity_check(Table *table, uint32_t num_threads) {
+  Pager *pager = table->pager;
+  IntegrityCheck check;
+  check.table = table;
+  pthread_mutex_init(&check.mutex, NULL);
+  check.num_problems = 0;
+
+  pthread_mutex_lock(&pager->latch);
+  check.num_file_pages = pager->file_length / pager->page_size;
+  pthread_mutex_unlock(&pager->latch);
+  integrity_run(&check, num_threads, integrity_check_pages);
+
+  if (check.num_problems == 0) {
+    integrity_split(&check);
+    uint32_t num_walkers =
+        num_threads < check.num_subtrees ? num_threads : check.num_subtrees;
+    integrity_run(&check, num_walkers, integrity_check_subtrees);
+    integrity_join_walks(&check);
+    free(check.subtrees);
+  }
+
+  pthread_mutex_destroy(&check.mutex);
+  return check.num_problems;
+}
@@ -0,0 +1,307 @@
+#define _GNU_SOURCE // O_DIRECT, fallocate()
+#include "db.h"
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#define TINYSQL_HAVE_IO_URING
+#endif
+
+/*
+ * I/O backends.
+ *
+ * Reads and writes of the database file go through an IoBackend. Single
+ * page reads are plain pread() calls in every backend, as there is nothing
+ * to batch. Batches of requests (written back runs of dirty pages,
+ * checkpoints, read-ahead) are what the backends differ in: the POSIX one
+ * issues one preadv()/pwritev() per request, while the io_uring one queues
+ * up to IO_URING_ENTRIES requests and submits them with a single system
+ * call, keeping that many requests in flight at the device.
+ *
+ * No file offset is shared between requests, so they may complete in any
+ * order.
+ */
+
+#ifdef TINYSQL_HAVE_IO_URING
+
+struct IoRing {
+  int ring_fd;
+  uint32_t num_entries;
+
+  void *sq_ring;
+  size_t sq_ring_length;
+  void *cq_ring; // Same mapping as sq_ring on kernels with a single mmap
+  size_t cq_ring_length;
+  struct io_uring_sqe *sqes;
+  size_t sqes_length;
+
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+};
+
+static void io_ring_free(IoRing *ring) {
+  if (ring->sqes) {
+    munmap(ring->sqes, ring->sqes_length);
+  }
+  if (ring->cq_ring && ring->cq_ring != ring->sq_ring) {
+    munmap(ring->cq_ring, ring->cq_ring_length);
+  }
+  if (ring->sq_ring) {
+    munmap(ring->sq_ring, ring->sq_ring_length);
+  }
+  close(ring->ring_fd);
+  free(ring);
+}
+
+/*
+ * Set up a ring and map its queues. Returns NULL if the kernel does not
+ * support io_uring or does not allow it.
+ */
+static IoRing *io_ring_open() {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  int ring_fd = syscall(__NR_io_uring_setup, IO_URING_ENTRIES, &params);
+  if (ring_fd < 0) {
+    return NULL;
+  }
+
+  IoRing *ring = calloc(1, sizeof(IoRing));
+  ring->ring_fd = ring_fd;
+  ring->num_entries = params.sq_entries;
+  ring->sq_ring_length =
+      params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_ring_length =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap && ring->cq_ring_length > ring->sq_ring_length) {
+    ring->sq_ring_length = ring->cq_ring_length;
+  }
+
+  void *sq_ring = mmap(NULL, ring->sq_ring_length, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+  if (sq_ring == MAP_FAILED) {
+    io_ring_free(ring);
+    return NULL;
+  }
+  ring->sq_ring = sq_ring;
+
+  if (single_mmap) {
+    ring->cq_ring = sq_ring;
+  } else {
+    void *cq_ring =
+        mmap(NULL, ring->cq_ring_length, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+    if (cq_ring == MAP_FAILED) {
+      io_ring_free(ring);
+      return NULL;
+    }
+    ring->cq_ring = cq_ring;
+  }
+
+  ring->sqes_length = params.sq_entries * sizeof(struct io_uring_sqe);
+  void *sqes = mmap(NULL, ring->sqes_length, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    io_ring_free(ring);
+    return NULL;
+  }
+  ring->sqes = sqes;
+
+  ring->sq_tail = ring->sq_ring + params.sq_off.tail;
+  ring->sq_mask = ring->sq_ring + params.sq_off.ring_mask;
+  ring->sq_array = ring->sq_ring + params.sq_off.array;
+  ring->cq_head = ring->cq_ring + params.cq_off.head;
+  ring->cq_tail = ring->cq_ring + params.cq_off.tail;
+  ring->cq_mask = ring->cq_ring + params.cq_off.ring_mask;
+  ring->cqes = ring->cq_ring + params.cq_off.cqes;
+
+  return ring;
+}
+
+static int io_ring_enter(IoRing *ring, uint32_t to_submit,
+                         uint32_t min_complete) {
+  int result;
+  do {
+    result = syscall(__NR_io_uring_enter, ring->ring_fd, to_submit,
+                     min_complete, IORING_ENTER_GETEVENTS, NULL, 0);
+  } while (result < 0 && errno == EINTR);
+  return result;
+}
+
+/*
+ * Queue up to one ring's worth of requests, submit them with one system call
+ * and wait until every one of them has completed.
+ */
+static void io_ring_submit(IoRing *ring, int file_descriptor,
+                           IoRequest *requests, uint32_t count) {
+  unsigned tail = *ring->sq_tail;
+  for (uint32_t i = 0; i < count; i++) {
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = requests[i].write ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->fd = file_descriptor;
+    sqe->addr = (uint64_t)(uintptr_t)requests[i].iov;
+    sqe->len = requests[i].iov_count;
+    sqe->off = requests[i].offset;
+    sqe->user_data = i;
+    ring->sq_array[index] = index;
+    tail++;
+  }
+  __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+  uint32_t completed = 0;
+  uint32_t to_submit = count;
+  while (completed < count) {
+    if (io_ring_enter(ring, to_submit, 1) < 0) {
+      printf("Error submitting I/O: %d\n", errno);
+      exit(EXIT_FAILURE);
+    }
+    to_submit = 0;
+
+    unsigned head = *ring->cq_head;
+    unsigned cq_tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != cq_tail) {
+      struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+      requests[cqe->user_data].result = cqe->res;
+      head++;
+      completed++;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+  }
+}
+
+#else
+
+struct IoRing {
+  int unused;
+};
+
+static IoRing *io_ring_open() { return NULL; }
+
+static void io_ring_free(IoRing *ring) { free(ring); }
+
+static void io_ring_submit(IoRing *ring, int file_descriptor,
+                           IoRequest *requests, uint32_t count) {}
+
+#endif
+
+/*
+ * Turn O_DIRECT on or off for an open file. Returns whether the file ends up
+ * bypassing the page cache, which is not the case where the file system
+ * does not support it.
+ */
+static bool io_set_direct(int file_descriptor, bool direct) {
+#ifdef O_DIRECT
+  int flags = fcntl(file_descriptor, F_GETFL);
+  if (flags == -1) {
+    return false;
+  }
+  flags = direct ? (flags | O_DIRECT) : (flags & ~O_DIRECT);
+  if (fcntl(file_descriptor, F_SETFL, flags) == -1) {
+    return false;
+  }
+  return direct;
+#else
+  return false;
+#endif
+}
+
+/**
+ * Set up an I/O backend for an open file. Falls back to the POSIX backend
+ * when io_uring is not available, and to buffered I/O when the file cannot
+ * be opened for direct I/O; io->type and io->direct tell what was set up.
+ *
+ * @param io the backend to set up
+ * @param file_descriptor the file it reads and writes
+ * @param type the backend to use
+ * @param direct whether to bypass the page cache with O_DIRECT
+ */
+void io_open(IoBackend *io, int file_descriptor, IoBackendType type,
+             bool direct) {
+  io->file_descriptor = file_descriptor;
+  io->type = IO_BACKEND_POSIX;
+  io->ring = NULL;
+  if (type == IO_BACKEND_URING) {
+    io->ring = io_ring_open();
+    if (io->ring) {
+      io->type = IO_BACKEND_URING;
+    }
+  }
+  io->direct = io_set_direct(file_descriptor, direct);
+}
+
+void io_close(IoBackend *io) {
+  if (io->ring) {
+    io_ring_free(io->ring);
+    io->ring = NULL;
+  }
+  if (io->direct) {
+    io->direct = io_set_direct(io->file_descriptor, false);
+  }
+  io->type = IO_BACKEND_POSIX;
+}
+
+ssize_t io_read(IoBackend *io, void *buffer, size_t length, off_t offset) {
+  ssize_t result;
+  do {
+    result = pread(io->file_descriptor, buffer, length, offset);
+  } while (result == -1 && errno == EINTR);
+  return result;
+}
+
+/**
+ * Carry out a batch of requests and wait for all of them. Each request's
+ * result is set to the number of bytes transferred, or to -errno.
+ *
+ * @param io the backend to submit to
+ * @param requests the requests, in any order
+ * @param count the number of requests
+ */
+void io_submit(IoBackend *io, IoRequest *requests, uint32_t count) {
+  if (io->type == IO_BACKEND_URING) {
+    for (uint32_t i = 0; i < count; i += io->ring->num_entries) {
+      uint32_t batch = count - i < io->ring->num_entries
+                           ? count - i
+                           : io->ring->num_entries;
+      io_ring_submit(io->ring, io->file_descriptor, requests + i, batch);
+    }
+    return;
+  }
+
+  for (uint32_t i = 0; i < count; i++) {
+    IoRequest *request = &requests[i];
+    ssize_t result;
+    do {
+      result = request->write ? pwritev(io->file_descriptor, request->iov,
+                                        request->iov_count, request->offset)
+                              : preadv(io->file_descriptor, request->iov,
+                                       request->iov_count, request->offset);
+    } while (result == -1 && errno == EINTR);
+    request->result = result == -1 ? -errno : result;
+  }
+}
+
+/*
+ * Give the file system back the blocks of a range of the file, which then
+ * reads as zeros; the file keeps its length. Returns false where the file
+ * system cannot do that.
+ */
+bool io_punch_hole(IoBackend *io, off_t offset, off_t length) {
+#ifdef FALLOC_FL_PUNCH_HOLE
+  int result;
+  do {
+    result = fallocate(io->file_descriptor,
+                       FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset,
+                       length);
+  } while (result == -1 && errno == EINTR);
+  return result == 0;
+#else
+  return false;
+#endif
+}
@@ -1,16 +1,268 @@
 #include "db.h"
 
-MetaCommandResult do_meta_command(InputBuffer *input_buffer, Table *table) {
+/*
+ * .import FILE [FILL_FACTOR]
+ */
+static MetaCommandResult do_import(InputBuffer *input_buffer, Table *table) {
+  strtok(input_buffer->buffer, " ");
+  char *filename = strtok(NULL, " ");
+  char *fill_factor_string = strtok(NULL, " ");
+
+  double fill_factor = IMPORT_DEFAULT_FILL_FACTOR;
+  if (fill_factor_string != NULL) {
+    fill_factor = atof(fill_factor_string);
+  }
+  if (filename == NULL || fill_factor <= 0 || fill_factor > 1) {
+    printf("Usage: .import FILE [FILL_FACTOR]\n");
+    return META_COMMAND_SUCCESS;
+  }
+
+  pager_unpin_all(table->pager);
+  uint32_t rows_imported;
+  uint32_t error_line;
+  switch (table_import(table, filename, fill_factor, &rows_imported,
+                       &error_line)) {
+  case (IMPORT_SUCCESS):
+    pager_commit(table->pager);
+    printf("Imported %d rows.\n", rows_imported);
+    break;
+  case (IMPORT_FILE_ERROR):
+    printf("Error: could not open '%s'.\n", filename);
+    break;
+  case (IMPORT_PARSE_ERROR):
+    printf("Error: could not parse line %d.\n", error_line);
+    break;
+  case (IMPORT_DUPLICATE_KEY):
+    printf("Error: Duplicate Key.\n");
+    break;
+  case (IMPORT_TABLE_NOT_EMPTY):
+    printf("Error: .import needs an empty table.\n");
+    break;
+  }
+  return META_COMMAND_SUCCESS;
+}
+
+/*
+ * If line is the meta command command, alone or followed by a space and an
+ * argument, return the argument, or "" if there is none. Otherwise NULL.
+ */
+static char *meta_command_argument(char *line, const char *command) {
+  size_t length = strlen(command);
+  if (strncmp(line, command, length) != 0) {
+    return NULL;
+  }
+  if (line[length] == '\0') {
+    return line + length;
+  }
+  return line[length] == ' ' ? line + length + 1 : NULL;
+}
+
+/* Parse a whole number from 0 to max, returning false if string is not one */
+static bool parse_number(const char *string, uint32_t max, uint32_t *number) {
+  if (*string < '0' || *string > '9') {
+    return false;
+  }
+  char *end;
+  errno = 0;
+  unsigned long value = strtoul(string, &end, 10);
+  if (*end != '\0' || errno == ERANGE || value > max) {
+    return false;
+  }
+  *number = value;
+  return true;
+}
+
+/*
+ * .threads [N [unordered]]
+ *
+ * Selects over a range of keys are split across N threads, returning their
+ * rows in key order unless unordered is given; 1 scans on the REPL's thread.
+ */
+static MetaCommandResult do_threads(InputBuffer *input_buffer, Table *table) {
+  strtok(input_buffer->buffer, " ");
+  char *threads_string = strtok(NULL, " ");
+  char *order_string = strtok(NULL, " ");
+
+  if (threads_string == NULL) {
+    printf("%d%s\n", table->scan_threads,
+           table->scan_ordered ? "" : " unordered");
+    return META_COMMAND_SUCCESS;
+  }
+  int num_threads = atoi(threads_string);
+  if (num_threads < 1 || num_threads > SCAN_MAX_THREADS ||
+      (order_string != NULL && strcmp(order_string, "unordered") != 0)) {
+    printf("Usage: .threads [N [unordered]], with N from 1 to %d\n",
+           SCAN_MAX_THREADS);
+    return META_COMMAND_SUCCESS;
+  }
+  table->scan_threads = num_threads;
+  table->scan_ordered = order_string == NULL;
+  return META_COMMAND_SUCCESS;
+}
+
+/*
+ * .integrity_check
+ *
+ * Checks every page's checksum and the shape of the tree on as many threads
+ * as there are CPUs, printing each problem found, or ok.
+ */
+static MetaCommandResult do_integrity_check(Table *table) {
+  long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  uint32_t num_threads = num_cpus < 1                  ? 1
+                         : num_cpus > SCAN_MAX_THREADS ? SCAN_MAX_THREADS
+                                                       : num_cpus;
+  uint32_t num_problems = table_integrity_check(table, num_threads);
+  if (num_problems == 0) {
+    printf("ok\n");
+  } else {
+    printf("%d problem%s found.\n", num_problems,
+           num_problems == 1 ? "" : "s");
+  }
+  return META_COMMAND_SUCCESS;
+}
+
+/*
+ * Meta commands that checkpoint or rewrite the database, which would write
+ * out a transaction before it is committed.
+ */
+static bool is_storage_command(const char *command) {
+  return strcmp(command, ".checkpoint") == 0 ||
+         strcmp(command, ".vacuum") == 0 || strcmp(command, ".wal on") == 0 ||
+         strcmp(command, ".wal off") == 0 ||
+         strncmp(command, ".import ", 8) == 0;
+}
+
+/*
+ * .flusher [PAGES_PER_SECOND]
+ *
+ * Runs the background flusher, writing back at most PAGES_PER_SECOND dirty
+ * pages a second; 0 stops it.
+ */
+static MetaCommandResult do_flusher(char *rate_string, Table *table) {
+  uint32_t pages_per_second;
+  if (*rate_string == '\0') {
+    printf("%d\n", table->flusher ? table->flusher->pages_per_second : 0);
+  } else if (parse_number(rate_string, UINT32_MAX, &pages_per_second)) {
+    flusher_set_rate(table, pages_per_second);
+  } else {
+    printf("Usage: .flusher [PAGES_PER_SECOND]\n");
+  }
+  return META_COMMAND_SUCCESS;
+}
+
+/*
+ * .prefetch [PAGES]
+ *
+ * Sets how many leaves ahead of a sequential scan are read ahead; 0 turns
+ * read-ahead off.
+ */
+static MetaCommandResult do_prefetch(char *depth_string, Table *table) {
+  uint32_t depth;
+  if (*depth_string == '\0') {
+    printf("%d\n", table->pager->prefetch_depth);
+  } else if (parse_number(depth_string, PAGER_MAX_PREFETCH_DEPTH, &depth)) {
+    table->pager->prefetch_depth = depth;
+  } else {
+    printf("Usage: .prefetch [PAGES], with PAGES from 0 to %d\n",
+           PAGER_MAX_PREFETCH_DEPTH);
+  }
+  return META_COMMAND_SUCCESS;
+}
+
+static MetaCommandResult run_meta_command(InputBuffer *input_buffer,
+                                          Table *table) {
+  if (table->pager->in_transaction &&
+      is_storage_command(input_buffer->buffer)) {
+    printf("Error: %s is not allowed in a transaction.\n",
+           input_buffer->buffer);
+    return META_COMMAND_SUCCESS;
+  }
+
+  char *argument;
   if (strcmp(input_buffer->buffer, ".exit") == 0) {
-    db_close(table);
-    exit(EXIT_SUCCESS);
+    return META_COMMAND_EXIT;
   } else if (strcmp(input_buffer->buffer, ".btree") == 0) {
     printf("Tree:\n");
-    print_tree(table->pager, 0, 0);
+    print_tree(table->pager, table->root_page_num, 0);
     return META_COMMAND_SUCCESS;
   } else if (strcmp(input_buffer->buffer, ".constants") == 0) {
     printf("Constants:\n");
-    print_constants();
+    print_constants(table->pager);
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(input_buffer->buffer, ".stats") == 0) {
+    printf("pages read: %d\n", table->pager->pages_read);
+    printf("pages mapped: %d\n", table->pager->pages_mapped);
+    printf("pages prefetched: %d\n", table->pager->pages_prefetched);
+    printf("pages written: %d\n", table->pager->pages_written);
+    printf("pages skipped: %d\n", table->pager->pages_skipped);
+    printf("pages flushed: %d\n", table->pager->pages_flushed);
+    printf("pages compressed: %d\n", table->pager->pages_compressed);
+    if (table->pager->wal) {
+      printf("wal frames written: %d\n", table->pager->wal->frames_written);
+      printf("wal syncs: %d\n", table->pager->wal->syncs);
+      printf("checkpoints: %d\n", table->pager->checkpoints);
+    }
+    void *header = get_page(table->pager, DB_HEADER_PAGE_NUM);
+    printf("pages: %d\n", table->pager->num_pages);
+    printf("free pages: %d\n", *header_freelist_count(header));
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(input_buffer->buffer, ".io") == 0) {
+    IoBackend *io = &table->pager->io;
+    printf("%s%s\n", io->type == IO_BACKEND_URING ? "io_uring" : "posix",
+           io->direct ? " (O_DIRECT)" : "");
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(input_buffer->buffer, ".mmap on") == 0) {
+    pager_set_mmap_enabled(table->pager, true);
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(input_buffer->buffer, ".mmap off") == 0) {
+    pager_set_mmap_enabled(table->pager, false);
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(input_buffer->buffer, ".compress") == 0) {
+    printf("%s\n", table->pager->compression ? "on" : "off");
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(input_buffer->buffer, ".compress on") == 0) {
+    table->pager->compression = true;
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(input_buffer->buffer, ".compress off") == 0) {
+    table->pager->compression = false;
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(input_buffer->buffer, ".checkpoint") == 0) {
+    pager_checkpoint(table->pager);
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(input_buffer->buffer, ".integrity_check") == 0) {
+    return do_integrity_check(table);
+  } else if (strcmp(input_buffer->buffer, ".vacuum") == 0) {
+    table_vacuum(table);
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(input_buffer->buffer, ".wal on") == 0) {
+    pager_set_wal_enabled(table->pager, true);
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(input_buffer->buffer, ".wal off") == 0) {
+    pager_set_wal_enabled(table->pager, false);
+    return META_COMMAND_SUCCESS;
+  } else if (strncmp(input_buffer->buffer, ".wal_sync ", 10) == 0) {
+    if (table->pager->wal == NULL) {
+      printf("WAL is disabled.\n");
+    } else {
+      uint32_t commits_per_sync = atoi(input_buffer->buffer + 10);
+      table->pager->wal->commits_per_sync =
+          commits_per_sync ? commits_per_sync : 1;
+    }
+    return META_COMMAND_SUCCESS;
+  } else if (strncmp(input_buffer->buffer, ".import ", 8) == 0) {
+    return do_import(input_buffer, table);
+  } else if ((argument = meta_command_argument(input_buffer->buffer,
+                                               ".prefetch")) != NULL) {
+    return do_prefetch(argument, table);
+  } else if (strncmp(input_buffer->buffer, ".threads", 8) == 0) {
+    return do_threads(input_buffer, table);
+  } else if (strncmp(input_buffer->buffer, ".cache_size", 11) == 0) {
+    char *frames_string = input_buffer->buffer + 11;
+    if (*frames_string == '\0') {
+      printf("%d\n", table->pager->max_frames);
+    } else {
+      pager_set_max_frames(table->pager, atoi(frames_string));
+    }
     return META_COMMAND_SUCCESS;
   } else {
     return META_COMMAND_UNRECOGNIZED_COMMAND;
@@ -18,76 +270,366 @@ MetaCommandResult do_meta_command(InputBuffer *input_buffer, Table *table) {
 }
 
 /*
- * Until we start recycling free pages, new pages will always
- * go onto the end of the database file.
- *
- * For now, we’re assuming that in a database with N pages, page numbers 0
- * through N-1 are allocated. Therefore we can always allocate page number N for
- * new pages. Eventually after we implement deletion, some pages may become
- * empty and their page numbers unused. To be more efficient, we could
- * re-allocate those free pages.
+ * Meta commands reach into the pager and the tree, so they run with the
+ * table locked against the flusher. .flusher itself waits for the flusher
+ * to stop, and so must not hold the lock.
  */
-uint32_t get_unused_page_num(Pager *pager) { return pager->num_pages; }
+MetaCommandResult do_meta_command(InputBuffer *input_buffer, Table *table) {
+  char *rate_string = meta_command_argument(input_buffer->buffer, ".flusher");
+  if (rate_string != NULL) {
+    return do_flusher(rate_string, table);
+  }
 
-int main(int argc, char *argv[]) {
-  if (argc < 2) {
-    printf("Must supply a database filename.\n");
-    exit(EXIT_FAILURE);
+  pthread_rwlock_wrlock(&table->lock);
+  MetaCommandResult result = run_meta_command(input_buffer, table);
+  pthread_rwlock_unlock(&table->lock);
+  return result;
+}
+
+/*
+ * Batch mode names the line of each error, having no prompt to tell which
+ * statement went wrong.
+ */
+static void print_error_location(ScriptReader *script) {
+  if (script != NULL) {
+    printf("Line %d: ", script->line_num);
   }
+}
 
-  char *filename = argv[1];
-  Table *table = db_open(filename);
+/* Report why text, a line of input, could not be prepared or bound */
+static void print_prepare_error(PrepareResult result, const char *text,
+                                ScriptReader *script) {
+  print_error_location(script);
+  switch (result) {
+  case (PREPARE_SUCCESS):
+    break;
+  case (PREPARE_NEGATIVE_ID):
+    printf("ID must be positive.\n");
+    break;
+  case (PREPARE_STRING_TOO_LONG):
+    printf("String is too long.\n");
+    break;
+  case (PREPARE_SYNTAX_ERROR):
+    printf("Syntax error. Could not parse statement.\n");
+    break;
+  case (PREPARE_UNRECOGNIZED_STATEMENT):
+    printf("Unrecognized keyword at start of '%s'.\n", text);
+    break;
+  }
+}
 
-  InputBuffer *input_buffer = new_input_buffer();
-  while (true) {
-    print_prompt();
-    read_input(input_buffer);
+/*
+ * Write the row a query stepped to as "(<column>, <column>, ...)". Text is
+ * copied straight out of the page the row lives in.
+ */
+static void write_row(Query *query, Writer *writer) {
+  writer_bytes(writer, "(", 1);
+  uint32_t num_columns = query_column_count(query);
+  for (uint32_t i = 0; i < num_columns; i++) {
+    if (i > 0) {
+      writer_bytes(writer, ", ", 2);
+    }
+    if (query_column_type(query, i) == COLUMN_TYPE_INTEGER) {
+      writer_uint(writer, query_column_int(query, i));
+    } else {
+      uint32_t length;
+      const char *text = query_column_text(query, i, &length);
+      writer_bytes(writer, text, length);
+    }
+  }
+  writer_bytes(writer, ")\n", 2);
+}
 
-    if (input_buffer->buffer[0] == '.') {
-      switch (do_meta_command(input_buffer, table)) {
-      case (META_COMMAND_SUCCESS):
-        continue;
-      case (META_COMMAND_UNRECOGNIZED_COMMAND):
-        printf("Unrecognized command '%s'\n", input_buffer->buffer);
-        continue;
+static LineResult run_statement(Statement *statement, Table *table,
+                                ScriptReader *script) {
+  ExecuteResult result = EXECUTE_SUCCESS;
+  if (scan_is_parallel(table, statement)) {
+    scan_parallel(table, statement, stdout, write_row);
+  } else {
+    Query query;
+    query_init(&query, table, statement);
+
+    Writer writer;
+    writer_init(&writer, stdout);
+    while (query_step(&query) == STEP_ROW) {
+      write_row(&query, &writer);
+    }
+    writer_flush(&writer);
+    result = query_result(&query);
+  }
+
+  if (result != EXECUTE_SUCCESS) {
+    print_error_location(script);
+  }
+  switch (result) {
+  case (EXECUTE_SUCCESS):
+    if (script == NULL) {
+      printf("Executed.\n");
+    }
+    return LINE_SUCCESS;
+  case (EXECUTE_TABLE_FULL):
+    printf("Error: Table full.\n");
+    break;
+  case (EXECUTE_DUPLICATE_KEY):
+    printf("Error: Duplicate Key.\n");
+    break;
+  case (EXECUTE_KEY_NOT_FOUND):
+    printf("Error: Key not found.\n");
+    break;
+  case (EXECUTE_IN_TRANSACTION):
+    printf("Error: Already in a transaction.\n");
+    break;
+  case (EXECUTE_NO_TRANSACTION):
+    printf("Error: No transaction is active.\n");
+    break;
+  }
+  return LINE_ERROR;
+}
+
+static LineResult print_unknown_statement(Token *name, ScriptReader *script) {
+  print_error_location(script);
+  printf("Error: No prepared statement named '%.*s'.\n", name->length,
+         name->start);
+  return LINE_ERROR;
+}
+
+/*
+ * prepare <name> as <statement>, execute <name> [<value> ...] and
+ * deallocate <name>. A prepared statement is parsed once and kept in the
+ * cache; execute binds one value to each of its parameters, in order, and
+ * runs it. line is the whole line, tokenized by tokenizer.
+ */
+static LineResult run_prepared(const char *line, Tokenizer *tokenizer,
+                               Token *keyword, Table *table,
+                               StatementCache *cache, ScriptReader *script) {
+  Token name = tokenizer_next(tokenizer);
+  if (name.type != TOKEN_WORD) {
+    print_prepare_error(PREPARE_SYNTAX_ERROR, line, script);
+    return LINE_ERROR;
+  }
+
+  if (token_is(keyword, "execute")) {
+    Statement *statement =
+        statement_cache_find(cache, name.start, name.length);
+    if (statement == NULL) {
+      return print_unknown_statement(&name, script);
+    }
+    PrepareResult result = PREPARE_SUCCESS;
+    for (uint32_t i = 1; i <= statement->num_parameters; i++) {
+      Token value = tokenizer_next_value(tokenizer);
+      if (value.type == TOKEN_END) {
+        result = PREPARE_SYNTAX_ERROR;
+        break;
+      }
+      result = statement_bind_text(statement, i, value.start, value.length);
+      if (result != PREPARE_SUCCESS) {
+        break;
       }
     }
+    if (result == PREPARE_SUCCESS &&
+        tokenizer_next_value(tokenizer).type != TOKEN_END) {
+      result = PREPARE_SYNTAX_ERROR;
+    }
+    if (result != PREPARE_SUCCESS) {
+      print_prepare_error(result, line, script);
+      return LINE_ERROR;
+    }
+    return run_statement(statement, table, script);
+  }
 
-    Statement statement;
-    switch (prepare_statement(input_buffer, &statement)) {
-    case (PREPARE_SUCCESS):
-      break;
-    case (PREPARE_NEGATIVE_ID):
-      printf("ID must be positive.\n");
-      continue;
-    case (PREPARE_STRING_TOO_LONG):
-      printf("String is too long.\n");
-      continue;
-    case (PREPARE_SYNTAX_ERROR):
-      printf("Syntax error. Could not parse statement.\n");
-      continue;
-    case (PREPARE_UNRECOGNIZED_STATEMENT):
-      printf("Unrecognized keyword at start of '%s'.\n", input_buffer->buffer);
+  if (token_is(keyword, "prepare")) {
+    Token as = tokenizer_next(tokenizer);
+    if (!token_is(&as, "as")) {
+      print_prepare_error(PREPARE_SYNTAX_ERROR, line, script);
+      return LINE_ERROR;
+    }
+    const char *text = tokenizer_rest(tokenizer);
+    Statement *statement = statement_cache_add(cache, name.start, name.length);
+    PrepareResult result = prepare_statement(text, statement);
+    if (result != PREPARE_SUCCESS) {
+      statement_cache_remove(cache, name.start, name.length);
+      print_prepare_error(result, text, script);
+      return LINE_ERROR;
+    }
+  } else {
+    if (tokenizer_next(tokenizer).type != TOKEN_END) {
+      print_prepare_error(PREPARE_SYNTAX_ERROR, line, script);
+      return LINE_ERROR;
+    }
+    if (!statement_cache_remove(cache, name.start, name.length)) {
+      return print_unknown_statement(&name, script);
+    }
+  }
+
+  if (script == NULL) {
+    printf("Executed.\n");
+  }
+  return LINE_SUCCESS;
+}
+
+/*
+ * Run one line of input, a meta command or a statement. script is the
+ * script being run in batch mode, where successes are not acknowledged, and
+ * NULL at the prompt.
+ */
+static LineResult run_line(InputBuffer *input_buffer, Table *table,
+                           StatementCache *cache, ScriptReader *script) {
+  if (input_buffer->buffer[0] == '.') {
+    switch (do_meta_command(input_buffer, table)) {
+    case (META_COMMAND_SUCCESS):
+      return LINE_SUCCESS;
+    case (META_COMMAND_EXIT):
+      return LINE_EXIT;
+    case (META_COMMAND_UNRECOGNIZED_COMMAND):
+      print_error_location(script);
+      printf("Unrecognized command '%s'\n", input_buffer->buffer);
+      return LINE_ERROR;
+    }
+  }
+
+  Tokenizer tokenizer;
+  tokenizer_init(&tokenizer, input_buffer->buffer);
+  Token keyword = tokenizer_next(&tokenizer);
+  if (token_is(&keyword, "prepare") || token_is(&keyword, "execute") ||
+      token_is(&keyword, "deallocate")) {
+    return run_prepared(input_buffer->buffer, &tokenizer, &keyword, table,
+                        cache, script);
+  }
+
+  Statement statement;
+  PrepareResult result = prepare_statement(input_buffer->buffer, &statement);
+  if (result != PREPARE_SUCCESS) {
+    statement_free(&statement);
+    print_prepare_error(result, input_buffer->buffer, script);
+    return LINE_ERROR;
+  }
+  if (statement.num_parameters > 0) {
+    // Nothing can be bound to a statement that is not prepared by name
+    statement_free(&statement);
+    print_prepare_error(PREPARE_SYNTAX_ERROR, input_buffer->buffer, script);
+    return LINE_ERROR;
+  }
+
+  LineResult line_result = run_statement(&statement, table, script);
+  statement_free(&statement);
+  return line_result;
+}
+
+/*
+ * Run every line of a script, skipping blank lines and "--" comments, then
+ * report how many statements ran and how fast on stderr, out of the way of
+ * the results.
+ */
+static void run_script(ScriptReader *script, Table *table,
+                       StatementCache *cache) {
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  uint32_t num_statements = 0;
+  uint32_t num_errors = 0;
+  InputBuffer line;
+  while (script_read_line(script, &line)) {
+    if (line.input_length == 0 || strncmp(line.buffer, "--", 2) == 0) {
       continue;
     }
+    LineResult result = run_line(&line, table, cache, script);
+    if (result == LINE_EXIT) {
+      break;
+    }
+    num_statements++;
+    if (result == LINE_ERROR) {
+      num_errors++;
+    }
+  }
 
-    switch (execute_statement(&statement, table)) {
-    case (EXECUTE_SUCCESS):
-      printf("Executed.\n");
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double seconds =
+      (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  fflush(stdout);
+  fprintf(stderr, "Executed %d statements (%d failed) in %.3fs",
+          num_statements, num_errors, seconds);
+  if (seconds > 0) {
+    fprintf(stderr, ", %.0f statements/s", num_statements / seconds);
+  }
+  fprintf(stderr, ".\n");
+}
+
+int main(int argc, char *argv[]) {
+  uint32_t page_size = PAGER_DEFAULT_PAGE_SIZE;
+  IoBackendType io_backend = IO_BACKEND_POSIX;
+  bool direct_io = false;
+  char *script_filename = NULL;
+
+  int option;
+  while ((option = getopt(argc, argv, "p:i:df:")) != -1) {
+    switch (option) {
+    case ('p'):
+      // Only used when the database file is created
+      page_size = atoi(optarg);
       break;
-    case (EXECUTE_TABLE_FULL):
-      printf("Error: Table full.\n");
+    case ('i'):
+      if (strcmp(optarg, "posix") == 0) {
+        io_backend = IO_BACKEND_POSIX;
+        break;
+      }
+      if (strcmp(optarg, "uring") == 0) {
+        io_backend = IO_BACKEND_URING;
+        break;
+      }
+      // fall through
+    default:
+      printf("Usage: %s [-p PAGE_SIZE] [-i posix|uring] [-d] [-f SCRIPT] "
+             "FILENAME\n",
+             argv[0]);
+      exit(EXIT_FAILURE);
+    case ('d'):
+      direct_io = true;
       break;
-    case (EXECUTE_DUPLICATE_KEY):
-      printf("Error: Duplicate Key.\n");
+    case ('f'):
+      // "-" reads the script from standard input
+      script_filename = optarg;
       break;
     }
   }
 
-  free(input_buffer);
-  for (int i = 0; i < TABLE_MAX_PAGES; i++) {
-    free(table->pager->pages[i]);
+  if (optind >= argc) {
+    printf("Must supply a database filename.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  char *filename = argv[optind];
+  Table *table = db_open(filename, page_size);
+  pager_set_io(table->pager, io_backend, direct_io);
+
+  StatementCache cache;
+  statement_cache_init(&cache);
+
+  if (script_filename != NULL) {
+    ScriptReader *script = script_open(script_filename);
+    if (script == NULL) {
+      printf("Error: could not open '%s'.\n", script_filename);
+      db_close(table);
+      exit(EXIT_FAILURE);
+    }
+    run_script(script, table, &cache);
+    script_close(script);
+    statement_cache_free(&cache);
+    db_close(table);
+    return EXIT_SUCCESS;
+  }
+
+  InputBuffer *input_buffer = new_input_buffer();
+  while (true) {
+    print_prompt();
+    read_input(input_buffer);
+    if (run_line(input_buffer, table, &cache, NULL) == LINE_EXIT) {
+      break;
+    }
   }
-  free(table->pager);
-  free(table);
+
+  close_input_buffer(input_buffer);
+  statement_cache_free(&cache);
+  db_close(table);
+  return EXIT_SUCCESS;
 }
@@ -25,10 +25,29 @@ void create_new_root(Table *table, uint32_t right_child_page_num) {
   void *right_child = get_page(table->pager, right_child_page_num);
   uint32_t left_child_page_num = get_unused_page_num(table->pager);
   void *left_child = get_page(table->pager, left_child_page_num);
+  pager_mark_dirty(table->pager, table->root_page_num);
+  pager_mark_dirty(table->pager, right_child_page_num);
+  pager_mark_dirty(table->pager, left_child_page_num);
+
+  /* When splitting an internal root, the new right child starts out empty */
+  if (get_node_type(root) == NODE_INTERNAL) {
+    initialize_internal_node(right_child);
+    initialize_internal_node(left_child);
+  }
 
-  memcpy(left_child, root, PAGE_SIZE);
+  memcpy(left_child, root, table->pager->page_size);
   set_node_root(left_child, false);
 
+  /* The old root's children now hang off the left child */
+  if (get_node_type(left_child) == NODE_INTERNAL) {
+    for (uint32_t i = 0; i <= *internal_node_num_keys(left_child); i++) {
+      uint32_t child_page_num = *internal_node_child(left_child, i);
+      void *child = get_page(table->pager, child_page_num);
+      pager_mark_dirty(table->pager, child_page_num);
+      *node_parent(child) = left_child_page_num;
+    }
+  }
+
   /* Root node is a new internal node with one key and two children */
   initialize_internal_node(root);
   set_node_root(root, true);
@@ -37,6 +56,8 @@ void create_new_root(Table *table, uint32_t right_child_page_num) {
   uint32_t left_child_max_key = get_node_max_key(table->pager, left_child);
   *internal_node_key(root, 0) = left_child_max_key;
   *internal_node_right_child(root) = right_child_page_num;
+  *node_parent(left_child) = table->root_page_num;
+  *node_parent(right_child) = table->root_page_num;
 }
 
 // These methods return a pointer to the value in question, so they can be used
@@ -56,18 +77,29 @@ uint32_t *leaf_node_num_cells(void *node) {
 }
 
 /**
- * Returns a pointer to a specific cell in a leaf node.
+ * Returns a pointer to the number of bytes taken up by the rows stored at the
+ * end of a leaf node.
+ *
+ * @param node A pointer to the leaf node.
+ * @return A pointer to the content size of the leaf node.
+ */
+uint32_t *leaf_node_content_size(void *node) {
+  return node + LEAF_NODE_CONTENT_SIZE_OFFSET;
+}
+
+/**
+ * Returns a pointer to the slot of a specific cell in a leaf node.
  *
- * This function calculates the address of a specific cell in a leaf node
+ * This function calculates the address of a specific slot in a leaf node
  * by adding the header size and the offset for the cell number to the base
  * address of the node.
  *
  * @param node A pointer to the leaf node.
  * @param cell_num The index of the cell within the leaf node.
- * @return A pointer to the specified cell in the leaf node.
+ * @return A pointer to the slot of the specified cell in the leaf node.
  */
 void *leaf_node_cell(void *node, uint32_t cell_num) {
-  return node + LEAF_NODE_HEADER_SIZE + cell_num * LEAF_NODE_CELL_SIZE;
+  return node + LEAF_NODE_HEADER_SIZE + cell_num * LEAF_NODE_SLOT_SIZE;
 }
 
 /**
@@ -82,22 +114,104 @@ void *leaf_node_cell(void *node, uint32_t cell_num) {
  * @return A pointer to the key of the specified cell in the leaf node.
  */
 void *leaf_node_key(void *node, uint32_t cell_num) {
-  return leaf_node_cell(node, cell_num);
+  return leaf_node_cell(node, cell_num) + LEAF_NODE_KEY_OFFSET;
+}
+
+uint16_t *leaf_node_value_offset(void *node, uint32_t cell_num) {
+  return leaf_node_cell(node, cell_num) + LEAF_NODE_VALUE_OFFSET_OFFSET;
+}
+
+uint16_t *leaf_node_value_size(void *node, uint32_t cell_num) {
+  return leaf_node_cell(node, cell_num) + LEAF_NODE_VALUE_SIZE_OFFSET;
 }
 
 /**
  * Returns a pointer to the value of a specific cell in a leaf node.
  *
- * This function calculates the address of the value of a specific cell in a
- * leaf node by using the leaf_node_cell function to get the cell and adding the
- * size of the key to the cell address.
+ * The cell's slot holds the offset of its serialized row within the page.
  *
  * @param node A pointer to the leaf node.
  * @param cell_num The index of the cell within the leaf node.
  * @return A pointer to the value of the specified cell in the leaf node.
  */
 void *leaf_node_value(void *node, uint32_t cell_num) {
-  return leaf_node_cell(node, cell_num) + LEAF_NODE_KEY_SIZE;
+  return node + *leaf_node_value_offset(node, cell_num);
+}
+
+/**
+ * Returns the number of bytes between the slot array and the rows, which is
+ * what a new cell (slot plus row) has to fit into.
+ *
+ * @param pager The pager the node belongs to, for the page size.
+ * @param node A pointer to the leaf node.
+ * @return The free space of the leaf node in bytes.
+ */
+uint32_t leaf_node_free_space(Pager *pager, void *node) {
+  return pager->page_size - LEAF_NODE_HEADER_SIZE -
+         *leaf_node_num_cells(node) * LEAF_NODE_SLOT_SIZE -
+         *leaf_node_content_size(node);
+}
+
+/**
+ * Inserts a cell at cell_num, shifting the slots after it to the right, and
+ * copies its value in front of the rows already stored.
+ *
+ * The caller must make sure that a slot plus value_size bytes fit in the
+ * node's free space.
+ *
+ * @param pager The pager the node belongs to, for the page size.
+ * @param node A pointer to the leaf node.
+ * @param cell_num The index the new cell will have.
+ * @param key The key of the new cell.
+ * @param value The serialized row.
+ * @param value_size The size of the serialized row in bytes.
+ */
+void leaf_node_insert_value(Pager *pager, void *node, uint32_t cell_num,
+                            uint32_t key, void *value, uint32_t value_size) {
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  if (cell_num < num_cells) {
+    memmove(leaf_node_cell(node, cell_num + 1), leaf_node_cell(node, cell_num),
+            (num_cells - cell_num) * LEAF_NODE_SLOT_SIZE);
+  }
+
+  *leaf_node_content_size(node) += value_size;
+  uint32_t value_offset = pager->page_size - *leaf_node_content_size(node);
+  memcpy(node + value_offset, value, value_size);
+
+  *(uint32_t *)leaf_node_key(node, cell_num) = key;
+  *leaf_node_value_offset(node, cell_num) = value_offset;
+  *leaf_node_value_size(node, cell_num) = value_size;
+  *leaf_node_num_cells(node) = num_cells + 1;
+}
+
+/**
+ * Removes a cell, shifting the slots after it to the left, and closes the gap
+ * its value leaves among the rows so that they stay packed against the end of
+ * the page.
+ *
+ * @param pager The pager the node belongs to, for the page size.
+ * @param node A pointer to the leaf node.
+ * @param cell_num The index of the cell to remove.
+ */
+void leaf_node_remove_cell(Pager *pager, void *node, uint32_t cell_num) {
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  uint32_t value_offset = *leaf_node_value_offset(node, cell_num);
+  uint32_t value_size = *leaf_node_value_size(node, cell_num);
+
+  /* Rows stored in front of the removed one move up by its size */
+  uint32_t content_start = pager->page_size - *leaf_node_content_size(node);
+  memmove(node + content_start + value_size, node + content_start,
+          value_offset - content_start);
+  for (uint32_t i = 0; i < num_cells; i++) {
+    if (*leaf_node_value_offset(node, i) < value_offset) {
+      *leaf_node_value_offset(node, i) += value_size;
+    }
+  }
+
+  memmove(leaf_node_cell(node, cell_num), leaf_node_cell(node, cell_num + 1),
+          (num_cells - cell_num - 1) * LEAF_NODE_SLOT_SIZE);
+  *leaf_node_content_size(node) -= value_size;
+  *leaf_node_num_cells(node) = num_cells - 1;
 }
 
 uint32_t *leaf_node_next_leaf(void *node) {
@@ -117,6 +231,7 @@ void initialize_leaf_node(void *node) {
   set_node_root(node, false);
   *leaf_node_num_cells(node) = 0;
   *leaf_node_next_leaf(node) = 0; // 0 represents no sibling
+  *leaf_node_content_size(node) = 0;
 }
 
 uint32_t *internal_node_num_keys(void *node) {
@@ -181,11 +296,13 @@ void internal_node_insert(Table *table, uint32_t parent_page_num,
 
   uint32_t original_num_keys = *internal_node_num_keys(parent);
 
-  if (original_num_keys >= INTERNAL_NODE_MAX_KEYS) {
+  if (original_num_keys >= table->pager->internal_node_max_keys) {
     internal_node_split_and_insert(table, parent_page_num, child_page_num);
     return;
   }
 
+  pager_mark_dirty(table->pager, parent_page_num);
+
   uint32_t right_child_page_num = *internal_node_right_child(parent);
   /*
   An internal node with a right child of INVALID_PAGE_NUM is empty
@@ -224,7 +341,10 @@ void internal_node_insert(Table *table, uint32_t parent_page_num,
 
 void update_internal_node_key(void *node, uint32_t old_key, uint32_t new_key) {
   uint32_t old_child_index = internal_node_find_child(node, old_key);
-  *internal_node_key(node, old_child_index) = new_key;
+  /* The right child has no key of its own in this node */
+  if (old_child_index < *internal_node_num_keys(node)) {
+    *internal_node_key(node, old_child_index) = new_key;
+  }
 }
 
 uint32_t internal_node_find_child(void *node, uint32_t key) {
@@ -234,22 +354,8 @@ uint32_t internal_node_find_child(void *node, uint32_t key) {
   */
 
   uint32_t num_keys = *internal_node_num_keys(node);
-
-  /* Binary search */
-  uint32_t min_index = 0;
-  uint32_t max_index = num_keys; /* there is one more child than key */
-
-  while (min_index != max_index) {
-    uint32_t index = (min_index + max_index) / 2;
-    uint32_t key_to_right = *internal_node_key(node, index);
-    if (key_to_right >= key) {
-      max_index = index;
-    } else {
-      min_index = index + 1;
-    }
-  }
-
-  return min_index;
+  /* there is one more child than key */
+  return key_search(internal_node_key(node, 0), num_keys, key);
 }
 
 void initialize_internal_node(void *node) {
@@ -267,51 +373,31 @@ void initialize_internal_node(void *node) {
 }
 
 /**
- * Uses binary search to search for a given key. If a given key is not
+ * Searches a leaf for a given key with key_search(). If a given key is not
  * found, it returns position after which the key needs to be inserted
  *
  * @param table the table to be searched
  * @param page_num the page in which the key needs to be searched
  * @param key the key which needs to be searched for
- *
- * @return A pointer to the cursor at the given position
+ * @param cursor the cursor to position
  */
-Cursor *leaf_node_find(Table *table, uint32_t page_num, uint32_t key) {
+void leaf_node_find(Table *table, uint32_t page_num, uint32_t key,
+                    Cursor *cursor) {
   void *node = get_page(table->pager, page_num);
   uint32_t num_cells = *leaf_node_num_cells(node);
 
-  Cursor *cursor = malloc(sizeof(Cursor));
   cursor->table = table;
   cursor->page_num = page_num;
   cursor->end_of_table = false;
 
-  // Binary search
-  uint32_t min_index = 0;
-  uint32_t one_past_max_index = num_cells;
-  while (one_past_max_index != min_index) {
-    uint32_t index = (min_index + one_past_max_index) / 2;
-    uint32_t key_at_index = *(uint32_t *)leaf_node_key(node, index);
-    if (key == key_at_index) {
-      cursor->cell_num = index;
-      return cursor;
-    }
-    if (key < key_at_index) {
-      one_past_max_index = index;
-    } else {
-      min_index = index + 1;
-    }
-  }
-
-  cursor->cell_num = min_index;
-  return cursor;
+  cursor->cell_num = key_search(leaf_node_key(node, 0), num_cells, key);
 }
 
 /**
  * Inserts a key-value pair into a leaf node of a B-tree.
  *
  * This function handles the insertion of a key-value pair into a leaf node.
- * If the node is full, it prints an error message and exits. Node splitting
- * is required but not implemented in this function.
+ * If the node does not have room for the serialized row, it is split.
  *
  * @param cursor A pointer to the Cursor structure, which indicates the position
  *               in the table where the insertion should occur.
@@ -320,88 +406,167 @@ Cursor *leaf_node_find(Table *table, uint32_t page_num, uint32_t key) {
  * inserted.
  */
 void leaf_node_insert(Cursor *cursor, uint32_t key, Row *value) {
-  void *node = get_page(cursor->table->pager, cursor->page_num);
+  Pager *pager = cursor->table->pager;
+  void *node = get_page(pager, cursor->page_num);
 
-  uint32_t num_cells = *leaf_node_num_cells(node);
+  uint8_t serialized[ROW_MAX_SIZE];
+  uint32_t value_size = serialize_row(value, serialized);
 
   // Node full
-  if (num_cells >= LEAF_NODE_MAX_CELLS) {
+  if (leaf_node_free_space(pager, node) < LEAF_NODE_SLOT_SIZE + value_size) {
     leaf_node_split_and_insert(cursor, key, value);
     return;
   }
 
-  /**
-   * If the cursor's cell number is less than the current number of cells, it
-   * means the new cell needs to be inserted in the middle. We shift the
-   * existing cells to the right to make room for the new cell.
-   */
-  if (cursor->cell_num < num_cells) {
-    for (uint32_t i = num_cells; i > cursor->cell_num; i--) {
-      memcpy(leaf_node_cell(node, i), leaf_node_cell(node, i - 1),
-             LEAF_NODE_CELL_SIZE);
-    }
-  }
-
-  *(leaf_node_num_cells(node)) += 1;
-  *((uint32_t *)leaf_node_key(node, cursor->cell_num)) = key;
-  serialize_row(value, leaf_node_value(node, cursor->cell_num));
+  pager_mark_dirty(pager, cursor->page_num);
+  leaf_node_insert_value(pager, node, cursor->cell_num, key, serialized,
+                         value_size);
 }
 
 /*
- * Create a new node and move half the cells over.
+ * Create a new node and move the upper half of the cells, by size, over.
  * Insert the new value in one of the two nodes.
  * Update parent or create a new parent.
+ *
+ * Appending past the last key of the right-most leaf starts the new leaf with
+ * just the new cell instead, so a table filled with increasing ids ends up
+ * with full leaves rather than half-empty ones.
  */
 void leaf_node_split_and_insert(Cursor *cursor, uint32_t key, Row *value) {
-  void *old_node = get_page(cursor->table->pager, cursor->page_num);
-  uint32_t old_max = get_node_max_key(cursor->table->pager, old_node);
-  uint32_t new_page_num = get_unused_page_num(cursor->table->pager);
-  void *new_node = get_page(cursor->table->pager, new_page_num);
+  Pager *pager = cursor->table->pager;
+  void *old_node = get_page(pager, cursor->page_num);
+  uint32_t old_max = get_node_max_key(pager, old_node);
+  bool is_last_leaf = *leaf_node_next_leaf(old_node) == 0;
+  uint32_t new_page_num = get_unused_page_num(pager);
+  void *new_node = get_page(pager, new_page_num);
+  pager_mark_dirty(pager, cursor->page_num);
+  pager_mark_dirty(pager, new_page_num);
   initialize_leaf_node(new_node);
 
-  *(uint32_t *)(new_node) = *(uint32_t *)node_parent(old_node);
+  *node_parent(new_node) = *node_parent(old_node);
 
   /** Whenever we split a leaf node, update the sibling pointers. The old leaf’s
    * sibling becomes the new leaf, and the new leaf’s sibling becomes whatever
    * used to be the old leaf’s sibling. */
   *leaf_node_next_leaf(new_node) = *leaf_node_next_leaf(old_node);
   *leaf_node_next_leaf(old_node) = new_page_num;
+  if (is_last_leaf) {
+    cursor->table->last_leaf_page_num = new_page_num;
+  }
+
+  /*
+  The old node is rebuilt from a copy of itself, so that the rows it keeps are
+  packed against the end of the page again
+  */
+  void *old_copy = malloc(pager->page_size);
+  memcpy(old_copy, old_node, pager->page_size);
+  uint32_t old_num_cells = *leaf_node_num_cells(old_copy);
+  uint32_t num_cells = old_num_cells + 1;
+
+  uint8_t serialized[ROW_MAX_SIZE];
+  uint32_t value_size = serialize_row(value, serialized);
+
+  uint32_t total_size = LEAF_NODE_SLOT_SIZE + value_size;
+  for (uint32_t i = 0; i < old_num_cells; i++) {
+    total_size += LEAF_NODE_SLOT_SIZE + *leaf_node_value_size(old_copy, i);
+  }
+
+  /* The left node keeps the cells making up the first half of the bytes */
+  uint32_t left_split_count = old_num_cells;
+  if (!is_last_leaf || cursor->cell_num != old_num_cells) {
+    uint32_t left_size = 0;
+    left_split_count = 0;
+    while (left_split_count < num_cells - 1 && left_size < total_size / 2) {
+      uint32_t i = left_split_count;
+      if (i == cursor->cell_num) {
+        left_size += LEAF_NODE_SLOT_SIZE + value_size;
+      } else {
+        uint32_t from = i > cursor->cell_num ? i - 1 : i;
+        left_size +=
+            LEAF_NODE_SLOT_SIZE + *leaf_node_value_size(old_copy, from);
+      }
+      left_split_count++;
+    }
+    if (left_split_count == 0) {
+      left_split_count = 1;
+    }
+  }
+
+  *leaf_node_num_cells(old_node) = 0;
+  *leaf_node_content_size(old_node) = 0;
 
-  for (int32_t i = LEAF_NODE_MAX_CELLS; i >= 0; i--) {
+  for (uint32_t i = 0; i < num_cells; i++) {
     void *destination_node;
-    if (i >= LEAF_NODE_LEFT_SPLIT_COUNT) {
+    uint32_t index_within_node;
+    if (i >= left_split_count) {
       destination_node = new_node;
+      index_within_node = i - left_split_count;
     } else {
       destination_node = old_node;
+      index_within_node = i;
     }
 
-    uint32_t index_within_node = i % LEAF_NODE_LEFT_SPLIT_COUNT;
-    void *destination = leaf_node_cell(destination_node, index_within_node);
     if (i == cursor->cell_num) {
-      serialize_row(value, destination);
-    } else if (i > cursor->cell_num) {
-      memcpy(destination, leaf_node_cell(old_node, i - 1), LEAF_NODE_CELL_SIZE);
+      leaf_node_insert_value(pager, destination_node, index_within_node, key,
+                             serialized, value_size);
     } else {
-      memcpy(destination, leaf_node_cell(old_node, i), LEAF_NODE_CELL_SIZE);
+      uint32_t from = i > cursor->cell_num ? i - 1 : i;
+      leaf_node_insert_value(pager, destination_node, index_within_node,
+                             *(uint32_t *)leaf_node_key(old_copy, from),
+                             leaf_node_value(old_copy, from),
+                             *leaf_node_value_size(old_copy, from));
     }
   }
-
-  *(leaf_node_num_cells(old_node)) = LEAF_NODE_LEFT_SPLIT_COUNT;
-  *(leaf_node_num_cells(new_node)) = LEAF_NODE_RIGHT_SPLIT_COUNT;
+  free(old_copy);
 
   if (is_node_root(old_node)) {
-    return create_new_root(cursor->table, new_page_num);
+    create_new_root(cursor->table, new_page_num);
   } else {
     uint32_t parent_page_num = *(uint32_t *)node_parent(old_node);
     uint32_t new_max = get_node_max_key(cursor->table->pager, old_node);
     void *parent = get_page(cursor->table->pager, parent_page_num);
 
+    pager_mark_dirty(cursor->table->pager, parent_page_num);
     update_internal_node_key(parent, old_max, new_max);
     internal_node_insert(cursor->table, parent_page_num, new_page_num);
     return;
   }
 }
 
+/*
+ * Overwrite the cells of an internal node with num_children children, given
+ * in key order along with their max keys, and point the children back at it.
+ */
+static void internal_node_set_children(Table *table, uint32_t page_num,
+                                       uint32_t *children, uint32_t *max_keys,
+                                       uint32_t num_children) {
+  void *node = get_page(table->pager, page_num);
+  pager_mark_dirty(table->pager, page_num);
+
+  *internal_node_num_keys(node) = num_children - 1;
+  for (uint32_t i = 0; i < num_children - 1; i++) {
+    *internal_node_cell(node, i) = children[i];
+    *internal_node_key(node, i) = max_keys[i];
+  }
+  *internal_node_right_child(node) = children[num_children - 1];
+
+  for (uint32_t i = 0; i < num_children; i++) {
+    void *child = get_page(table->pager, children[i]);
+    if (*node_parent(child) != page_num) {
+      pager_mark_dirty(table->pager, children[i]);
+      *node_parent(child) = page_num;
+    }
+  }
+}
+
+/*
+ * Split a full internal node while adding child_page_num to it.
+ *
+ * The node's children plus the new one are laid out in key order, the lower
+ * half stays in the old node and the upper half moves to a new node. Every
+ * cell already carries its child's max key, so only the right child's max
+ * has to be looked up, no matter how large the fanout is.
+ */
 void internal_node_split_and_insert(Table *table, uint32_t parent_page_num,
                                     uint32_t child_page_num) {
   uint32_t old_page_num = parent_page_num;
@@ -412,118 +577,402 @@ void internal_node_split_and_insert(Table *table, uint32_t parent_page_num,
   uint32_t new_page_num = get_unused_page_num(table->pager);
 
   /*
-   Declaring a flag before updating pointers which
-   records whether this operation involves splitting the root -
-   if it does, we will insert our newly created node during
-   the step where the table's new root is created. If it does
-   not, we have to insert the newly created node into its parent
-   after the old node's keys have been transferred over. We are not
-   able to do this if the newly created node's parent is not a newly
-   initialized root node, because in that case its parent may have existing
-   keys aside from our old node which we are splitting. If that is true, we
-   need to find a place for our newly created node in its parent, and we
-   cannot insert it at the correct index if it does not yet have any keys
-   */
+  Gather every child in key order, together with its max key, with the new
+  child in its place
+  */
+  uint32_t old_num_keys = *internal_node_num_keys(old_node);
+  uint32_t num_children = old_num_keys + 2;
+  uint32_t *children = malloc(num_children * sizeof(uint32_t));
+  uint32_t *max_keys = malloc(num_children * sizeof(uint32_t));
+
+  uint32_t index = internal_node_find_child(old_node, child_max);
+  if (index == old_num_keys && child_max > old_max) {
+    index = old_num_keys + 1;
+  }
+  for (uint32_t i = 0, from = 0; i < num_children; i++) {
+    if (i == index) {
+      children[i] = child_page_num;
+      max_keys[i] = child_max;
+    } else if (from < old_num_keys) {
+      children[i] = *internal_node_child(old_node, from);
+      max_keys[i] = *internal_node_key(old_node, from);
+      from++;
+    } else {
+      children[i] = *internal_node_right_child(old_node);
+      max_keys[i] = old_max;
+      from++;
+    }
+  }
+
+  /*
+  If we are splitting the root, the old root's cells move to a new left child
+  and the new node becomes the new root's right child. Otherwise the new node
+  is added to the old node's parent once it has its keys, so that the parent
+  can place it
+  */
   uint32_t splitting_root = is_node_root(old_node);
 
-  void *parent;
-  void *new_node;
+  uint32_t parent_of_old_page_num;
   if (splitting_root) {
     create_new_root(table, new_page_num);
-    parent = get_page(table->pager, table->root_page_num);
-    /*
-    If we are splitting the root, we need to update old_node to point
-    to the new root's left child, new_page_num will already point to
-    the new root's right child
-    */
-    old_page_num = *internal_node_child(parent, 0);
+    parent_of_old_page_num = table->root_page_num;
+    void *root = get_page(table->pager, table->root_page_num);
+    old_page_num = *internal_node_child(root, 0);
     old_node = get_page(table->pager, old_page_num);
   } else {
-    parent = get_page(table->pager, *node_parent(old_node));
-    new_node = get_page(table->pager, new_page_num);
-    initialize_internal_node(new_node);
+    parent_of_old_page_num = *node_parent(old_node);
   }
+  void *new_node = get_page(table->pager, new_page_num);
+  pager_mark_dirty(table->pager, new_page_num);
+  initialize_internal_node(new_node);
+  *node_parent(new_node) = parent_of_old_page_num;
+
+  /* The lower half stays in the old node, the upper half moves over */
+  uint32_t left_count = num_children / 2;
+  internal_node_set_children(table, old_page_num, children, max_keys,
+                             left_count);
+  internal_node_set_children(table, new_page_num, children + left_count,
+                             max_keys + left_count, num_children - left_count);
+  uint32_t new_old_max = max_keys[left_count - 1];
+
+  free(children);
+  free(max_keys);
+
+  void *parent = get_page(table->pager, parent_of_old_page_num);
+  pager_mark_dirty(table->pager, parent_of_old_page_num);
+  update_internal_node_key(parent, old_max, new_old_max);
 
-  uint32_t *old_num_keys = internal_node_num_keys(old_node);
+  if (!splitting_root) {
+    internal_node_insert(table, parent_of_old_page_num, new_page_num);
+  }
+}
+
+void internal_node_find(Table *table, uint32_t page_num, uint32_t key,
+                        Cursor *cursor) {
+  void *node = get_page(table->pager, page_num);
+  uint32_t child_index = internal_node_find_child(node, key);
+  uint32_t child_num = *internal_node_child(node, child_index);
+  void *child = get_page(table->pager, child_num);
+  switch (get_node_type(child)) {
+  case NODE_LEAF:
+    leaf_node_find(table, child_num, key, cursor);
+    break;
+  case NODE_INTERNAL:
+    internal_node_find(table, child_num, key, cursor);
+    break;
+  }
+}
+/*
+ * Deleting rows
+ *
+ * A leaf left less than half full by a delete borrows cells from a sibling
+ * under the same parent, or is merged with it when both fit in one page.
+ * Merging removes a child from the parent, which in turn borrows from or
+ * merges with its own sibling once it has fewer than half its children, and
+ * a root left with a single child is replaced by that child. The tree never
+ * keeps near-empty nodes around, so its height and fill do not drift as rows
+ * are deleted and inserted again.
+ */
 
-  uint32_t cur_page_num = *internal_node_right_child(old_node);
-  void *cur = get_page(table->pager, cur_page_num);
+/* Bytes of a leaf's page taken up by its slots and rows */
+static uint32_t leaf_node_used_space(Pager *pager, void *node) {
+  return pager->page_size - LEAF_NODE_HEADER_SIZE -
+         leaf_node_free_space(pager, node);
+}
 
-  /*
-  First put right child into new node and set right child of old node to invalid
-  page number
-  */
-  internal_node_insert(table, new_page_num, cur_page_num);
-  *node_parent(cur) = new_page_num;
-  *internal_node_right_child(old_node) = INVALID_PAGE_NUM;
-  /*
-  For each key until you get to the middle key, move the key and the child to
-  the new node
-  */
-  for (int i = INTERNAL_NODE_MAX_CELLS - 1; i > INTERNAL_NODE_MAX_CELLS / 2;
-       i--) {
-    cur_page_num = *internal_node_child(old_node, i);
-    cur = get_page(table->pager, cur_page_num);
+static uint32_t leaf_node_min_space(Pager *pager) {
+  return (pager->page_size - LEAF_NODE_HEADER_SIZE) / 2;
+}
 
-    internal_node_insert(table, new_page_num, cur_page_num);
-    *node_parent(cur) = new_page_num;
+static uint32_t internal_node_min_children(Pager *pager) {
+  return (pager->internal_node_max_keys + 1) / 2;
+}
 
-    (*old_num_keys)--;
+/* Return the index of child_page_num among the children of node */
+static uint32_t internal_node_child_index(void *node,
+                                          uint32_t child_page_num) {
+  uint32_t num_keys = *internal_node_num_keys(node);
+  for (uint32_t i = 0; i < num_keys; i++) {
+    if (*internal_node_cell(node, i) == child_page_num) {
+      return i;
+    }
   }
+  return num_keys;
+}
 
-  /*
-  Set child before middle key, which is now the highest key, to be node's right
-  child, and decrement number of keys
-  */
-  *internal_node_right_child(old_node) =
-      *internal_node_child(old_node, *old_num_keys - 1);
-  (*old_num_keys)--;
+/*
+ * Drop the child at cell_num + 1 of an internal node after it has been merged
+ * into the child at cell_num, which takes over its place and max key.
+ */
+static void internal_node_remove_merged_child(void *node, uint32_t cell_num) {
+  uint32_t num_keys = *internal_node_num_keys(node);
+  *internal_node_child(node, cell_num + 1) =
+      *internal_node_child(node, cell_num);
+  memmove(internal_node_cell(node, cell_num),
+          internal_node_cell(node, cell_num + 1),
+          (num_keys - cell_num - 1) * INTERNAL_NODE_CELL_SIZE);
+  *internal_node_num_keys(node) = num_keys - 1;
+}
 
-  /*
-  Determine which of the two nodes after the split should contain the child to
-  be inserted, and insert the child
-  */
-  uint32_t max_after_split = get_node_max_key(table->pager, old_node);
+/*
+ * Record a node's new max key in the first ancestor that keeps it. A right
+ * child's max is its parent's max, so the key lives further up.
+ */
+static void update_ancestor_max_key(Table *table, uint32_t page_num,
+                                    uint32_t new_max) {
+  void *node = get_page(table->pager, page_num);
+  while (!is_node_root(node)) {
+    uint32_t parent_page_num = *node_parent(node);
+    void *parent = get_page(table->pager, parent_page_num);
+    uint32_t index = internal_node_child_index(parent, page_num);
+    if (index < *internal_node_num_keys(parent)) {
+      pager_mark_dirty(table->pager, parent_page_num);
+      *internal_node_key(parent, index) = new_max;
+      return;
+    }
+    page_num = parent_page_num;
+    node = parent;
+  }
+}
 
-  uint32_t destination_page_num =
-      child_max < max_after_split ? old_page_num : new_page_num;
+/*
+ * Find the sibling a node under its parent is rebalanced with: the next
+ * child, or the previous one for the right child. Returns the index of the
+ * left one of the pair.
+ */
+static uint32_t sibling_pair(void *parent, uint32_t page_num,
+                             uint32_t *left_page_num,
+                             uint32_t *right_page_num) {
+  uint32_t index = internal_node_child_index(parent, page_num);
+  if (index == *internal_node_num_keys(parent)) {
+    index--;
+  }
+  *left_page_num = *internal_node_child(parent, index);
+  *right_page_num = *internal_node_child(parent, index + 1);
+  return index;
+}
 
-  internal_node_insert(table, destination_page_num, child_page_num);
-  *node_parent(child) = destination_page_num;
+/*
+ * Replace a root that has a single child with that child. The root keeps its
+ * page number, so the child is copied into it and its page freed.
+ */
+static void collapse_root(Table *table) {
+  Pager *pager = table->pager;
+  void *root = get_page(pager, table->root_page_num);
+  uint32_t child_page_num = *internal_node_right_child(root);
+  void *child = get_page(pager, child_page_num);
+
+  pager_mark_dirty(pager, table->root_page_num);
+  memcpy(root, child, pager->page_size);
+  set_node_root(root, true);
 
-  update_internal_node_key(parent, old_max,
-                           get_node_max_key(table->pager, old_node));
+  if (get_node_type(root) == NODE_INTERNAL) {
+    for (uint32_t i = 0; i <= *internal_node_num_keys(root); i++) {
+      uint32_t grandchild_page_num = *internal_node_child(root, i);
+      void *grandchild = get_page(pager, grandchild_page_num);
+      pager_mark_dirty(pager, grandchild_page_num);
+      *node_parent(grandchild) = table->root_page_num;
+    }
+  }
 
-  if (!splitting_root) {
-    internal_node_insert(table, *node_parent(old_node), new_page_num);
-    *node_parent(new_node) = *node_parent(old_node);
+  table->last_leaf_page_num = INVALID_PAGE_NUM;
+  free_page_num(pager, child_page_num);
+}
+
+static void internal_node_rebalance(Table *table, uint32_t page_num) {
+  Pager *pager = table->pager;
+  void *node = get_page(pager, page_num);
+
+  if (is_node_root(node)) {
+    if (*internal_node_num_keys(node) == 0) {
+      collapse_root(table);
+    }
+    return;
+  }
+  uint32_t min_children = internal_node_min_children(pager);
+  if (*internal_node_num_keys(node) + 1 >= min_children) {
+    return;
+  }
+
+  uint32_t parent_page_num = *node_parent(node);
+  void *parent = get_page(pager, parent_page_num);
+  uint32_t left_page_num, right_page_num;
+  uint32_t index =
+      sibling_pair(parent, page_num, &left_page_num, &right_page_num);
+  void *left = get_page(pager, left_page_num);
+  void *right = get_page(pager, right_page_num);
+
+  /* Gather the children of both nodes in key order, with their max keys */
+  uint32_t left_num_keys = *internal_node_num_keys(left);
+  uint32_t right_num_keys = *internal_node_num_keys(right);
+  uint32_t num_children = left_num_keys + right_num_keys + 2;
+  uint32_t *children = malloc(num_children * sizeof(uint32_t));
+  uint32_t *max_keys = malloc(num_children * sizeof(uint32_t));
+
+  for (uint32_t i = 0; i < left_num_keys; i++) {
+    children[i] = *internal_node_cell(left, i);
+    max_keys[i] = *internal_node_key(left, i);
+  }
+  children[left_num_keys] = *internal_node_right_child(left);
+  max_keys[left_num_keys] = *internal_node_key(parent, index);
+  for (uint32_t i = 0; i < right_num_keys; i++) {
+    children[left_num_keys + 1 + i] = *internal_node_cell(right, i);
+    max_keys[left_num_keys + 1 + i] = *internal_node_key(right, i);
+  }
+  children[num_children - 1] = *internal_node_right_child(right);
+  max_keys[num_children - 1] = get_node_max_key(pager, right);
+
+  pager_mark_dirty(pager, parent_page_num);
+  if (num_children <= pager->internal_node_max_keys + 1) {
+    /* Merge the right node into the left one */
+    internal_node_set_children(table, left_page_num, children, max_keys,
+                               num_children);
+    internal_node_remove_merged_child(parent, index);
+    free_page_num(pager, right_page_num);
+    free(children);
+    free(max_keys);
+    internal_node_rebalance(table, parent_page_num);
+    return;
   }
+
+  /* Borrow just enough children to bring the smaller node up to half full */
+  uint32_t left_count = left_page_num == page_num
+                            ? min_children
+                            : num_children - min_children;
+  internal_node_set_children(table, left_page_num, children, max_keys,
+                             left_count);
+  internal_node_set_children(table, right_page_num, children + left_count,
+                             max_keys + left_count, num_children - left_count);
+  *internal_node_key(parent, index) = max_keys[left_count - 1];
+  free(children);
+  free(max_keys);
 }
 
-Cursor *internal_node_find(Table *table, uint32_t page_num, uint32_t key) {
-  void *node = get_page(table->pager, page_num);
-  uint32_t num_keys = *internal_node_num_keys(node);
+/*
+ * Lay the cells of two adjacent leaves out again, the first left_count of
+ * them in the left leaf and the rest in the right one.
+ */
+static void leaf_nodes_redistribute(Pager *pager, void *left, void *right,
+                                    uint32_t left_count) {
+  void *left_copy = malloc(pager->page_size);
+  void *right_copy = malloc(pager->page_size);
+  memcpy(left_copy, left, pager->page_size);
+  memcpy(right_copy, right, pager->page_size);
+  uint32_t left_num_cells = *leaf_node_num_cells(left_copy);
+  uint32_t num_cells = left_num_cells + *leaf_node_num_cells(right_copy);
+
+  *leaf_node_num_cells(left) = 0;
+  *leaf_node_content_size(left) = 0;
+  *leaf_node_num_cells(right) = 0;
+  *leaf_node_content_size(right) = 0;
+
+  for (uint32_t i = 0; i < num_cells; i++) {
+    void *source = i < left_num_cells ? left_copy : right_copy;
+    uint32_t from = i < left_num_cells ? i : i - left_num_cells;
+    void *destination = i < left_count ? left : right;
+    uint32_t index_within_node = i < left_count ? i : i - left_count;
+    leaf_node_insert_value(pager, destination, index_within_node,
+                           *(uint32_t *)leaf_node_key(source, from),
+                           leaf_node_value(source, from),
+                           *leaf_node_value_size(source, from));
+  }
 
-  /* Binary Search */
-  uint32_t min_index = 0;
-  uint32_t max_index = num_keys;
+  free(left_copy);
+  free(right_copy);
+}
 
-  while (min_index != max_index) {
-    uint32_t index = (min_index + max_index) / 2;
-    uint32_t key_to_right = *internal_node_key(node, index);
-    if (key_to_right >= key) {
-      max_index = index;
-    } else {
-      min_index = index + 1;
+static void leaf_node_rebalance(Table *table, uint32_t page_num) {
+  Pager *pager = table->pager;
+  void *node = get_page(pager, page_num);
+  uint32_t parent_page_num = *node_parent(node);
+  void *parent = get_page(pager, parent_page_num);
+  uint32_t left_page_num, right_page_num;
+  uint32_t index =
+      sibling_pair(parent, page_num, &left_page_num, &right_page_num);
+  void *left = get_page(pager, left_page_num);
+  void *right = get_page(pager, right_page_num);
+  pager_mark_dirty(pager, left_page_num);
+  pager_mark_dirty(pager, right_page_num);
+  pager_mark_dirty(pager, parent_page_num);
+
+  uint32_t left_num_cells = *leaf_node_num_cells(left);
+  uint32_t num_cells = left_num_cells + *leaf_node_num_cells(right);
+  if (leaf_node_used_space(pager, left) + leaf_node_used_space(pager, right) <=
+      pager->page_size - LEAF_NODE_HEADER_SIZE) {
+    /* Merge the right leaf into the left one and unlink it */
+    leaf_nodes_redistribute(pager, left, right, num_cells);
+    uint32_t next_page_num = *leaf_node_next_leaf(right);
+    *leaf_node_next_leaf(left) = next_page_num;
+    if (next_page_num == 0) {
+      table->last_leaf_page_num = left_page_num;
+    } else if (table->last_leaf_page_num == right_page_num) {
+      table->last_leaf_page_num = INVALID_PAGE_NUM;
     }
+    internal_node_remove_merged_child(parent, index);
+    free_page_num(pager, right_page_num);
+    internal_node_rebalance(table, parent_page_num);
+    return;
   }
 
-  uint32_t child_num = *internal_node_child(node, min_index);
-  void *child = get_page(table->pager, child_num);
-  switch (get_node_type(child)) {
-  case NODE_LEAF:
-    return leaf_node_find(table, child_num, key);
-  case NODE_INTERNAL:
-    return internal_node_find(table, page_num, key);
+  /* Borrow just enough cells to bring the smaller leaf up to half full */
+  uint32_t min_space = leaf_node_min_space(pager);
+  uint32_t left_count = left_num_cells;
+  if (left_page_num == page_num) {
+    uint32_t left_space = leaf_node_used_space(pager, left);
+    for (uint32_t i = 0; left_space < min_space; i++, left_count++) {
+      left_space += LEAF_NODE_SLOT_SIZE + *leaf_node_value_size(right, i);
+    }
+  } else {
+    uint32_t right_space = leaf_node_used_space(pager, right);
+    while (right_space < min_space) {
+      left_count--;
+      right_space +=
+          LEAF_NODE_SLOT_SIZE + *leaf_node_value_size(left, left_count);
+    }
   }
-}
\ No newline at end of file
+  leaf_nodes_redistribute(pager, left, right, left_count);
+  *internal_node_key(parent, index) = get_node_max_key(pager, left);
+}
+
+/**
+ * Deletes the cell a cursor points at, then rebalances the leaf with a
+ * sibling if that left it less than half full.
+ *
+ * @param cursor A pointer to the Cursor positioned at the cell to delete.
+ */
+void leaf_node_delete(Cursor *cursor) {
+  Table *table = cursor->table;
+  Pager *pager = table->pager;
+  void *node = get_page(pager, cursor->page_num);
+  uint32_t num_cells = *leaf_node_num_cells(node);
+
+  pager_mark_dirty(pager, cursor->page_num);
+  leaf_node_remove_cell(pager, node, cursor->cell_num);
+  if (is_node_root(node)) {
+    return;
+  }
+
+  if (cursor->cell_num == num_cells - 1 && num_cells > 1) {
+    update_ancestor_max_key(table, cursor->page_num,
+                            get_node_max_key(pager, node));
+  }
+  if (leaf_node_used_space(pager, node) < leaf_node_min_space(pager)) {
+    leaf_node_rebalance(table, cursor->page_num);
+  }
+}
+
+/**
+ * Replaces the row a cursor points at. The row is rewritten in place when it
+ * still fits in its leaf, otherwise the leaf is split around it.
+ *
+ * @param cursor A pointer to the Cursor positioned at the row to replace.
+ * @param value A pointer to the new row, with the same key.
+ */
+void leaf_node_update(Cursor *cursor, Row *value) {
+  Pager *pager = cursor->table->pager;
+  void *node = get_page(pager, cursor->page_num);
+
+  pager_mark_dirty(pager, cursor->page_num);
+  leaf_node_remove_cell(pager, node, cursor->cell_num);
+  leaf_node_insert(cursor, value->id, value);
+}
@@ -1,6 +1,83 @@
 #include "db.h"
 
-Pager *pager_open(const char *filename) {
+/*
+ * Store the header of a new database in page 0 and write it straight to the
+ * file, so that the page size is known before anything else is read on the
+ * next open.
+ */
+static void pager_write_header(int fd, uint32_t page_size) {
+  void *header = calloc(1, page_size);
+  *(uint32_t *)(header + DB_HEADER_MAGIC_OFFSET) = DB_HEADER_MAGIC;
+  *(uint32_t *)(header + DB_HEADER_VERSION_OFFSET) = DB_HEADER_VERSION;
+  *(uint32_t *)(header + DB_HEADER_PAGE_SIZE_OFFSET) = page_size;
+  *header_root_page_num(header) = DB_HEADER_PAGE_NUM + 1;
+  *header_freelist_head(header) = 0;
+  *header_freelist_count(header) = 0;
+  page_set_checksum(header, page_size);
+
+  if (pwrite(fd, header, page_size, 0) != (ssize_t)page_size ||
+      fdatasync(fd) == -1) {
+    printf("Error writing db header: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+  free(header);
+}
+
+/*
+ * Read the page size from the header of an existing database.
+ */
+static uint32_t pager_read_page_size(int fd) {
+  uint32_t header[DB_HEADER_SIZE / sizeof(uint32_t)];
+  if (pread(fd, header, DB_HEADER_SIZE, 0) != (ssize_t)DB_HEADER_SIZE) {
+    printf("File is not a tinysql database.\n");
+    exit(EXIT_FAILURE);
+  }
+  // Version 1 files had no page header in front of the magic
+  if (header[DB_HEADER_MAGIC_OFFSET / sizeof(uint32_t)] != DB_HEADER_MAGIC &&
+      header[0] == DB_HEADER_MAGIC) {
+    printf("Unsupported db file version.\n");
+    exit(EXIT_FAILURE);
+  }
+  if (header[DB_HEADER_MAGIC_OFFSET / sizeof(uint32_t)] != DB_HEADER_MAGIC) {
+    printf("File is not a tinysql database.\n");
+    exit(EXIT_FAILURE);
+  }
+  if (header[DB_HEADER_VERSION_OFFSET / sizeof(uint32_t)] !=
+      DB_HEADER_VERSION) {
+    printf("Unsupported db file version.\n");
+    exit(EXIT_FAILURE);
+  }
+  return header[DB_HEADER_PAGE_SIZE_OFFSET / sizeof(uint32_t)];
+}
+
+static bool is_valid_page_size(uint32_t page_size) {
+  return page_size >= PAGER_MIN_PAGE_SIZE &&
+         page_size <= PAGER_MAX_PAGE_SIZE &&
+         (page_size & (page_size - 1)) == 0;
+}
+
+uint32_t *header_root_page_num(void *header) {
+  return header + DB_HEADER_ROOT_PAGE_OFFSET;
+}
+
+uint32_t *header_freelist_head(void *header) {
+  return header + DB_HEADER_FREELIST_HEAD_OFFSET;
+}
+
+uint32_t *header_freelist_count(void *header) {
+  return header + DB_HEADER_FREELIST_COUNT_OFFSET;
+}
+
+/**
+ * Open a database file, creating it with the given page size if it does not
+ * exist yet. An existing database keeps the page size stored in its header.
+ *
+ * @param filename the database file
+ * @param page_size the page size for a new database
+ *
+ * @return the pager, with the node layout worked out for its page size
+ */
+Pager *pager_open(const char *filename, uint32_t page_size) {
   int fd = open(filename,
                 O_RDWR |     // Read/Write mode
                     O_CREAT, // Create file if it does not exist
@@ -14,106 +91,1433 @@ Pager *pager_open(const char *filename) {
   }
 
   off_t file_length = lseek(fd, 0, SEEK_END);
+  if (file_length == 0) {
+    if (!is_valid_page_size(page_size)) {
+      printf("Page size must be a power of two from %d to %d.\n",
+             PAGER_MIN_PAGE_SIZE, PAGER_MAX_PAGE_SIZE);
+      exit(EXIT_FAILURE);
+    }
+    pager_write_header(fd, page_size);
+    file_length = page_size;
+  } else {
+    page_size = pager_read_page_size(fd);
+    if (!is_valid_page_size(page_size)) {
+      printf("Invalid page size %d in db header. Corrupt file.\n", page_size);
+      exit(EXIT_FAILURE);
+    }
+  }
 
   Pager *pager = malloc(sizeof(Pager));
+  pager->filename = strdup(filename);
   pager->file_descriptor = fd;
+  io_open(&pager->io, fd, IO_BACKEND_POSIX, false);
   pager->file_length = file_length;
-  pager->num_pages = (file_length / PAGE_SIZE);
+  pager->page_size = page_size;
+  pager->num_pages = (file_length / pager->page_size);
 
-  if (file_length % PAGE_SIZE != 0) {
+  if (file_length % pager->page_size != 0) {
     printf("Db file is not a whole number of pages. Corrupt file.\n");
     exit(EXIT_FAILURE);
   }
 
-  for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
-    pager->pages[i] = NULL;
+#ifdef TINYSQL_SMALL_FANOUT
+  pager->internal_node_max_keys = SMALL_FANOUT_INTERNAL_NODE_MAX_KEYS;
+#else
+  pager->internal_node_max_keys =
+      (page_size - INTERNAL_NODE_HEADER_SIZE) / INTERNAL_NODE_CELL_SIZE;
+#endif
+
+  pager->max_frames = PAGER_DEFAULT_MAX_FRAMES;
+  pager->num_frames = 0;
+  // Reserved whole, so that frames never move under a reader; only the part
+  // in use is ever backed by memory
+  pager->frames = mmap(NULL, PAGER_MAX_FRAMES * sizeof(Frame),
+                       PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (pager->frames == MAP_FAILED) {
+    printf("Error allocating page frames: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+  pager->clock_hand = 0;
+  pager->pin_epoch = 1;
+  pthread_mutex_init(&pager->latch, NULL);
+  memset(pager->sessions, 0, sizeof(pager->sessions));
+  pager->num_sessions = 0;
+
+  pager->page_table_capacity = 0;
+  pager->page_table = NULL;
+  pager->retired_page_tables = NULL;
+  pager->num_retired_page_tables = 0;
+  pager->written_frames = NULL;
+  pager->num_written_frames = 0;
+  pager->written_frames_capacity = 0;
+
+  pager->arena_slabs = NULL;
+  pager->num_arena_slabs = 0;
+  pager->free_pages = NULL;
+  pager->num_free_pages = 0;
+  pager->free_pages_capacity = 0;
+
+  pager->in_transaction = false;
+
+  pager->mmap_enabled = false;
+  pager->map = NULL;
+  pager->map_length = 0;
+
+  pager->prefetch_depth = PAGER_DEFAULT_PREFETCH_DEPTH;
+
+  pager->pages_read = 0;
+  pager->pages_mapped = 0;
+  pager->pages_prefetched = 0;
+  pager->pages_written = 0;
+  pager->pages_skipped = 0;
+  pager->pages_flushed = 0;
+  pager->checkpoints = 0;
+  pager->pages_compressed = 0;
+  pager->compression = false;
+
+  // Replay whatever committed statements the last session left in the log
+  pager->wal = wal_open(filename, page_size);
+  if (pager->wal->num_frames > 0) {
+    uint32_t db_num_pages = pager->wal->db_num_pages;
+    pager_checkpoint(pager);
+    if (db_num_pages > pager->num_pages) {
+      pager->num_pages = db_num_pages;
+    }
   }
 
   return pager;
 }
 
+/*
+ * Grow the page table so that it can map page_num. The table is indexed by
+ * page number, so it doubles in size rather than growing one page at a time.
+ * A reader may still be looking at the old table without the latch, so it
+ * is retired rather than freed; the tables add up to less than twice the
+ * size of the last one.
+ */
+static void pager_reserve_page_table(Pager *pager, uint32_t page_num) {
+  if (page_num < pager->page_table_capacity) {
+    return;
+  }
+
+  uint32_t capacity = pager->page_table_capacity ? pager->page_table_capacity
+                                                 : PAGER_DEFAULT_MAX_FRAMES;
+  while (capacity <= page_num) {
+    capacity *= 2;
+  }
+
+  uint32_t *page_table = malloc(capacity * sizeof(uint32_t));
+  for (uint32_t i = 0; i < capacity; i++) {
+    page_table[i] = i < pager->page_table_capacity ? pager->page_table[i]
+                                                   : INVALID_FRAME_NUM;
+  }
+  if (pager->page_table != NULL) {
+    pager->retired_page_tables =
+        realloc(pager->retired_page_tables,
+                (pager->num_retired_page_tables + 1) * sizeof(uint32_t *));
+    pager->retired_page_tables[pager->num_retired_page_tables++] =
+        pager->page_table;
+  }
+
+  // A reader that sees the new capacity also sees the new table
+  __atomic_store_n(&pager->page_table, page_table, __ATOMIC_RELEASE);
+  __atomic_store_n(&pager->page_table_capacity, capacity, __ATOMIC_RELEASE);
+}
+
+/* Map page_num to frame_num, or to INVALID_FRAME_NUM, for every reader */
+static void pager_set_page_frame(Pager *pager, uint32_t page_num,
+                                 uint32_t frame_num) {
+  __atomic_store_n(&pager->page_table[page_num], frame_num, __ATOMIC_RELEASE);
+}
+
+/*
+ * The frame caching page_num, or INVALID_FRAME_NUM, for a thread that does
+ * not hold the latch. The frame may have been given another page since.
+ */
+static uint32_t pager_cached_frame(Pager *pager, uint32_t page_num) {
+  uint32_t capacity =
+      __atomic_load_n(&pager->page_table_capacity, __ATOMIC_ACQUIRE);
+  uint32_t *page_table = __atomic_load_n(&pager->page_table, __ATOMIC_ACQUIRE);
+  if (page_num >= capacity) {
+    return INVALID_FRAME_NUM;
+  }
+  return __atomic_load_n(&page_table[page_num], __ATOMIC_ACQUIRE);
+}
+
+static uint32_t pager_lookup_frame(Pager *pager, uint32_t page_num) {
+  if (page_num >= pager->page_table_capacity) {
+    return INVALID_FRAME_NUM;
+  }
+  return pager->page_table[page_num];
+}
+
+/*
+ * The token's address tells threads apart, and a session belongs to the
+ * thread as long as its owner is that address; only the owner ever sets or
+ * clears it. Each thread also remembers the session it used last, which
+ * saves looking for it while it keeps to one pager.
+ */
+static _Thread_local Pager *session_pager = NULL;
+static _Thread_local uint32_t session_num = 0;
+static _Thread_local char session_token;
+
+/* The calling thread's session, or NULL when it has none; takes no latch */
+static PagerSession *pager_current_session(Pager *pager) {
+  // A pager opened where a closed one was has none of its sessions in use
+  uint32_t num_sessions =
+      __atomic_load_n(&pager->num_sessions, __ATOMIC_ACQUIRE);
+  if (session_pager == pager && session_num < num_sessions &&
+      __atomic_load_n(&pager->sessions[session_num].owner,
+                      __ATOMIC_RELAXED) == &session_token) {
+    return &pager->sessions[session_num];
+  }
+
+  // A thread using more than one pager keeps a session in each
+  for (uint32_t num = 0; num < num_sessions; num++) {
+    PagerSession *session = &pager->sessions[num];
+    if (__atomic_load_n(&session->owner, __ATOMIC_RELAXED) == &session_token) {
+      session_pager = pager;
+      session_num = num;
+      return session;
+    }
+  }
+  return NULL;
+}
+
+/*
+ * The session of the calling thread, which is started if need be in the
+ * first free slot. Called with the latch held.
+ */
+static PagerSession *pager_session(Pager *pager) {
+  PagerSession *session = pager_current_session(pager);
+  if (session != NULL) {
+    return session;
+  }
+
+  uint32_t num = 0;
+  while (num < pager->num_sessions && pager->sessions[num].owner != NULL) {
+    num++;
+  }
+  if (num == PAGER_MAX_SESSIONS) {
+    printf("Error: more than %d threads are using the database.\n",
+           PAGER_MAX_SESSIONS);
+    exit(EXIT_FAILURE);
+  }
+  if (num == pager->num_sessions) {
+    __atomic_store_n(&pager->num_sessions, num + 1, __ATOMIC_RELEASE);
+  }
+
+  session = &pager->sessions[num];
+  session->map_reads = false;
+  session->readahead_last_page_num = INVALID_PAGE_NUM;
+  session->readahead_end_page_num = 0;
+  session->pin_epoch = __atomic_load_n(&pager->pin_epoch, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&session->owner, &session_token, __ATOMIC_RELAXED);
+  session_pager = pager;
+  session_num = num;
+  return session;
+}
+
+/*
+ * The oldest epoch an active session has unpinned at. Frames stamped with it
+ * or anything later may still be in use. Called with the latch held.
+ */
+static uint64_t pager_oldest_pin_epoch(Pager *pager) {
+  uint64_t oldest = __atomic_load_n(&pager->pin_epoch, __ATOMIC_SEQ_CST);
+  for (uint32_t i = 0; i < pager->num_sessions; i++) {
+    PagerSession *session = &pager->sessions[i];
+    uint64_t pin_epoch = __atomic_load_n(&session->pin_epoch, __ATOMIC_SEQ_CST);
+    if (session->owner != NULL && pin_epoch < oldest) {
+      oldest = pin_epoch;
+    }
+  }
+  return oldest;
+}
+
+static bool frame_is_pinned(Frame *frame, uint64_t oldest_pin_epoch) {
+  return __atomic_load_n(&frame->pin_epoch, __ATOMIC_SEQ_CST) >=
+         oldest_pin_epoch;
+}
+
+/* Stamp a frame as handed out in the current epoch; stamps never go back */
+static void frame_pin(Pager *pager, Frame *frame) {
+  uint64_t epoch = __atomic_load_n(&pager->pin_epoch, __ATOMIC_SEQ_CST);
+  uint64_t stamp = __atomic_load_n(&frame->pin_epoch, __ATOMIC_RELAXED);
+  while (stamp < epoch &&
+         !__atomic_compare_exchange_n(&frame->pin_epoch, &stamp, epoch, true,
+                                      __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+  }
+  // Only written when it changes, to keep the frame's line shared
+  if (!__atomic_load_n(&frame->referenced, __ATOMIC_RELAXED)) {
+    __atomic_store_n(&frame->referenced, true, __ATOMIC_RELAXED);
+  }
+}
+
+static void pager_write_pages(Pager *pager, uint32_t *page_nums, void **pages,
+                              uint32_t count);
+
+/*
+ * Move a frame's version on by amount before its page is changed, for
+ * readers that take neither the table lock nor a pin
+ */
+static void frame_bump_version(Frame *frame, uint32_t amount) {
+  __atomic_add_fetch(&frame->version, amount, __ATOMIC_SEQ_CST);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/*
+ * Write back (if needed) and forget the page held in a frame, leaving the
+ * frame free for reuse. A frame that turns out to be pinned is left alone,
+ * and false returned. Readers pin frames without the latch, so the page is
+ * withdrawn from the frame before the pin is checked: a reader either sees
+ * it withdrawn and takes the latch, or has its pin seen here.
+ */
+static bool pager_evict_frame(Pager *pager, uint32_t frame_num,
+                              uint64_t oldest_pin_epoch) {
+  Frame *frame = &pager->frames[frame_num];
+  uint32_t page_num = frame->page_num;
+  if (page_num == INVALID_PAGE_NUM) {
+    return true;
+  }
+
+  __atomic_store_n(&frame->page_num, INVALID_PAGE_NUM, __ATOMIC_SEQ_CST);
+  if (frame_is_pinned(frame, oldest_pin_epoch)) {
+    __atomic_store_n(&frame->page_num, page_num, __ATOMIC_SEQ_CST);
+    return false;
+  }
+  // Keeps the version odd if the page is being written
+  frame_bump_version(frame, 2);
+
+  if (frame->dirty) {
+    if (pager->wal) {
+      // Never write around the log: the newest image stays findable there
+      wal_append_frame(pager->wal, page_num, frame->data, 0);
+    } else {
+      pager_write_pages(pager, &page_num, &frame->data, 1);
+    }
+    frame->dirty = false;
+  }
+  pager_set_page_frame(pager, page_num, INVALID_FRAME_NUM);
+  __atomic_store_n(&frame->referenced, false, __ATOMIC_RELAXED);
+  return true;
+}
+
+static void pager_arena_free(Pager *pager, void *page) {
+  if (pager->num_free_pages == pager->free_pages_capacity) {
+    pager->free_pages_capacity = pager->free_pages_capacity
+                                     ? pager->free_pages_capacity * 2
+                                     : PAGER_ARENA_MIN_SLAB_FRAMES;
+    pager->free_pages = realloc(pager->free_pages,
+                                pager->free_pages_capacity * sizeof(void *));
+  }
+  pager->free_pages[pager->num_free_pages++] = page;
+}
+
+/*
+ * Map a slab big enough for the rest of the buffer pool (and at least
+ * PAGER_ARENA_MIN_SLAB_FRAMES pages) and put its pages on the free list.
+ * Large slabs are offered to the kernel for transparent huge pages, which
+ * cuts the TLB misses of a scan across the pool.
+ */
+static void pager_arena_grow(Pager *pager) {
+  uint32_t num_pages = pager->max_frames > pager->num_frames
+                           ? pager->max_frames - pager->num_frames
+                           : 0;
+  if (num_pages < PAGER_ARENA_MIN_SLAB_FRAMES) {
+    num_pages = PAGER_ARENA_MIN_SLAB_FRAMES;
+  }
+
+  size_t length = (size_t)num_pages * pager->page_size;
+  void *data = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (data == MAP_FAILED) {
+    printf("Error allocating page frames: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+#ifdef MADV_HUGEPAGE
+  madvise(data, length, MADV_HUGEPAGE);
+#endif
+
+  pager->arena_slabs =
+      realloc(pager->arena_slabs,
+              (pager->num_arena_slabs + 1) * sizeof(ArenaSlab));
+  pager->arena_slabs[pager->num_arena_slabs].data = data;
+  pager->arena_slabs[pager->num_arena_slabs].length = length;
+  pager->num_arena_slabs++;
+
+  // Hand out the slab from its start, so that neighbouring frames are
+  // neighbours in memory too
+  for (uint32_t i = num_pages; i > 0; i--) {
+    pager_arena_free(pager, data + (size_t)(i - 1) * pager->page_size);
+  }
+}
+
+static void *pager_arena_alloc(Pager *pager) {
+  if (pager->num_free_pages == 0) {
+    pager_arena_grow(pager);
+  }
+  return pager->free_pages[--pager->num_free_pages];
+}
+
+/* Unmap every slab at once; no page buffer may be used afterwards */
+static void pager_arena_release(Pager *pager) {
+  for (uint32_t i = 0; i < pager->num_arena_slabs; i++) {
+    munmap(pager->arena_slabs[i].data, pager->arena_slabs[i].length);
+  }
+  free(pager->arena_slabs);
+  free(pager->free_pages);
+  pager->arena_slabs = NULL;
+  pager->num_arena_slabs = 0;
+  pager->free_pages = NULL;
+  pager->num_free_pages = 0;
+  pager->free_pages_capacity = 0;
+}
+
+static uint32_t pager_add_frame(Pager *pager) {
+  // Past max_frames only when statements pin more pages than the pool
+  // holds; the pool overshoots until the next pager_unpin_all().
+  if (pager->num_frames == PAGER_MAX_FRAMES) {
+    printf("Error: more than %d pages are in use at once.\n",
+           PAGER_MAX_FRAMES);
+    exit(EXIT_FAILURE);
+  }
+
+  uint32_t frame_num = pager->num_frames;
+  Frame *frame = &pager->frames[frame_num];
+  __atomic_store_n(&frame->data, pager_arena_alloc(pager), __ATOMIC_RELAXED);
+  // A reader holding an out-of-date page table may still look at the frame
+  __atomic_store_n(&frame->page_num, INVALID_PAGE_NUM, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&frame->pin_epoch, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&frame->referenced, false, __ATOMIC_RELAXED);
+  frame->dirty = false;
+  __atomic_store_n(&pager->num_frames, frame_num + 1, __ATOMIC_RELEASE);
+
+  return frame_num;
+}
+
+/*
+ * Find a frame to load a page into. Free capacity is used first; after that
+ * the CLOCK hand sweeps the pool, giving every referenced frame a second
+ * chance and skipping frames pinned by the current statement.
+ */
+static uint32_t pager_allocate_frame(Pager *pager) {
+  if (pager->num_frames < pager->max_frames) {
+    return pager_add_frame(pager);
+  }
+
+  // Two full sweeps: the first may only clear reference bits
+  uint64_t oldest_pin_epoch = pager_oldest_pin_epoch(pager);
+  for (uint32_t i = 0; i < 2 * pager->num_frames; i++) {
+    uint32_t frame_num = pager->clock_hand;
+    pager->clock_hand = (pager->clock_hand + 1) % pager->num_frames;
+
+    Frame *frame = &pager->frames[frame_num];
+    if (frame_is_pinned(frame, oldest_pin_epoch)) {
+      continue;
+    }
+    if (__atomic_exchange_n(&frame->referenced, false, __ATOMIC_RELAXED)) {
+      continue;
+    }
+
+    if (pager_evict_frame(pager, frame_num, oldest_pin_epoch)) {
+      return frame_num;
+    }
+  }
+
+  // Every frame is pinned
+  return pager_add_frame(pager);
+}
+
+/*
+ * Return a pointer to page_num inside the read-only mapping, or NULL if the
+ * page has to come through the buffer pool: because it lies past the end of
+ * the mapped file, or because its newest image is in the WAL.
+ */
+static void *pager_mapped_page(Pager *pager, uint32_t page_num) {
+  off_t offset = (off_t)page_num * pager->page_size;
+  if (offset + pager->page_size > pager->file_length ||
+      (size_t)offset + pager->page_size > pager->map_length) {
+    return NULL;
+  }
+  if (pager->wal && wal_find_frame(pager->wal, page_num) != INVALID_FRAME_NUM) {
+    return NULL;
+  }
+  if (page_is_compressed(pager->map + offset)) {
+    return NULL;
+  }
+
+  pager->pages_mapped++;
+  return pager->map + offset;
+}
+
+/*
+ * Give up on a page read from the file that came back short or fails its
+ * checksum, rather than build on it. A compressed page is expanded in place.
+ */
+static void pager_check_page(Pager *pager, uint32_t page_num, void *page,
+                             ssize_t bytes_read) {
+  if (bytes_read != (ssize_t)pager->page_size) {
+    printf("Error: short read of page %d: %zd bytes.\n", page_num, bytes_read);
+    exit(EXIT_FAILURE);
+  }
+  if (!page_checksum_matches(page, pager->page_size)) {
+    printf("Error: page %d is corrupt (checksum mismatch).\n", page_num);
+    exit(EXIT_FAILURE);
+  }
+  if (page_is_compressed(page) && !page_decompress(page, pager->page_size)) {
+    printf("Error: page %d is corrupt (bad compressed data).\n", page_num);
+    exit(EXIT_FAILURE);
+  }
+}
+
 void *get_page(Pager *pager, uint32_t page_num) {
-  if (page_num > TABLE_MAX_PAGES) {
-    printf("Tried to fetch page number out of bounds. %d > %d\n", page_num,
-           TABLE_MAX_PAGES);
+  if (page_num == INVALID_PAGE_NUM) {
+    printf("Tried to fetch invalid page number.\n");
     exit(EXIT_FAILURE);
   }
 
-  if (pager->pages[page_num] == NULL) {
-    // Cache miss. Allocate memory and load from file.
-    void *page = malloc(PAGE_SIZE);
-    uint32_t num_pages = pager->file_length / PAGE_SIZE;
+  // A cached page is pinned and returned without the latch
+  if (pager_current_session(pager) != NULL) {
+    uint32_t frame_num = pager_cached_frame(pager, page_num);
+    if (frame_num != INVALID_FRAME_NUM) {
+      Frame *frame = &pager->frames[frame_num];
+      frame_pin(pager, frame);
+      if (__atomic_load_n(&frame->page_num, __ATOMIC_SEQ_CST) == page_num) {
+        return frame->data;
+      }
+    }
+  }
+
+  pthread_mutex_lock(&pager->latch);
+  PagerSession *session = pager_session(pager);
+  uint32_t frame_num = pager_lookup_frame(pager, page_num);
+
+  if (frame_num == INVALID_FRAME_NUM && session->map_reads) {
+    void *page = pager_mapped_page(pager, page_num);
+    if (page) {
+      pthread_mutex_unlock(&pager->latch);
+      return page;
+    }
+  }
+
+  if (frame_num == INVALID_FRAME_NUM) {
+    // Cache miss. Claim a frame and load from file.
+    frame_num = pager_allocate_frame(pager);
+    void *page = pager->frames[frame_num].data;
+    uint32_t num_pages = pager->file_length / pager->page_size;
 
     // We might save a partial page at the end of the file
-    if (pager->file_length % PAGE_SIZE) {
+    if (pager->file_length % pager->page_size) {
       num_pages += 1;
     }
 
-    if (page_num <= num_pages) {
-      lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
-      ssize_t bytes_read = read(pager->file_descriptor, page, PAGE_SIZE);
+    uint32_t wal_frame_num =
+        pager->wal ? wal_find_frame(pager->wal, page_num) : INVALID_FRAME_NUM;
+
+    ssize_t bytes_read = 0;
+    if (wal_frame_num != INVALID_FRAME_NUM) {
+      // Log frames carry checksums of their own
+      wal_read_frame(pager->wal, wal_frame_num, page);
+      bytes_read = pager->page_size;
+      pager->pages_read++;
+    } else if (page_num < num_pages) {
+      pager->pages_read++;
+      bytes_read = io_read(&pager->io, page, pager->page_size,
+                           (off_t)page_num * pager->page_size);
       if (bytes_read == -1) {
         printf("Error reading file: %d\n", errno);
         exit(EXIT_FAILURE);
       }
+      pager_check_page(pager, page_num, page, bytes_read);
     }
+    memset(page + bytes_read, 0, pager->page_size - bytes_read);
 
-    pager->pages[page_num] = page;
+    // Published only once loaded, for readers that take no latch
+    pager_reserve_page_table(pager, page_num);
+    __atomic_store_n(&pager->frames[frame_num].page_num, page_num,
+                     __ATOMIC_SEQ_CST);
+    pager_set_page_frame(pager, page_num, frame_num);
 
     if (page_num >= pager->num_pages) {
       pager->num_pages = page_num + 1;
     }
   }
 
-  return pager->pages[page_num];
+  Frame *frame = &pager->frames[frame_num];
+  frame_pin(pager, frame);
+  void *data = frame->data;
+
+  pthread_mutex_unlock(&pager->latch);
+  return data;
+}
+
+/*
+ * Record that a page is about to be modified. Only dirty pages are ever
+ * written back, and readers without the table lock have to be kept off a
+ * page while it changes, so every code path that writes into a page must
+ * call this before its first write. The page stays off limits to those
+ * readers until pager_end_writes().
+ */
+void pager_mark_dirty(Pager *pager, uint32_t page_num) {
+  uint32_t frame_num = pager_lookup_frame(pager, page_num);
+  if (frame_num == INVALID_FRAME_NUM) {
+    printf("Tried to mark uncached page %d dirty\n", page_num);
+    exit(EXIT_FAILURE);
+  }
+
+  Frame *frame = &pager->frames[frame_num];
+  frame->dirty = true;
+  if (__atomic_load_n(&frame->version, __ATOMIC_RELAXED) % 2 == 1) {
+    return;
+  }
+  frame_bump_version(frame, 1);
+
+  if (pager->num_written_frames == pager->written_frames_capacity) {
+    pager->written_frames_capacity = pager->written_frames_capacity
+                                         ? pager->written_frames_capacity * 2
+                                         : PAGER_DEFAULT_MAX_FRAMES;
+    pager->written_frames =
+        realloc(pager->written_frames,
+                pager->written_frames_capacity * sizeof(uint32_t));
+  }
+  pager->written_frames[pager->num_written_frames++] = frame_num;
+}
+
+/*
+ * Let readers without the table lock back onto the pages marked dirty since
+ * the last call. Called at the end of every statement, by pager_commit().
+ */
+void pager_end_writes(Pager *pager) {
+  for (uint32_t i = 0; i < pager->num_written_frames; i++) {
+    Frame *frame = &pager->frames[pager->written_frames[i]];
+    if (__atomic_load_n(&frame->version, __ATOMIC_RELAXED) % 2 == 1) {
+      __atomic_add_fetch(&frame->version, 1, __ATOMIC_RELEASE);
+    }
+  }
+  pager->num_written_frames = 0;
+}
+
+/**
+ * Start reading a cached page without the table lock and without pinning
+ * it. Nothing read from the page may be trusted, or even used to index
+ * into it unchecked, until pager_validate_read() has confirmed that the page
+ * did not change in the meantime.
+ *
+ * @param pager the pager
+ * @param page_num the page to read
+ * @param read filled in with the page and the version it is read at
+ *
+ * @return false if the page is not cached, and has to be read under the
+ * table lock instead
+ */
+bool pager_read_optimistic(Pager *pager, uint32_t page_num, PageRead *read) {
+  uint32_t frame_num = pager_cached_frame(pager, page_num);
+  if (frame_num == INVALID_FRAME_NUM) {
+    return false;
+  }
+
+  Frame *frame = &pager->frames[frame_num];
+  read->version = __atomic_load_n(&frame->version, __ATOMIC_ACQUIRE);
+  if (__atomic_load_n(&frame->page_num, __ATOMIC_ACQUIRE) != page_num) {
+    return false;
+  }
+  read->frame = frame;
+  read->page = __atomic_load_n(&frame->data, __ATOMIC_RELAXED);
+
+  // Only written when it changes, to keep the frame's line shared
+  if (!__atomic_load_n(&frame->referenced, __ATOMIC_RELAXED)) {
+    __atomic_store_n(&frame->referenced, true, __ATOMIC_RELAXED);
+  }
+  return true;
+}
+
+/*
+ * Whether a page read with pager_read_optimistic() was not being written
+ * and stayed as it was
+ */
+bool pager_validate_read(PageRead *read) {
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return read->version % 2 == 0 &&
+         __atomic_load_n(&read->frame->version, __ATOMIC_RELAXED) ==
+             read->version;
+}
+
+/*
+ * Hand back to the file system the blocks past the compressed bytes of each
+ * page just written compressed, stored_sizes[i] of page i (0 if it was not).
+ * Where the file system cannot, the pages stay compressed, taking their
+ * whole slots, and compression is turned off.
+ */
+static void pager_punch_holes(Pager *pager, uint32_t *page_nums,
+                              uint32_t *stored_sizes, uint32_t count) {
+  for (uint32_t i = 0; i < count && pager->compression; i++) {
+    if (stored_sizes[i] == 0) {
+      continue;
+    }
+    uint32_t used = (stored_sizes[i] + PAGE_COMPRESSION_BLOCK_SIZE - 1) /
+                    PAGE_COMPRESSION_BLOCK_SIZE * PAGE_COMPRESSION_BLOCK_SIZE;
+    if (!io_punch_hole(&pager->io,
+                       (off_t)page_nums[i] * pager->page_size + used,
+                       pager->page_size - used)) {
+      pager->compression = false;
+    }
+  }
+}
+
+/*
+ * Write count pages, given in increasing page number order, to the file,
+ * setting each one's checksum first; with compression on, pages other than
+ * the header that compress well enough are written compressed instead. Each
+ * run of adjacent pages becomes one vectored write, and all of the runs are
+ * handed to the I/O backend as a single batch.
+ */
+static void pager_write_pages(Pager *pager, uint32_t *page_nums, void **pages,
+                              uint32_t count) {
+  struct iovec *iov = malloc(count * sizeof(struct iovec));
+  IoRequest *requests = malloc(count * sizeof(IoRequest));
+  uint32_t num_requests = 0;
+
+  // Page aligned, as the file may be open for direct I/O
+  bool compression = pager->compression;
+  size_t stored_length = compression ? (size_t)count * pager->page_size : 0;
+  uint8_t *stored = NULL;
+  uint32_t *stored_sizes = NULL;
+  if (compression) {
+    stored = mmap(NULL, stored_length, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (stored == MAP_FAILED) {
+      printf("Error allocating compression buffer: %d\n", errno);
+      exit(EXIT_FAILURE);
+    }
+    stored_sizes = calloc(count, sizeof(uint32_t));
+  }
+
+  for (uint32_t i = 0; i < count; i++) {
+    void *page = pages[i];
+    if (compression && page_nums[i] != DB_HEADER_PAGE_NUM) {
+      void *stored_page = stored + (size_t)i * pager->page_size;
+      stored_sizes[i] = page_compress(page, stored_page, pager->page_size);
+      if (stored_sizes[i] > 0) {
+        page = stored_page;
+        pager->pages_compressed++;
+      }
+    }
+    page_set_checksum(page, pager->page_size);
+    iov[i].iov_base = page;
+    iov[i].iov_len = pager->page_size;
+  }
+
+  uint32_t run_start = 0;
+  while (run_start < count) {
+    uint32_t run_length = 1;
+    while (run_start + run_length < count &&
+           run_length < PAGER_MAX_WRITE_RUN &&
+           page_nums[run_start + run_length] ==
+               page_nums[run_start] + run_length) {
+      run_length++;
+    }
+
+    IoRequest *request = &requests[num_requests++];
+    request->write = true;
+    request->iov = iov + run_start;
+    request->iov_count = run_length;
+    request->offset = (off_t)page_nums[run_start] * pager->page_size;
+    run_start += run_length;
+  }
+
+  io_submit(&pager->io, requests, num_requests);
+
+  for (uint32_t i = 0; i < num_requests; i++) {
+    IoRequest *request = &requests[i];
+    if (request->result < 0) {
+      printf("Error writing: %d\n", (int)-request->result);
+      exit(EXIT_FAILURE);
+    }
+    if ((size_t)request->result !=
+        (size_t)request->iov_count * pager->page_size) {
+      printf("Short write: %zd bytes\n", request->result);
+      exit(EXIT_FAILURE);
+    }
+
+    // Evicted pages past the old end of file must be read back from disk
+    if (request->offset + request->result > pager->file_length) {
+      pager->file_length = request->offset + request->result;
+    }
+  }
+  pager->pages_written += count;
+
+  if (compression) {
+    pager_punch_holes(pager, page_nums, stored_sizes, count);
+    munmap(stored, stored_length);
+    free(stored_sizes);
+  }
+  free(iov);
+  free(requests);
+}
+
+/*
+ * Write back the pages held in the given frames, which must be sorted by
+ * page number, and mark them clean.
+ */
+static void pager_write_frames(Pager *pager, uint32_t *frame_nums,
+                               uint32_t count) {
+  uint32_t *page_nums = malloc(count * sizeof(uint32_t));
+  void **pages = malloc(count * sizeof(void *));
+  for (uint32_t i = 0; i < count; i++) {
+    page_nums[i] = pager->frames[frame_nums[i]].page_num;
+    pages[i] = pager->frames[frame_nums[i]].data;
+  }
+
+  pager_write_pages(pager, page_nums, pages, count);
+
+  for (uint32_t i = 0; i < count; i++) {
+    pager->frames[frame_nums[i]].dirty = false;
+  }
+  free(page_nums);
+  free(pages);
 }
 
 void pager_flush(Pager *pager, uint32_t page_num) {
-  if (pager->pages[page_num] == NULL) {
+  uint32_t frame_num = pager_lookup_frame(pager, page_num);
+  if (frame_num == INVALID_FRAME_NUM) {
     printf("Tried to flush null page\n");
     exit(EXIT_FAILURE);
   }
 
-  off_t offset = lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
+  pager_write_frames(pager, &frame_num, 1);
+}
+
+static int compare_uint64(const void *a, const void *b) {
+  uint64_t value_a = *(const uint64_t *)a;
+  uint64_t value_b = *(const uint64_t *)b;
+  return (value_a > value_b) - (value_a < value_b);
+}
+
+/*
+ * Collect the frames holding dirty pages, sorted by page number. The caller
+ * frees the returned array.
+ */
+static uint32_t *pager_collect_dirty(Pager *pager, uint32_t *num_dirty) {
+  // Sorted as page number and frame number pairs, for want of a qsort()
+  // context argument
+  uint64_t *pairs = malloc(pager->num_frames * sizeof(uint64_t));
+  *num_dirty = 0;
+
+  for (uint32_t i = 0; i < pager->num_frames; i++) {
+    Frame *frame = &pager->frames[i];
+    if (frame->page_num != INVALID_PAGE_NUM && frame->dirty) {
+      pairs[(*num_dirty)++] = (uint64_t)frame->page_num << 32 | i;
+    }
+  }
+  qsort(pairs, *num_dirty, sizeof(uint64_t), compare_uint64);
+
+  uint32_t *dirty = malloc(pager->num_frames * sizeof(uint32_t));
+  for (uint32_t i = 0; i < *num_dirty; i++) {
+    dirty[i] = (uint32_t)pairs[i];
+  }
+  free(pairs);
+  return dirty;
+}
+
+/*
+ * Write back every dirty page in the buffer pool. Dirty pages are sorted by
+ * page number so that runs of adjacent pages go out as one write, and the
+ * runs as one batch; clean pages are skipped.
+ */
+void pager_flush_dirty(Pager *pager) {
+  uint32_t num_dirty;
+  uint32_t *dirty = pager_collect_dirty(pager, &num_dirty);
+
+  for (uint32_t i = 0; i < pager->num_frames; i++) {
+    if (pager->frames[i].page_num != INVALID_PAGE_NUM &&
+        !pager->frames[i].dirty) {
+      pager->pages_skipped++;
+    }
+  }
+
+  if (num_dirty > 0) {
+    pager_write_frames(pager, dirty, num_dirty);
+  }
 
-  if (offset == -1) {
-    printf("Error seeking: %d\n", errno);
+  free(dirty);
+}
+
+/**
+ * Write back up to max_pages dirty pages, in page order from page_num on,
+ * for the background flusher. The caller holds the table lock shared, so no
+ * page is being changed, and the latch is held throughout, so that no page
+ * is evicted (and written back) meanwhile.
+ *
+ * @param pager the pager
+ * @param page_num the page to start from
+ * @param max_pages the most pages to write
+ *
+ * @return the page to carry on from next time, 0 once past the last dirty
+ * page
+ */
+uint32_t pager_flush_some(Pager *pager, uint32_t page_num,
+                          uint32_t max_pages) {
+  pthread_mutex_lock(&pager->latch);
+  uint32_t num_dirty;
+  uint32_t *dirty = pager_collect_dirty(pager, &num_dirty);
+
+  uint32_t first = 0;
+  while (first < num_dirty && pager->frames[dirty[first]].page_num < page_num) {
+    first++;
+  }
+  uint32_t count = num_dirty - first;
+  if (count > max_pages) {
+    count = max_pages;
+  }
+
+  uint32_t next_page_num = 0;
+  if (first + count < num_dirty) {
+    next_page_num = pager->frames[dirty[first + count]].page_num;
+  }
+  if (count > 0) {
+    pager_write_frames(pager, dirty + first, count);
+    pager->pages_flushed += count;
+  }
+  pthread_mutex_unlock(&pager->latch);
+
+  free(dirty);
+  return next_page_num;
+}
+
+/*
+ * End a statement. Readers without the table lock are let back onto the
+ * pages it wrote. With the WAL enabled, every page the statement dirtied is
+ * appended to the log, the last one as a commit frame, and the log is synced
+ * according to the group commit policy. Without it, dirty pages simply stay
+ * in the buffer pool until they are evicted or the database is closed.
+ * Inside a transaction nothing is logged until pager_commit_transaction().
+ */
+void pager_commit(Pager *pager) {
+  pager_end_writes(pager);
+
+  Wal *wal = pager->wal;
+  if (wal == NULL || pager->in_transaction) {
+    return;
+  }
+
+  uint32_t num_dirty;
+  uint32_t *dirty = pager_collect_dirty(pager, &num_dirty);
+  if (num_dirty == 0 && wal->num_frames == wal->committed_frames) {
+    free(dirty);
+    return;
+  }
+
+  for (uint32_t i = 0; i < num_dirty; i++) {
+    Frame *frame = &pager->frames[dirty[i]];
+    uint32_t commit_num_pages = (i == num_dirty - 1) ? pager->num_pages : 0;
+    wal_append_frame(wal, frame->page_num, frame->data, commit_num_pages);
+    frame->dirty = false;
+  }
+  free(dirty);
+
+  if (num_dirty == 0) {
+    // Every page written was evicted to the log before the commit; recovery
+    // drops those frames unless a commit frame follows them
+    void *header = get_page(pager, DB_HEADER_PAGE_NUM);
+    wal_append_frame(wal, DB_HEADER_PAGE_NUM, header, pager->num_pages);
+  }
+
+  wal_commit(wal);
+
+  if (wal->num_frames >= wal->auto_checkpoint) {
+    pager_checkpoint(pager);
+  }
+}
+
+/*
+ * Begin a transaction: the statements up to pager_commit_transaction() are
+ * logged as one commit. Pages evicted in between are logged as uncommitted
+ * frames, which recovery ignores, so a crash leaves none of the transaction
+ * behind.
+ */
+void pager_begin_transaction(Pager *pager) { pager->in_transaction = true; }
+
+/*
+ * Commit the statements since pager_begin_transaction() with a single commit
+ * frame and a single sync of the log, whatever the group commit policy.
+ */
+void pager_commit_transaction(Pager *pager) {
+  pager->in_transaction = false;
+  pager_commit(pager);
+  if (pager->wal != NULL) {
+    wal_sync(pager->wal);
+  }
+}
+
+/*
+ * Copy the newest logged image of every page into the database file and
+ * start a new log. The log is synced first, so a crash part way through just
+ * replays the same frames again on the next open. Without the WAL this is a
+ * plain flush of the dirty pages. Inside a transaction the log holds frames
+ * that are not committed yet, so the checkpoint waits for the commit. The
+ * caller keeps statements that write out, with the table lock; selects may
+ * go on meanwhile, as the latch is only held while pages are written to the
+ * file and while the log is reset.
+ */
+void pager_checkpoint(Pager *pager) {
+  Wal *wal = pager->wal;
+  if (pager->in_transaction) {
+    return;
+  }
+  if (wal == NULL) {
+    pager_flush_dirty(pager);
+    return;
+  }
+  if (wal->num_frames == 0) {
+    return;
+  }
+
+  wal_sync(wal);
+
+  // Page aligned, as the file may be open for direct I/O
+  uint8_t *buffer = mmap(NULL, PAGER_CHECKPOINT_BATCH * pager->page_size,
+                         PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                         -1, 0);
+  if (buffer == MAP_FAILED) {
+    printf("Error allocating checkpoint buffer: %d\n", errno);
     exit(EXIT_FAILURE);
   }
+  uint32_t page_nums[PAGER_CHECKPOINT_BATCH];
+  void *pages[PAGER_CHECKPOINT_BATCH];
+  uint32_t num_pages = 0;
 
-  ssize_t bytes_written =
-      write(pager->file_descriptor, pager->pages[page_num], PAGE_SIZE);
+  for (uint32_t page_num = 0; page_num < wal->page_frames_capacity;
+       page_num++) {
+    uint32_t wal_frame_num = wal->page_frames[page_num];
+    if (wal_frame_num == INVALID_FRAME_NUM) {
+      continue;
+    }
+
+    pages[num_pages] = buffer + num_pages * pager->page_size;
+    page_nums[num_pages] = page_num;
+    wal_read_frame(wal, wal_frame_num, pages[num_pages]);
+    if (++num_pages == PAGER_CHECKPOINT_BATCH) {
+      pthread_mutex_lock(&pager->latch);
+      pager_write_pages(pager, page_nums, pages, num_pages);
+      pthread_mutex_unlock(&pager->latch);
+      num_pages = 0;
+    }
+  }
+  if (num_pages > 0) {
+    pthread_mutex_lock(&pager->latch);
+    pager_write_pages(pager, page_nums, pages, num_pages);
+    pthread_mutex_unlock(&pager->latch);
+  }
+  munmap(buffer, PAGER_CHECKPOINT_BATCH * pager->page_size);
 
-  if (bytes_written == -1) {
-    printf("Error writing: %d\n", errno);
+  if (fdatasync(pager->file_descriptor) == -1) {
+    printf("Error syncing db file: %d\n", errno);
     exit(EXIT_FAILURE);
   }
+
+  // Readers that miss look pages up in the log under the latch
+  pthread_mutex_lock(&pager->latch);
+  wal_reset(wal);
+  pthread_mutex_unlock(&pager->latch);
+  pager->checkpoints++;
 }
 
-void db_close(Table *table) {
-  Pager *pager = table->pager;
+/*
+ * Shrink the database to its first num_pages pages. Cached copies of the
+ * pages cut off are dropped without being written, everything else is
+ * committed and checkpointed into the file before it is truncated.
+ */
+void pager_truncate(Pager *pager, uint32_t num_pages) {
+  for (uint32_t i = 0; i < pager->num_frames; i++) {
+    Frame *frame = &pager->frames[i];
+    if (frame->page_num != INVALID_PAGE_NUM && frame->page_num >= num_pages) {
+      pager_set_page_frame(pager, frame->page_num, INVALID_FRAME_NUM);
+      __atomic_store_n(&frame->page_num, INVALID_PAGE_NUM, __ATOMIC_SEQ_CST);
+      frame_bump_version(frame, 2);
+      frame->referenced = false;
+      frame->dirty = false;
+    }
+  }
+  pager->num_pages = num_pages;
 
-  for (uint32_t i = 0; i < pager->num_pages; i++) {
-    if (pager->pages[i] == NULL) {
+  pager_commit(pager);
+  pager_checkpoint(pager);
+
+  off_t file_length = (off_t)num_pages * pager->page_size;
+  if (ftruncate(pager->file_descriptor, file_length) == -1) {
+    printf("Error truncating db file: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+  pager->file_length = file_length;
+}
+
+/*
+ * Turn the write-ahead log on or off. Turning it off checkpoints everything
+ * into the database file and removes the log.
+ */
+void pager_set_wal_enabled(Pager *pager, bool enabled) {
+  if (enabled && pager->wal == NULL) {
+    pager->wal = wal_open(pager->filename, pager->page_size);
+  } else if (!enabled && pager->wal != NULL) {
+    pager_commit(pager);
+    pager_checkpoint(pager);
+    wal_close(pager->wal, true);
+    pager->wal = NULL;
+  }
+}
+
+/*
+ * Give back frames the pool overshot by while everything was pinned, as far
+ * as they are no longer pinned. Called with the latch held.
+ */
+static void pager_trim_frames(Pager *pager) {
+  uint64_t oldest_pin_epoch = pager_oldest_pin_epoch(pager);
+  while (pager->num_frames > pager->max_frames &&
+         pager_evict_frame(pager, pager->num_frames - 1, oldest_pin_epoch)) {
+    uint32_t frame_num = pager->num_frames - 1;
+    pager_arena_free(pager, pager->frames[frame_num].data);
+    __atomic_store_n(&pager->num_frames, frame_num, __ATOMIC_RELAXED);
+  }
+  if (pager->clock_hand >= pager->num_frames) {
+    pager->clock_hand = 0;
+  }
+}
+
+/*
+ * Release every page handed out to the calling thread so far. Page pointers
+ * it obtained before this call must not be used afterwards, as their frames
+ * may be reused.
+ */
+void pager_unpin_all(Pager *pager) {
+  // Only a pool that overshot needs the latch, to give frames back
+  PagerSession *session = pager_current_session(pager);
+  if (session != NULL &&
+      __atomic_load_n(&pager->num_frames, __ATOMIC_RELAXED) <=
+          pager->max_frames) {
+    uint64_t epoch = __atomic_add_fetch(&pager->pin_epoch, 1, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&session->pin_epoch, epoch, __ATOMIC_RELEASE);
+    return;
+  }
+
+  pthread_mutex_lock(&pager->latch);
+  session = pager_session(pager);
+  uint64_t epoch = __atomic_add_fetch(&pager->pin_epoch, 1, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&session->pin_epoch, epoch, __ATOMIC_RELEASE);
+  pager_trim_frames(pager);
+  pthread_mutex_unlock(&pager->latch);
+}
+
+/*
+ * Release the calling thread's pages, as pager_unpin_all() does, and stop
+ * counting the thread as a user of the pager until its next page request,
+ * so that an idle thread pins nothing.
+ */
+void pager_end_session(Pager *pager) {
+  pthread_mutex_lock(&pager->latch);
+  PagerSession *session = pager_current_session(pager);
+  if (session != NULL) {
+    session->map_reads = false;
+    __atomic_store_n(&session->owner, NULL, __ATOMIC_RELAXED);
+  }
+  pager_trim_frames(pager);
+  pthread_mutex_unlock(&pager->latch);
+}
+
+/*
+ * Map the whole database file, rounded up to the next PAGER_MMAP_EXTENT so
+ * that the file can grow a while before it has to be remapped. Only called
+ * between statements, as unmapping invalidates any page pointer into the old
+ * mapping.
+ */
+static void pager_remap(Pager *pager) {
+  if (pager->file_length <= pager->map_length) {
+    return;
+  }
+
+  if (pager->map) {
+    munmap(pager->map, pager->map_length);
+    pager->map = NULL;
+    pager->map_length = 0;
+  }
+
+  size_t length = ((size_t)pager->file_length + PAGER_MMAP_EXTENT - 1) /
+                  PAGER_MMAP_EXTENT * PAGER_MMAP_EXTENT;
+  void *map =
+      mmap(NULL, length, PROT_READ, MAP_SHARED, pager->file_descriptor, 0);
+  if (map == MAP_FAILED) {
+    // Not fatal: reads keep going through the buffer pool
+    return;
+  }
+
+  pager->map = map;
+  pager->map_length = length;
+}
+
+void pager_set_mmap_enabled(Pager *pager, bool enabled) {
+  pager->mmap_enabled = enabled;
+  if (!enabled && pager->map) {
+    munmap(pager->map, pager->map_length);
+    pager->map = NULL;
+    pager->map_length = 0;
+  }
+}
+
+/*
+ * Bracket a statement, or part of one, that only reads pages. In between,
+ * pages that are not cached may be returned to the calling thread from the
+ * mapping; such pages must not be written to or marked dirty. The mapping
+ * is only replaced while no other thread is using the pager, since other
+ * readers may hold pointers into it.
+ */
+void pager_begin_read(Pager *pager) {
+  if (!pager->mmap_enabled) {
+    return;
+  }
+
+  pthread_mutex_lock(&pager->latch);
+  PagerSession *session = pager_session(pager);
+  bool alone = true;
+  for (uint32_t i = 0; i < pager->num_sessions; i++) {
+    if (pager->sessions[i].owner != NULL && &pager->sessions[i] != session) {
+      alone = false;
+    }
+  }
+  if (alone || pager->map == NULL) {
+    pager_remap(pager);
+  }
+  session->map_reads = (pager->map != NULL);
+  pthread_mutex_unlock(&pager->latch);
+}
+
+void pager_end_read(Pager *pager) {
+  // Only the calling thread looks at its own map_reads
+  PagerSession *session = pager_current_session(pager);
+  if (session != NULL) {
+    session->map_reads = false;
+  }
+}
+
+/*
+ * Claim frames for count pages starting at first_page_num and describe a
+ * single vectored read into them. The frames are pinned until the read has
+ * been carried out and the statement ends.
+ */
+static void pager_queue_read(Pager *pager, uint32_t first_page_num,
+                             uint32_t count, IoRequest *request,
+                             struct iovec *iov) {
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t frame_num = pager_allocate_frame(pager);
+    Frame *frame = &pager->frames[frame_num];
+    // The frame only takes on the page once the read is done, see
+    // pager_publish_read()
+    pager_reserve_page_table(pager, first_page_num + i);
+    pager_set_page_frame(pager, first_page_num + i, frame_num);
+    frame_pin(pager, frame);
+    iov[i].iov_base = frame->data;
+    iov[i].iov_len = pager->page_size;
+  }
+
+  request->write = false;
+  request->iov = iov;
+  request->iov_count = count;
+  request->offset = (off_t)first_page_num * pager->page_size;
+}
+
+/* Hand the pages of a carried out read to readers that take no latch */
+static void pager_publish_read(Pager *pager, IoRequest *request) {
+  uint32_t first_page_num = request->offset / pager->page_size;
+  for (uint32_t i = 0; i < request->iov_count; i++) {
+    pager_check_page(pager, first_page_num + i, request->iov[i].iov_base,
+                     pager->page_size);
+    uint32_t frame_num = pager_lookup_frame(pager, first_page_num + i);
+    __atomic_store_n(&pager->frames[frame_num].page_num, first_page_num + i,
+                     __ATOMIC_SEQ_CST);
+  }
+}
+
+/*
+ * Ask the kernel to start reading count pages from page_num in the
+ * background, so that the synchronous read on the later cache miss (or the
+ * fault on the mapping) finds them in the page cache. Pages that are already
+ * cached, logged in the WAL or past the end of the file are not hinted.
+ *
+ * A file opened with O_DIRECT bypasses the page cache, so there the pages
+ * are read into the buffer pool right away instead, every run of them with
+ * one vectored read and all of the runs as one batch. Called with the latch
+ * held.
+ */
+static void pager_prefetch_pages(Pager *pager, uint32_t page_num,
+                                 uint32_t count) {
+  uint32_t file_pages = pager->file_length / pager->page_size;
+  uint32_t run_start = page_num;
+
+  bool map_reads = pager_session(pager)->map_reads;
+  bool load = pager->io.direct && !map_reads;
+  IoRequest *requests = NULL;
+  struct iovec *iov = NULL;
+  uint32_t num_requests = 0;
+  uint32_t num_loaded = 0;
+  if (load) {
+    // Leave most of the pool to the pages the statement is using
+    if (count > pager->max_frames / 2) {
+      count = pager->max_frames / 2;
+    }
+    requests = malloc(count * sizeof(IoRequest));
+    iov = malloc(count * sizeof(struct iovec));
+  }
+
+  for (uint32_t i = page_num; i <= page_num + count; i++) {
+    bool wanted = i < page_num + count && i < file_pages &&
+                  pager_lookup_frame(pager, i) == INVALID_FRAME_NUM &&
+                  (pager->wal == NULL ||
+                   wal_find_frame(pager->wal, i) == INVALID_FRAME_NUM);
+    if (wanted) {
       continue;
     }
-    pager_flush(pager, i);
-    free(pager->pages[i]);
-    pager->pages[i] = NULL;
+
+    // Hint each run of wanted pages with a single call
+    if (i > run_start) {
+      off_t offset = (off_t)run_start * pager->page_size;
+      off_t length = (off_t)(i - run_start) * pager->page_size;
+      if (map_reads) {
+        madvise(pager->map + offset, length, MADV_WILLNEED);
+      } else if (load) {
+        pager_queue_read(pager, run_start, i - run_start,
+                         &requests[num_requests++], iov + num_loaded);
+        num_loaded += i - run_start;
+      } else {
+        posix_fadvise(pager->file_descriptor, offset, length,
+                      POSIX_FADV_WILLNEED);
+      }
+      pager->pages_prefetched += i - run_start;
+    }
+    run_start = i + 1;
+  }
+
+  if (num_requests > 0) {
+    io_submit(&pager->io, requests, num_requests);
+    for (uint32_t i = 0; i < num_requests; i++) {
+      if ((size_t)requests[i].result !=
+          (size_t)requests[i].iov_count * pager->page_size) {
+        printf("Error reading file: %d\n", (int)-requests[i].result);
+        exit(EXIT_FAILURE);
+      }
+      pager_publish_read(pager, &requests[i]);
+    }
+  }
+  free(requests);
+  free(iov);
+}
+
+void pager_prefetch(Pager *pager, uint32_t page_num, uint32_t count) {
+  pthread_mutex_lock(&pager->latch);
+  pager_prefetch_pages(pager, page_num, count);
+  pthread_mutex_unlock(&pager->latch);
+}
+
+/*
+ * Called by cursors each time they step onto a leaf through a sibling
+ * pointer. The next leaf is always hinted; once two consecutive leaves are
+ * also physically adjacent in the file, the scan is treated as sequential
+ * and a window of prefetch_depth pages is hinted ahead of it. Each thread's
+ * scan is followed in its own session, so scans side by side do not break
+ * up one another's runs.
+ */
+void pager_readahead(Pager *pager, uint32_t page_num, uint32_t next_page_num) {
+  pthread_mutex_lock(&pager->latch);
+  PagerSession *session = pager_session(pager);
+  bool sequential = (page_num == session->readahead_last_page_num + 1);
+  session->readahead_last_page_num = page_num;
+
+  if (pager->prefetch_depth == 0 || next_page_num == 0) {
+    pthread_mutex_unlock(&pager->latch);
+    return;
+  }
+
+  if (sequential && next_page_num == page_num + 1) {
+    // Slide the window only once the scan has used most of it
+    if (next_page_num + pager->prefetch_depth / 2 >=
+        session->readahead_end_page_num) {
+      uint32_t start = next_page_num > session->readahead_end_page_num
+                           ? next_page_num
+                           : session->readahead_end_page_num;
+      uint32_t end = next_page_num + pager->prefetch_depth;
+      if (end > pager->num_pages) {
+        end = pager->num_pages;
+      }
+      if (start < end) {
+        pager_prefetch_pages(pager, start, end - start);
+      }
+      session->readahead_end_page_num = end;
+    }
+  } else {
+    pager_prefetch_pages(pager, next_page_num, 1);
+  }
+  pthread_mutex_unlock(&pager->latch);
+}
+
+/*
+ * Resize the buffer pool. Shrinking takes effect immediately for unpinned
+ * frames and otherwise at the next pager_unpin_all().
+ */
+void pager_set_max_frames(Pager *pager, uint32_t max_frames) {
+  if (max_frames == 0) {
+    max_frames = 1;
+  }
+
+  if (max_frames > PAGER_MAX_FRAMES) {
+    max_frames = PAGER_MAX_FRAMES;
+  }
+
+  pthread_mutex_lock(&pager->latch);
+  pager->max_frames = max_frames;
+  pager_trim_frames(pager);
+  pthread_mutex_unlock(&pager->latch);
+}
+
+/*
+ * Switch the I/O backend, and turn direct I/O on or off. Falls back to the
+ * POSIX backend and buffered I/O where those are not available.
+ */
+void pager_set_io(Pager *pager, IoBackendType type, bool direct) {
+  io_close(&pager->io);
+  io_open(&pager->io, pager->file_descriptor, type, direct);
+}
+
+void db_close(Table *table) {
+  Pager *pager = table->pager;
+  flusher_stop(table);
+
+  // A transaction still open at exit is committed
+  pager->in_transaction = false;
+  if (pager->wal) {
+    pager_commit(pager);
+    pager_checkpoint(pager);
+    wal_close(pager->wal, true);
+  } else {
+    pager_flush_dirty(pager);
   }
+  pager_arena_release(pager);
+  pager_set_mmap_enabled(pager, false);
+  io_close(&pager->io);
 
   int result = close(pager->file_descriptor);
   if (result == -1) {
     printf("Error closing db file.\n");
     exit(EXIT_FAILURE);
   }
-  for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
-    void *page = pager->pages[i];
-    if (page) {
-      free(page);
-      pager->pages[i] = NULL;
-    }
+
+  pthread_mutex_destroy(&pager->latch);
+  pthread_rwlock_destroy(&table->lock);
+  munmap(pager->frames, PAGER_MAX_FRAMES * sizeof(Frame));
+  for (uint32_t i = 0; i < pager->num_retired_page_tables; i++) {
+    free(pager->retired_page_tables[i]);
   }
+  free(pager->retired_page_tables);
+  free(pager->written_frames);
+  free(pager->page_table);
+  free(pager->filename);
   free(pager);
   free(table);
-}
\ No newline at end of file
+}
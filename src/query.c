@@ -0,0 +1,402 @@
+#include "db.h"
+
+/*
+ * Running statements a row at a time.
+ *
+ * This is the interface for embedding the database: a caller opens a table
+ * with db_open(), prepares a statement into a Query, binds its parameters
+ * and calls query_step() until it is done, reading each result row with the
+ * query_column_ functions in between. The REPL is just such a caller.
+ *
+ * A select does no more work per step than it takes to find the next row,
+ * and the row is read straight from its page: text columns point into the
+ * page and are not NUL-terminated. Those pages stay in place until the next
+ * call to query_step(), for this query or any other, so a row must be read
+ * (or copied) before the next step. Statements that change the table run
+ * to completion in their first step.
+ *
+ * Queries may run on many threads at once. A select holds its table's lock
+ * shared from its first step until it is done, reset or finalized, and any
+ * other statement holds it exclusively while it runs, so selects run side
+ * by side but never alongside a change to the table. A thread must finish
+ * (or reset) its select before it runs another statement on the table.
+ *
+ * Selects that only look keys up, where id = ... or id in (...), first try
+ * each key without the lock, with table_lookup(), and copy its row out of
+ * the page. Only a lookup that runs into a write, or needs a page that is
+ * not cached, takes the lock, which the select then keeps.
+ *
+ * A caller that already holds the lock, shared, may run selects under it
+ * with query_init_locked(), on as many threads as it likes; scan.c runs the
+ * partitions of a parallel scan so.
+ */
+
+/*
+ * Count the keys in [key_low, key_high]. Leaves that lie wholly within the
+ * range are counted from their header, and only the leaf holding key_high
+ * has its slots searched; no row is read.
+ */
+static uint32_t count_range(Table *table, uint32_t key_low,
+                            uint32_t key_high) {
+  Cursor cursor;
+  table_seek(table, key_low, &cursor);
+
+  uint32_t count = 0;
+  while (!cursor.end_of_table) {
+    void *node = get_page(table->pager, cursor.page_num);
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    if (*(uint32_t *)leaf_node_key(node, num_cells - 1) > key_high) {
+      uint32_t end = key_search(leaf_node_key(node, 0), num_cells, key_high);
+      if (*(uint32_t *)leaf_node_key(node, end) == key_high) {
+        end++;
+      }
+      if (end > cursor.cell_num) {
+        count += end - cursor.cell_num;
+      }
+      break;
+    }
+
+    count += num_cells - cursor.cell_num;
+    pager_unpin_all(table->pager);
+    // Step past the leaf's last cell, on to the next leaf
+    cursor.cell_num = num_cells - 1;
+    cursor_advance(&cursor);
+  }
+
+  return count;
+}
+
+/*
+ * Move a select ... in on to the next of its keys that the table holds.
+ * Consecutive keys often live in the same leaf, so the tree is only
+ * descended again once a key is past the last one in the cursor's leaf.
+ */
+static bool select_next_key(Query *query) {
+  Statement *statement = query->statement;
+  Table *table = query->table;
+  Cursor *cursor = &query->cursor;
+
+  while (query->next_key < statement->num_keys) {
+    uint32_t key = statement->keys[query->next_key];
+
+    // The cursor is only of use once a key has been found under the lock
+    bool in_leaf = false;
+    if (query->next_key > query->locked_key) {
+      void *node = get_page(table->pager, cursor->page_num);
+      uint32_t num_cells = *leaf_node_num_cells(node);
+      in_leaf = num_cells > 0 &&
+                key <= *(uint32_t *)leaf_node_key(node, num_cells - 1);
+    }
+    if (in_leaf) {
+      leaf_node_find(table, cursor->page_num, key, cursor);
+    } else {
+      table_find(table, key, cursor);
+    }
+    query->next_key++;
+
+    void *node = get_page(table->pager, cursor->page_num);
+    if (cursor->cell_num < *leaf_node_num_cells(node) &&
+        *(uint32_t *)leaf_node_key(node, cursor->cell_num) == key) {
+      query->key = key;
+      return true;
+    }
+    pager_unpin_all(table->pager);
+  }
+  return false;
+}
+
+/*
+ * Move a select on to its next row, setting the query's key, or to its row
+ * count; false once done
+ */
+static bool select_next(Query *query) {
+  Statement *statement = query->statement;
+  Cursor *cursor = &query->cursor;
+
+  if (statement->count) {
+    if (query->started) {
+      return false;
+    }
+    query->started = true;
+    query->count = 0;
+    if (statement->keys != NULL) {
+      while (select_next_key(query)) {
+        query->count++;
+      }
+    } else {
+      query->count =
+          count_range(query->table, statement->key_low, statement->key_high);
+    }
+    return true;
+  }
+
+  if (statement->keys != NULL) {
+    query->started = true;
+    return select_next_key(query);
+  }
+
+  if (!query->started) {
+    query->started = true;
+    table_seek(query->table, statement->key_low, cursor);
+  } else {
+    cursor_advance(cursor);
+  }
+  if (cursor->end_of_table) {
+    return false;
+  }
+  query->key = cursor_key(cursor);
+  return query->key <= statement->key_high;
+}
+
+/*
+ * The keys a select looks up, when it does nothing but look keys up, or
+ * NULL
+ */
+static uint32_t *select_lookup_keys(Statement *statement, uint32_t *num_keys) {
+  if (statement->count) {
+    return NULL;
+  }
+  if (statement->keys != NULL) {
+    *num_keys = statement->num_keys;
+    return statement->keys;
+  }
+  if (statement->key_low == statement->key_high) {
+    *num_keys = 1;
+    return &statement->key_low;
+  }
+  return NULL;
+}
+
+/*
+ * Move a select that only looks keys up on to its next row without the
+ * table lock, see table_lookup(). Sets found, or returns false, leaving the
+ * key to be looked up again, if the lock is needed after all.
+ */
+static bool select_lookup_next(Query *query, bool *found) {
+  uint32_t num_keys;
+  uint32_t *keys = select_lookup_keys(query->statement, &num_keys);
+
+  *found = false;
+  while (!*found && query->next_key < num_keys) {
+    uint32_t key = keys[query->next_key];
+    uint32_t row_size;
+    switch (table_lookup(query->table, key, query->row, &row_size)) {
+    case (LOOKUP_FOUND):
+      query->key = key;
+      query->value = query->row;
+      *found = true;
+      break;
+    case (LOOKUP_NOT_FOUND):
+      break;
+    case (LOOKUP_CONFLICT):
+    case (LOOKUP_NOT_CACHED):
+      return false;
+    }
+    query->next_key++;
+  }
+  return true;
+}
+
+/**
+ * Start a query on a statement the caller owns and keeps alive, and frees,
+ * itself. Such a query needs no finalizing.
+ *
+ * @param query the query to start
+ * @param table the table to run the statement on
+ * @param statement the prepared statement
+ */
+void query_init(Query *query, Table *table, Statement *statement) {
+  query->table = table;
+  query->statement = statement;
+  query->locked = false;
+  query->lock_held = false;
+  query_reset(query);
+}
+
+/**
+ * Start a select on a statement the caller owns, to run under the table's
+ * lock, which the caller holds shared until the query is done. Each thread
+ * running such queries ends its pager session itself, when done with them.
+ *
+ * @param query the query to start
+ * @param table the table to run the statement on
+ * @param statement the prepared select
+ */
+void query_init_locked(Query *query, Table *table, Statement *statement) {
+  query_init(query, table, statement);
+  query->lock_held = true;
+}
+
+/* Let go of the table once a select is done with it */
+static void query_unlock(Query *query) {
+  if (query->locked) {
+    query->locked = false;
+    pager_end_session(query->table->pager);
+    pthread_rwlock_unlock(&query->table->lock);
+  }
+}
+
+/**
+ * Prepare a statement into a new query.
+ *
+ * @param table the table to run the statement on
+ * @param text the statement, which is not kept
+ * @param query set to the query, which must be released with
+ * query_finalize(), or to NULL when the statement could not be prepared
+ *
+ * @return PREPARE_SUCCESS, or why the statement could not be parsed
+ */
+PrepareResult query_prepare(Table *table, const char *text, Query **query) {
+  Query *new_query = malloc(sizeof(Query));
+  PrepareResult result = prepare_statement(text, &new_query->prepared);
+  if (result != PREPARE_SUCCESS) {
+    statement_free(&new_query->prepared);
+    free(new_query);
+    *query = NULL;
+    return result;
+  }
+
+  query_init(new_query, table, &new_query->prepared);
+  *query = new_query;
+  return PREPARE_SUCCESS;
+}
+
+/* Binding a parameter starts the query over, see statement_bind_text() */
+PrepareResult query_bind_text(Query *query, uint32_t index, const char *text,
+                              uint32_t length) {
+  query_reset(query);
+  return statement_bind_text(query->statement, index, text, length);
+}
+
+/* Binding a parameter starts the query over, see statement_bind_int() */
+PrepareResult query_bind_int(Query *query, uint32_t index, int value) {
+  query_reset(query);
+  return statement_bind_int(query->statement, index, value);
+}
+
+/**
+ * Run a query up to its next result row.
+ *
+ * @param query the query
+ *
+ * @return STEP_ROW with a row to read, then STEP_DONE once the statement has
+ * run to completion, or STEP_ERROR if it failed
+ */
+StepResult query_step(Query *query) {
+  if (query->done) {
+    return query->result == EXECUTE_SUCCESS ? STEP_DONE : STEP_ERROR;
+  }
+
+  Statement *statement = query->statement;
+  Table *table = query->table;
+  Pager *pager = table->pager;
+  if (statement->type != STATEMENT_SELECT) {
+    query->done = true;
+    pthread_rwlock_wrlock(&table->lock);
+    query->result = execute_statement(statement, table);
+    pager_end_session(pager);
+    pthread_rwlock_unlock(&table->lock);
+    return query->result == EXECUTE_SUCCESS ? STEP_DONE : STEP_ERROR;
+  }
+
+  if (!query->locked && !query->lock_held) {
+    bool found;
+    uint32_t num_keys;
+    if (select_lookup_keys(statement, &num_keys) != NULL &&
+        select_lookup_next(query, &found)) {
+      query->done = !found;
+      return found ? STEP_ROW : STEP_DONE;
+    }
+
+    pthread_rwlock_rdlock(&table->lock);
+    query->locked = true;
+    query->locked_key = query->next_key;
+  }
+  // The pages of the previous row may be evicted again
+  pager_unpin_all(pager);
+  pager_begin_read(pager);
+  bool row = select_next(query);
+  if (row && !statement->count) {
+    query->value = cursor_value(&query->cursor);
+  }
+  pager_end_read(pager);
+
+  if (!row) {
+    query->done = true;
+    query_unlock(query);
+    return STEP_DONE;
+  }
+  return STEP_ROW;
+}
+
+/* Why a query failed, or EXECUTE_SUCCESS */
+ExecuteResult query_result(Query *query) { return query->result; }
+
+/* The number of columns in each result row */
+uint32_t query_column_count(Query *query) {
+  return query->statement->count ? 1 : query->statement->num_columns;
+}
+
+ColumnType query_column_type(Query *query, uint32_t column) {
+  Statement *statement = query->statement;
+  return statement->count || statement->columns[column] == COLUMN_ID
+             ? COLUMN_TYPE_INTEGER
+             : COLUMN_TYPE_TEXT;
+}
+
+/**
+ * Read an integer column, the id or a row count, of the current result row.
+ *
+ * @param query the query, having just stepped to a row
+ * @param column the column, counting from 0
+ */
+uint32_t query_column_int(Query *query, uint32_t column) {
+  Statement *statement = query->statement;
+  if (statement->count) {
+    return query->count;
+  }
+  return statement->columns[column] == COLUMN_ID ? query->key : 0;
+}
+
+/**
+ * Read a text column of the current result row.
+ *
+ * @param query the query, having just stepped to a row
+ * @param column the column, counting from 0
+ * @param length set to the length of the text
+ *
+ * @return the text, which is not NUL-terminated and only valid until the
+ * next step, or NULL if the column is not text
+ */
+const char *query_column_text(Query *query, uint32_t column,
+                              uint32_t *length) {
+  Statement *statement = query->statement;
+  if (statement->count || statement->columns[column] == COLUMN_ID) {
+    *length = 0;
+    return NULL;
+  }
+
+  uint8_t text_length;
+  const char *text =
+      row_string_column(query->value, statement->columns[column], &text_length);
+  *length = text_length;
+  return text;
+}
+
+/* Start a query over, to run it again, usually with new parameters */
+void query_reset(Query *query) {
+  query_unlock(query);
+  query->result = EXECUTE_SUCCESS;
+  query->started = false;
+  query->done = false;
+  query->next_key = 0;
+  query->locked_key = 0;
+  query->count = 0;
+}
+
+/* Release a query made by query_prepare(), along with its statement */
+void query_finalize(Query *query) {
+  query_unlock(query);
+  statement_free(&query->prepared);
+  free(query);
+}
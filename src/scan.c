@@ -0,0 +1,279 @@
+#include "db.h"
+
+/*
+ * Parallel scans.
+ *
+ * A select over a range of keys is cut into partitions at the separator
+ * keys of the top levels of the tree, each a range of about as many leaves.
+ * Worker threads take the partitions in key order and scan each with a query
+ * of its own, formatting its rows into a buffer of the partition's. The
+ * calling thread writes the buffers out as they complete: in key order, or
+ * in whatever order they complete when the rows need not be in key order.
+ *
+ * The caller holds the table's lock shared for the whole scan, and the
+ * workers run their queries under it (see query_init_locked()), so a scan
+ * sees the table as of one moment, just as a select on one thread does. The
+ * workers must not take the lock themselves: a writer waiting for it would
+ * hold them off while the caller waits for them.
+ */
+
+typedef struct {
+  Statement statement; // The select, narrowed to the partition's keys
+  char *output;        // The formatted rows, once done
+  size_t output_length;
+  bool done;
+  bool written;
+} ScanPartition;
+
+typedef struct {
+  Table *table;
+  ScanRowFunction row_function;
+  bool ordered;
+  ScanPartition *partitions;
+  uint32_t num_partitions;
+  uint32_t next_partition; // The next one for a worker to take
+  uint32_t num_written;
+  uint32_t window; // Of an ordered scan, partitions let run ahead of output
+  pthread_mutex_t mutex;
+  pthread_cond_t changed; // Signalled as partitions are done or written
+} Scan;
+
+/**
+ * Whether the REPL runs a statement as a parallel scan: a select of rows
+ * over a range of keys, with more than one thread to scan with.
+ *
+ * @param table the table to run the statement on
+ * @param statement the prepared statement
+ */
+bool scan_is_parallel(Table *table, Statement *statement) {
+  return table->scan_threads > 1 && statement->type == STATEMENT_SELECT &&
+         !statement->count && statement->keys == NULL &&
+         statement->key_low < statement->key_high;
+}
+
+/*
+ * Choose the keys to split [key_low, key_high] at into at most
+ * max_partitions ranges. The tree is cut into subtrees a level at a time,
+ * the root's children first, keeping those that overlap the range, until
+ * there are enough of them or they are leaves; the keys are then picked
+ * evenly from the largest key each subtree may hold. Returns the number of
+ * keys, in increasing order.
+ */
+static uint32_t scan_split_keys(Table *table, uint32_t key_low,
+                                uint32_t key_high, uint32_t max_partitions,
+                                uint32_t *split_keys) {
+  Pager *pager = table->pager;
+
+  // The subtrees, with the smallest and largest keys each may hold
+  uint32_t num_subtrees = 1;
+  uint32_t *page_nums = malloc(sizeof(uint32_t));
+  uint32_t *low_keys = malloc(sizeof(uint32_t));
+  uint32_t *high_keys = malloc(sizeof(uint32_t));
+  page_nums[0] = table->root_page_num;
+  low_keys[0] = 0;
+  high_keys[0] = UINT32_MAX;
+
+  while (num_subtrees < max_partitions &&
+         get_node_type(get_page(pager, page_nums[0])) == NODE_INTERNAL) {
+    uint32_t num_children = 0;
+    for (uint32_t i = 0; i < num_subtrees; i++) {
+      void *node = get_page(pager, page_nums[i]);
+      num_children += *internal_node_num_keys(node) + 1;
+    }
+    uint32_t *child_page_nums = malloc(num_children * sizeof(uint32_t));
+    uint32_t *child_low_keys = malloc(num_children * sizeof(uint32_t));
+    uint32_t *child_high_keys = malloc(num_children * sizeof(uint32_t));
+
+    num_children = 0;
+    for (uint32_t i = 0; i < num_subtrees; i++) {
+      void *node = get_page(pager, page_nums[i]);
+      uint32_t num_keys = *internal_node_num_keys(node);
+      for (uint32_t j = 0; j <= num_keys; j++) {
+        uint32_t high =
+            j < num_keys ? *internal_node_key(node, j) : high_keys[i];
+        // Child j holds the keys past those of child j - 1
+        bool overlaps =
+            high >= key_low &&
+            (j == 0 ? low_keys[i] <= key_high
+                    : *internal_node_key(node, j - 1) < key_high);
+        if (overlaps) {
+          child_page_nums[num_children] = *internal_node_child(node, j);
+          child_low_keys[num_children] =
+              j == 0 ? low_keys[i] : *internal_node_key(node, j - 1) + 1;
+          child_high_keys[num_children] = high;
+          num_children++;
+        }
+      }
+      pager_unpin_all(pager);
+    }
+
+    free(page_nums);
+    free(low_keys);
+    free(high_keys);
+    page_nums = child_page_nums;
+    low_keys = child_low_keys;
+    high_keys = child_high_keys;
+    num_subtrees = num_children;
+  }
+
+  // Subtrees overlapping the range adjoin, so all but the last end inside it
+  uint32_t num_partitions =
+      num_subtrees < max_partitions ? num_subtrees : max_partitions;
+  for (uint32_t i = 1; i < num_partitions; i++) {
+    split_keys[i - 1] = high_keys[i * num_subtrees / num_partitions - 1];
+  }
+
+  free(page_nums);
+  free(low_keys);
+  free(high_keys);
+  return num_partitions - 1;
+}
+
+/* Scan one partition into its buffer */
+static void scan_partition(Scan *scan, ScanPartition *partition) {
+  FILE *file = open_memstream(&partition->output, &partition->output_length);
+  if (file == NULL) {
+    printf("Error: could not buffer the rows of a scan.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  Writer writer;
+  writer_init(&writer, file);
+  Query query;
+  query_init_locked(&query, scan->table, &partition->statement);
+  while (query_step(&query) == STEP_ROW) {
+    scan->row_function(&query, &writer);
+  }
+  writer_flush(&writer);
+  fclose(file);
+}
+
+static void *scan_worker(void *argument) {
+  Scan *scan = argument;
+
+  pthread_mutex_lock(&scan->mutex);
+  while (scan->next_partition < scan->num_partitions) {
+    uint32_t num = scan->next_partition;
+    if (scan->ordered && num >= scan->num_written + scan->window) {
+      pthread_cond_wait(&scan->changed, &scan->mutex);
+      continue;
+    }
+    scan->next_partition++;
+    pthread_mutex_unlock(&scan->mutex);
+
+    scan_partition(scan, &scan->partitions[num]);
+
+    pthread_mutex_lock(&scan->mutex);
+    scan->partitions[num].done = true;
+    pthread_cond_broadcast(&scan->changed);
+  }
+  pthread_mutex_unlock(&scan->mutex);
+
+  pager_end_session(scan->table->pager);
+  return NULL;
+}
+
+/* The next partition to write out, or NULL if it is not done yet */
+static ScanPartition *scan_next_output(Scan *scan) {
+  if (scan->ordered) {
+    ScanPartition *partition = &scan->partitions[scan->num_written];
+    return partition->done ? partition : NULL;
+  }
+  for (uint32_t i = 0; i < scan->num_partitions; i++) {
+    ScanPartition *partition = &scan->partitions[i];
+    if (partition->done && !partition->written) {
+      return partition;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Run a select over a range of keys on table->scan_threads threads, see
+ * scan_is_parallel(), writing each row formatted by row_function to file.
+ * Rows are in key order if table->scan_ordered is set.
+ *
+ * @param table the table to scan
+ * @param statement the select
+ * @param file where the rows go
+ * @param row_function formats a row; it is called on the worker threads
+ */
+void scan_parallel(Table *table, Statement *statement, FILE *file,
+                   ScanRowFunction row_function) {
+  pthread_rwlock_rdlock(&table->lock);
+
+  uint32_t num_threads = table->scan_threads;
+  uint32_t max_partitions = num_threads * SCAN_PARTITIONS_PER_THREAD;
+  uint32_t *split_keys = malloc(max_partitions * sizeof(uint32_t));
+  uint32_t num_partitions =
+      1 + scan_split_keys(table, statement->key_low, statement->key_high,
+                          max_partitions, split_keys);
+  pager_end_session(table->pager);
+
+  Scan scan;
+  scan.table = table;
+  scan.row_function = row_function;
+  scan.ordered = table->scan_ordered;
+  scan.partitions = malloc(num_partitions * sizeof(ScanPartition));
+  scan.num_partitions = num_partitions;
+  scan.next_partition = 0;
+  scan.num_written = 0;
+  scan.window = num_threads * SCAN_PARTITIONS_AHEAD;
+  pthread_mutex_init(&scan.mutex, NULL);
+  pthread_cond_init(&scan.changed, NULL);
+  for (uint32_t i = 0; i < num_partitions; i++) {
+    ScanPartition *partition = &scan.partitions[i];
+    partition->statement = *statement;
+    if (i > 0) {
+      partition->statement.key_low = split_keys[i - 1] + 1;
+    }
+    if (i < num_partitions - 1) {
+      partition->statement.key_high = split_keys[i];
+    }
+    partition->output = NULL;
+    partition->output_length = 0;
+    partition->done = false;
+    partition->written = false;
+  }
+  free(split_keys);
+
+  if (num_threads > num_partitions) {
+    num_threads = num_partitions;
+  }
+  pthread_t *threads = malloc(num_threads * sizeof(pthread_t));
+  for (uint32_t i = 0; i < num_threads; i++) {
+    if (pthread_create(&threads[i], NULL, scan_worker, &scan) != 0) {
+      printf("Error: could not start a scan thread.\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  pthread_mutex_lock(&scan.mutex);
+  while (scan.num_written < num_partitions) {
+    ScanPartition *partition = scan_next_output(&scan);
+    if (partition == NULL) {
+      pthread_cond_wait(&scan.changed, &scan.mutex);
+      continue;
+    }
+    partition->written = true;
+    pthread_mutex_unlock(&scan.mutex);
+
+    fwrite(partition->output, 1, partition->output_length, file);
+    free(partition->output);
+
+    pthread_mutex_lock(&scan.mutex);
+    scan.num_written++;
+    pthread_cond_broadcast(&scan.changed);
+  }
+  pthread_mutex_unlock(&scan.mutex);
+
+  for (uint32_t i = 0; i < num_threads; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  free(threads);
+  pthread_cond_destroy(&scan.changed);
+  pthread_mutex_destroy(&scan.mutex);
+  free(scan.partitions);
+
+  pthread_rwlock_unlock(&table->lock);
+}
@@ -0,0 +1,160 @@
+#include "db.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TINYSQL_HAVE_AVX2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define TINYSQL_HAVE_NEON
+#endif
+
+/*
+ * Key search kernels.
+ *
+ * Keys are not stored back to back in either kind of node, but always every
+ * KEY_SEARCH_STRIDE bytes: in a leaf each key leads its slot, and in an
+ * internal node each key follows its child pointer. A kernel is given the
+ * address of the first key and returns the number of keys smaller than the
+ * one searched for, which is the index of the key if it is present and the
+ * index it would be inserted at otherwise.
+ *
+ * The vector kernels binary search until a few vectors' worth of keys are
+ * left and then compare those all at once, four keys per AVX2 or NEON
+ * vector. Every other lane of a vector holds the rest of a slot or a child
+ * pointer, and is masked out. Which kernel runs is decided once, from what
+ * the CPU supports. The NEON kernel needs AArch64 for its horizontal add.
+ */
+
+static const uint32_t KEY_SEARCH_STRIDE = LEAF_NODE_SLOT_SIZE;
+
+/* Below this many keys, the vector kernels stop bisecting */
+#define KEY_SEARCH_LINEAR_KEYS 32
+
+static uint32_t strided_key(const uint8_t *keys, uint32_t index) {
+  return *(const uint32_t *)(keys + index * KEY_SEARCH_STRIDE);
+}
+
+/* Narrow [*low, *high) down to the keys that might equal or exceed key */
+static void key_search_bisect(const uint8_t *keys, uint32_t *low,
+                              uint32_t *high, uint32_t key,
+                              uint32_t min_keys) {
+  while (*high - *low > min_keys) {
+    uint32_t index = (*low + *high) / 2;
+    if (strided_key(keys, index) >= key) {
+      *high = index;
+    } else {
+      *low = index + 1;
+    }
+  }
+}
+
+static uint32_t key_search_scalar(const uint8_t *keys, uint32_t num_keys,
+                                  uint32_t key) {
+  uint32_t low = 0;
+  uint32_t high = num_keys;
+  key_search_bisect(keys, &low, &high, key, 0);
+  return low;
+}
+
+#ifdef TINYSQL_HAVE_AVX2
+__attribute__((target("avx2"))) static uint32_t
+key_search_avx2(const uint8_t *keys, uint32_t num_keys, uint32_t key) {
+  uint32_t low = 0;
+  uint32_t high = num_keys;
+  key_search_bisect(keys, &low, &high, key, KEY_SEARCH_LINEAR_KEYS);
+
+  // AVX2 only compares signed integers, so flip the sign bits first
+  const __m256i sign = _mm256_set1_epi32(INT32_MIN);
+  const __m256i target = _mm256_xor_si256(_mm256_set1_epi32(key), sign);
+  uint32_t count = 0;
+  uint32_t i = low;
+  // Each load reaches half way into the slot after the fourth key, so it
+  // must not be the last one
+  for (; i + 4 < high; i += 4) {
+    __m256i block = _mm256_loadu_si256(
+        (const __m256i *)(keys + i * KEY_SEARCH_STRIDE));
+    __m256i smaller = _mm256_cmpgt_epi32(target, _mm256_xor_si256(block, sign));
+    uint32_t mask = _mm256_movemask_ps(_mm256_castsi256_ps(smaller));
+    count += __builtin_popcount(mask & 0x55);
+  }
+  for (; i < high && strided_key(keys, i) < key; i++) {
+    count++;
+  }
+  return low + count;
+}
+#endif
+
+#ifdef TINYSQL_HAVE_NEON
+static uint32_t key_search_neon(const uint8_t *keys, uint32_t num_keys,
+                                uint32_t key) {
+  uint32_t low = 0;
+  uint32_t high = num_keys;
+  key_search_bisect(keys, &low, &high, key, KEY_SEARCH_LINEAR_KEYS);
+
+  const uint32x4_t target = vdupq_n_u32(key);
+  uint32_t count = 0;
+  uint32_t i = low;
+  // vld2q splits four slots into their keys and everything else
+  for (; i + 4 < high; i += 4) {
+    uint32x4x2_t block =
+        vld2q_u32((const uint32_t *)(keys + i * KEY_SEARCH_STRIDE));
+    uint32x4_t smaller = vcltq_u32(block.val[0], target);
+    count += vaddvq_u32(vshrq_n_u32(smaller, 31));
+  }
+  for (; i < high && strided_key(keys, i) < key; i++) {
+    count++;
+  }
+  return low + count;
+}
+#endif
+
+typedef uint32_t (*KeySearchKernel)(const uint8_t *keys, uint32_t num_keys,
+                                    uint32_t key);
+
+static pthread_once_t key_search_once = PTHREAD_ONCE_INIT;
+static KeySearchKernel key_search_kernel = NULL;
+static const char *key_search_kernel_name = NULL;
+
+static void key_search_init() {
+  // The layout constants are not constant expressions, so this cannot be a
+  // _Static_assert
+  if (INTERNAL_NODE_CELL_SIZE != KEY_SEARCH_STRIDE ||
+      LEAF_NODE_SLOT_SIZE != KEY_SEARCH_STRIDE) {
+    printf("Keys of internal and leaf nodes are not %d bytes apart.\n",
+           KEY_SEARCH_STRIDE);
+    exit(EXIT_FAILURE);
+  }
+
+  key_search_kernel = key_search_scalar;
+  key_search_kernel_name = "scalar";
+#ifdef TINYSQL_HAVE_AVX2
+  if (__builtin_cpu_supports("avx2")) {
+    key_search_kernel = key_search_avx2;
+    key_search_kernel_name = "avx2";
+  }
+#endif
+#ifdef TINYSQL_HAVE_NEON
+  key_search_kernel = key_search_neon;
+  key_search_kernel_name = "neon";
+#endif
+}
+
+/**
+ * Count the keys smaller than key in a sorted run of keys spaced
+ * KEY_SEARCH_STRIDE bytes apart.
+ *
+ * @param keys the address of the first key
+ * @param num_keys the number of keys in the run
+ * @param key the key to search for
+ *
+ * @return the index of the first key greater than or equal to key
+ */
+uint32_t key_search(const void *keys, uint32_t num_keys, uint32_t key) {
+  pthread_once(&key_search_once, key_search_init);
+  return key_search_kernel(keys, num_keys, key);
+}
+
+const char *key_search_name() {
+  pthread_once(&key_search_once, key_search_init);
+  return key_search_kernel_name;
+}
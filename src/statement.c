@@ -0,0 +1,622 @@
+#include "db.h"
+
+/*
+ * Parsing statements.
+ *
+ * Statements are parsed from a Tokenizer in a single pass and never modify
+ * their text. Wherever a statement takes a literal id or value, except in an
+ * in list, it may hold a "?" parameter instead. A parameter records the
+ * field it stands for, and statement_bind_int() and statement_bind_text()
+ * fill that field in, so a statement can be prepared once and executed
+ * again and again with new values bound straight into its row or key range.
+ */
+
+/*
+ * Parse an id made of digits. Ids are printed as signed integers, so they
+ * stop at INT32_MAX.
+ */
+static PrepareResult prepare_id(const char *text, uint32_t length,
+                                uint32_t *id) {
+  bool negative = length > 1 && *text == '-';
+  uint32_t start = negative ? 1 : 0;
+  if (length == start) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+
+  uint64_t value = 0;
+  for (uint32_t i = start; i < length; i++) {
+    if (text[i] < '0' || text[i] > '9') {
+      return PREPARE_SYNTAX_ERROR;
+    }
+    value = value * 10 + (text[i] - '0');
+    if (value > INT32_MAX) {
+      return PREPARE_SYNTAX_ERROR;
+    }
+  }
+  if (negative) {
+    return PREPARE_NEGATIVE_ID;
+  }
+
+  *id = value;
+  return PREPARE_SUCCESS;
+}
+
+static PrepareResult prepare_string(const char *text, uint32_t length,
+                                    char *destination, uint32_t max_length) {
+  if (length > max_length) {
+    return PREPARE_STRING_TOO_LONG;
+  }
+  memcpy(destination, text, length);
+  destination[length] = '\0';
+  return PREPARE_SUCCESS;
+}
+
+static void set_key(Statement *statement, ParameterTarget target,
+                    uint32_t id) {
+  switch (target) {
+  case (PARAMETER_ID):
+    statement->row_to_insert.id = id;
+    break;
+  case (PARAMETER_KEY):
+    statement->key_low = id;
+    statement->key_high = id;
+    break;
+  case (PARAMETER_KEY_LOW):
+    statement->key_low = id;
+    break;
+  case (PARAMETER_KEY_HIGH):
+    statement->key_high = id;
+    break;
+  case (PARAMETER_USERNAME):
+  case (PARAMETER_EMAIL):
+    break;
+  }
+}
+
+/* Validate the text of a value and store it in the field it belongs to */
+static PrepareResult bind_value(Statement *statement, ParameterTarget target,
+                                const char *text, uint32_t length) {
+  switch (target) {
+  case (PARAMETER_USERNAME):
+    return prepare_string(text, length, statement->row_to_insert.username,
+                          COLUMN_USERNAME_SIZE);
+  case (PARAMETER_EMAIL):
+    return prepare_string(text, length, statement->row_to_insert.email,
+                          COLUMN_EMAIL_SIZE);
+  default: {
+    uint32_t id;
+    PrepareResult result = prepare_id(text, length, &id);
+    if (result == PREPARE_SUCCESS) {
+      set_key(statement, target, id);
+    }
+    return result;
+  }
+  }
+}
+
+/* A literal, stored right away, or a parameter, bound before execution */
+static PrepareResult prepare_value(Statement *statement, Token *token,
+                                   ParameterTarget target) {
+  if (token->type == TOKEN_PARAMETER) {
+    // No statement takes more than STATEMENT_MAX_PARAMETERS
+    statement->parameters[statement->num_parameters++] = target;
+    return PREPARE_SUCCESS;
+  }
+  if (token->type != TOKEN_WORD && token->type != TOKEN_NUMBER &&
+      token->type != TOKEN_STRING) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  return bind_value(statement, target, token->start, token->length);
+}
+
+/*
+ * The "<id> <username> <email>" of an insert or update. Another value after
+ * them is a syntax error.
+ */
+static PrepareResult prepare_row_values(Tokenizer *tokenizer,
+                                        Statement *statement) {
+  Token id = tokenizer_next_value(tokenizer);
+  Token username = tokenizer_next_value(tokenizer);
+  Token email = tokenizer_next_value(tokenizer);
+  if (email.type == TOKEN_END ||
+      tokenizer_next_value(tokenizer).type != TOKEN_END) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+
+  PrepareResult result = prepare_value(statement, &id, PARAMETER_ID);
+  if (result == PREPARE_SUCCESS) {
+    result = prepare_value(statement, &username, PARAMETER_USERNAME);
+  }
+  if (result == PREPARE_SUCCESS) {
+    result = prepare_value(statement, &email, PARAMETER_EMAIL);
+  }
+  return result;
+}
+
+/*
+ * Validate the text of a row's columns and copy them into row. Used by
+ * .import.
+ */
+PrepareResult prepare_row(char *id_string, char *username, char *email,
+                          Row *row) {
+  if (id_string == NULL || username == NULL || email == NULL) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+
+  PrepareResult result = prepare_id(id_string, strlen(id_string), &row->id);
+  if (result == PREPARE_SUCCESS) {
+    result = prepare_string(username, strlen(username), row->username,
+                            COLUMN_USERNAME_SIZE);
+  }
+  if (result == PREPARE_SUCCESS) {
+    result = prepare_string(email, strlen(email), row->email,
+                            COLUMN_EMAIL_SIZE);
+  }
+  return result;
+}
+
+static int compare_rows(const void *a, const void *b) {
+  uint32_t id_a = ((const Row *)a)->id;
+  uint32_t id_b = ((const Row *)b)->id;
+  return (id_a > id_b) - (id_a < id_b);
+}
+
+/* One "(<id>, <username>, <email>)" of a multi-row insert */
+static PrepareResult prepare_row_tuple(Tokenizer *tokenizer, Row *row) {
+  if (tokenizer_next(tokenizer).type != TOKEN_LEFT_PAREN) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  Token fields[NUM_COLUMNS];
+  for (uint32_t i = 0; i < NUM_COLUMNS; i++) {
+    fields[i] = tokenizer_next(tokenizer);
+    TokenType separator = i + 1 < NUM_COLUMNS ? TOKEN_COMMA : TOKEN_RIGHT_PAREN;
+    if ((fields[i].type != TOKEN_WORD && fields[i].type != TOKEN_NUMBER &&
+         fields[i].type != TOKEN_STRING) ||
+        tokenizer_next(tokenizer).type != separator) {
+      return PREPARE_SYNTAX_ERROR;
+    }
+  }
+
+  PrepareResult result =
+      prepare_id(fields[0].start, fields[0].length, &row->id);
+  if (result == PREPARE_SUCCESS) {
+    result = prepare_string(fields[1].start, fields[1].length, row->username,
+                            COLUMN_USERNAME_SIZE);
+  }
+  if (result == PREPARE_SUCCESS) {
+    result = prepare_string(fields[2].start, fields[2].length, row->email,
+                            COLUMN_EMAIL_SIZE);
+  }
+  return result;
+}
+
+/*
+ * The rest of "insert into users values (<id>, <username>, <email>), ...",
+ * once the "into" has been read. Strings may be quoted, but parameters are
+ * only taken by the single row form. The rows are stored sorted by id, so
+ * that they can be inserted in one pass over the tree.
+ */
+static PrepareResult prepare_insert_rows(Tokenizer *tokenizer,
+                                         Statement *statement) {
+  Token table_name = tokenizer_next(tokenizer);
+  Token values = tokenizer_next(tokenizer);
+  if (!token_is(&table_name, TABLE_NAME) || !token_is(&values, "values")) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+
+  uint32_t capacity = 8;
+  statement->rows = malloc(capacity * sizeof(Row));
+  while (true) {
+    if (statement->num_rows == capacity) {
+      capacity *= 2;
+      statement->rows = realloc(statement->rows, capacity * sizeof(Row));
+    }
+    PrepareResult result =
+        prepare_row_tuple(tokenizer, &statement->rows[statement->num_rows++]);
+    if (result != PREPARE_SUCCESS) {
+      return result;
+    }
+
+    Token separator = tokenizer_next(tokenizer);
+    if (separator.type == TOKEN_END) {
+      break;
+    }
+    if (separator.type != TOKEN_COMMA) {
+      return PREPARE_SYNTAX_ERROR;
+    }
+  }
+
+  qsort(statement->rows, statement->num_rows, sizeof(Row), compare_rows);
+  return PREPARE_SUCCESS;
+}
+
+static int compare_keys(const void *a, const void *b) {
+  uint32_t key_a = *(const uint32_t *)a;
+  uint32_t key_b = *(const uint32_t *)b;
+  return (key_a > key_b) - (key_a < key_b);
+}
+
+/*
+ * The "(<id>, <id>, ...)" of "select where id in". The ids are stored sorted
+ * and without duplicates, so that they can be looked up in one pass over the
+ * tree.
+ */
+static PrepareResult prepare_select_in(Tokenizer *tokenizer,
+                                       Statement *statement) {
+  if (tokenizer_next(tokenizer).type != TOKEN_LEFT_PAREN) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+
+  uint32_t capacity = 8;
+  statement->keys = malloc(capacity * sizeof(uint32_t));
+  while (true) {
+    Token token = tokenizer_next(tokenizer);
+    if (token.type != TOKEN_NUMBER) {
+      return PREPARE_SYNTAX_ERROR;
+    }
+    uint32_t id;
+    PrepareResult result = prepare_id(token.start, token.length, &id);
+    if (result != PREPARE_SUCCESS) {
+      return result;
+    }
+    if (statement->num_keys == capacity) {
+      capacity *= 2;
+      statement->keys = realloc(statement->keys, capacity * sizeof(uint32_t));
+    }
+    statement->keys[statement->num_keys++] = id;
+
+    Token separator = tokenizer_next(tokenizer);
+    if (separator.type == TOKEN_RIGHT_PAREN) {
+      break;
+    }
+    if (separator.type != TOKEN_COMMA) {
+      return PREPARE_SYNTAX_ERROR;
+    }
+  }
+  if (tokenizer_next(tokenizer).type != TOKEN_END) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+
+  qsort(statement->keys, statement->num_keys, sizeof(uint32_t), compare_keys);
+  uint32_t num_keys = 1;
+  for (uint32_t i = 1; i < statement->num_keys; i++) {
+    if (statement->keys[i] != statement->keys[num_keys - 1]) {
+      statement->keys[num_keys++] = statement->keys[i];
+    }
+  }
+  statement->num_keys = num_keys;
+
+  return PREPARE_SUCCESS;
+}
+
+/*
+ * "where id = <id>", and for a select also "where id between <low> and
+ * <high>" and "where id in (<id>, ...)", once the "where" has been read.
+ */
+static PrepareResult prepare_where(Tokenizer *tokenizer, Statement *statement,
+                                   bool ranges) {
+  Token column = tokenizer_next(tokenizer);
+  Token operator = tokenizer_next(tokenizer);
+  if (!token_is(&column, "id")) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+
+  PrepareResult result;
+  if (operator.type == TOKEN_EQUALS) {
+    // A single id is a range of one key
+    Token id = tokenizer_next(tokenizer);
+    result = prepare_value(statement, &id, PARAMETER_KEY);
+  } else if (ranges && token_is(&operator, "between")) {
+    Token low = tokenizer_next(tokenizer);
+    result = prepare_value(statement, &low, PARAMETER_KEY_LOW);
+    Token and = tokenizer_next(tokenizer);
+    if (result == PREPARE_SUCCESS && !token_is(&and, "and")) {
+      result = PREPARE_SYNTAX_ERROR;
+    }
+    if (result == PREPARE_SUCCESS) {
+      Token high = tokenizer_next(tokenizer);
+      result = prepare_value(statement, &high, PARAMETER_KEY_HIGH);
+    }
+  } else if (ranges && token_is(&operator, "in")) {
+    return prepare_select_in(tokenizer, statement);
+  } else {
+    return PREPARE_SYNTAX_ERROR;
+  }
+
+  if (result == PREPARE_SUCCESS &&
+      tokenizer_next(tokenizer).type != TOKEN_END) {
+    result = PREPARE_SYNTAX_ERROR;
+  }
+  return result;
+}
+
+static void select_all_columns(Statement *statement) {
+  statement->columns[0] = COLUMN_ID;
+  statement->columns[1] = COLUMN_USERNAME;
+  statement->columns[2] = COLUMN_EMAIL;
+  statement->num_columns = NUM_COLUMNS;
+}
+
+/*
+ * The columns between "select" and "where": "*" (the default), "count(*)", or
+ * a comma separated list of column names, each at most once. token starts as
+ * the first token after "select" and is left at the first one after the
+ * columns.
+ */
+static PrepareResult prepare_select_columns(Tokenizer *tokenizer,
+                                            Statement *statement,
+                                            Token *token) {
+  statement->count = false;
+  statement->num_columns = 0;
+
+  if (token->type == TOKEN_END || token_is(token, "where")) {
+    select_all_columns(statement);
+    return PREPARE_SUCCESS;
+  }
+  if (token->type == TOKEN_STAR) {
+    select_all_columns(statement);
+    *token = tokenizer_next(tokenizer);
+    return PREPARE_SUCCESS;
+  }
+  if (token_is(token, "count")) {
+    if (tokenizer_next(tokenizer).type != TOKEN_LEFT_PAREN ||
+        tokenizer_next(tokenizer).type != TOKEN_STAR ||
+        tokenizer_next(tokenizer).type != TOKEN_RIGHT_PAREN) {
+      return PREPARE_SYNTAX_ERROR;
+    }
+    statement->count = true;
+    select_all_columns(statement);
+    *token = tokenizer_next(tokenizer);
+    return PREPARE_SUCCESS;
+  }
+
+  while (true) {
+    Column column;
+    if (token_is(token, "id")) {
+      column = COLUMN_ID;
+    } else if (token_is(token, "username")) {
+      column = COLUMN_USERNAME;
+    } else if (token_is(token, "email")) {
+      column = COLUMN_EMAIL;
+    } else {
+      return PREPARE_SYNTAX_ERROR;
+    }
+    for (uint32_t i = 0; i < statement->num_columns; i++) {
+      if (statement->columns[i] == column) {
+        return PREPARE_SYNTAX_ERROR;
+      }
+    }
+    statement->columns[statement->num_columns++] = column;
+
+    *token = tokenizer_next(tokenizer);
+    if (token->type != TOKEN_COMMA) {
+      return PREPARE_SUCCESS;
+    }
+    *token = tokenizer_next(tokenizer);
+  }
+}
+
+// select [<columns>] [where id { between <low> and <high> | = <id> |
+//                                in (<id>, ...) }]
+static PrepareResult prepare_select(Tokenizer *tokenizer,
+                                    Statement *statement) {
+  statement->type = STATEMENT_SELECT;
+
+  Token token = tokenizer_next(tokenizer);
+  PrepareResult result = prepare_select_columns(tokenizer, statement, &token);
+  if (result != PREPARE_SUCCESS || token.type == TOKEN_END) {
+    return result;
+  }
+  if (!token_is(&token, "where")) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  return prepare_where(tokenizer, statement, true);
+}
+
+// delete where id = <id>
+static PrepareResult prepare_delete(Tokenizer *tokenizer,
+                                    Statement *statement) {
+  statement->type = STATEMENT_DELETE;
+
+  Token where = tokenizer_next(tokenizer);
+  if (!token_is(&where, "where")) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  return prepare_where(tokenizer, statement, false);
+}
+
+/**
+ * Parse a statement, leaving any parameters in it to be bound.
+ *
+ * @param text the statement
+ * @param statement the statement to fill in; its keys and rows must be
+ * released with statement_free(), even when parsing fails
+ *
+ * @return PREPARE_SUCCESS, or why the statement could not be parsed
+ */
+PrepareResult prepare_statement(const char *text, Statement *statement) {
+  statement->keys = NULL;
+  statement->num_keys = 0;
+  statement->rows = NULL;
+  statement->num_rows = 0;
+  statement->num_parameters = 0;
+  statement->key_low = 0;
+  statement->key_high = UINT32_MAX;
+  statement->row_to_insert.id = 0;
+  statement->row_to_insert.username[0] = '\0';
+  statement->row_to_insert.email[0] = '\0';
+
+  Tokenizer tokenizer;
+  tokenizer_init(&tokenizer, text);
+  Token keyword = tokenizer_next(&tokenizer);
+
+  if (token_is(&keyword, "insert")) {
+    statement->type = STATEMENT_INSERT;
+    Tokenizer lookahead = tokenizer;
+    Token into = tokenizer_next(&lookahead);
+    if (token_is(&into, "into")) {
+      return prepare_insert_rows(&lookahead, statement);
+    }
+    return prepare_row_values(&tokenizer, statement);
+  }
+  if (token_is(&keyword, "update")) {
+    // update <id> <username> <email> replaces the row with that id
+    statement->type = STATEMENT_UPDATE;
+    return prepare_row_values(&tokenizer, statement);
+  }
+  if (token_is(&keyword, "select")) {
+    return prepare_select(&tokenizer, statement);
+  }
+  if (token_is(&keyword, "delete")) {
+    return prepare_delete(&tokenizer, statement);
+  }
+  if (token_is(&keyword, "begin") || token_is(&keyword, "commit")) {
+    statement->type =
+        token_is(&keyword, "begin") ? STATEMENT_BEGIN : STATEMENT_COMMIT;
+    return tokenizer_next(&tokenizer).type == TOKEN_END ? PREPARE_SUCCESS
+                                                        : PREPARE_SYNTAX_ERROR;
+  }
+
+  return PREPARE_UNRECOGNIZED_STATEMENT;
+}
+
+void statement_free(Statement *statement) {
+  free(statement->keys);
+  statement->keys = NULL;
+  statement->num_keys = 0;
+  free(statement->rows);
+  statement->rows = NULL;
+  statement->num_rows = 0;
+}
+
+/**
+ * Bind a value, given as text, to a parameter of a prepared statement. The
+ * text is checked as it would be had it been written in the statement.
+ *
+ * @param statement the statement
+ * @param index the parameter, counting from 1 in the order they appear
+ * @param text the value, which need not be NUL-terminated
+ * @param length the length of the value
+ *
+ * @return PREPARE_SUCCESS, or why the value does not fit its parameter
+ */
+PrepareResult statement_bind_text(Statement *statement, uint32_t index,
+                                  const char *text, uint32_t length) {
+  if (index == 0 || index > statement->num_parameters) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  return bind_value(statement, statement->parameters[index - 1], text,
+                    length);
+}
+
+/**
+ * Bind an id to a parameter of a prepared statement.
+ *
+ * @param statement the statement
+ * @param index the parameter, counting from 1 in the order they appear
+ * @param value the id
+ *
+ * @return PREPARE_SUCCESS, or why the value does not fit its parameter
+ */
+PrepareResult statement_bind_int(Statement *statement, uint32_t index,
+                                 int value) {
+  if (index == 0 || index > statement->num_parameters) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  ParameterTarget target = statement->parameters[index - 1];
+  if (target == PARAMETER_USERNAME || target == PARAMETER_EMAIL) {
+    char text[12];
+    uint32_t length = snprintf(text, sizeof(text), "%d", value);
+    return bind_value(statement, target, text, length);
+  }
+  if (value < 0) {
+    return PREPARE_NEGATIVE_ID;
+  }
+  set_key(statement, target, value);
+  return PREPARE_SUCCESS;
+}
+
+/*
+ * The statement cache: statements prepared under a name at the prompt, kept
+ * parsed until they are deallocated.
+ */
+
+void statement_cache_init(StatementCache *cache) {
+  cache->statements = NULL;
+  cache->num_statements = 0;
+  cache->capacity = 0;
+}
+
+static NamedStatement *statement_cache_entry(StatementCache *cache,
+                                             const char *name,
+                                             uint32_t length) {
+  for (uint32_t i = 0; i < cache->num_statements; i++) {
+    NamedStatement *entry = &cache->statements[i];
+    if (strlen(entry->name) == length &&
+        strncmp(entry->name, name, length) == 0) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Look up a prepared statement by name.
+ *
+ * @return the statement, or NULL if there is none by that name
+ */
+Statement *statement_cache_find(StatementCache *cache, const char *name,
+                                uint32_t length) {
+  NamedStatement *entry = statement_cache_entry(cache, name, length);
+  return entry != NULL ? &entry->statement : NULL;
+}
+
+/**
+ * Make room for a statement under a name, replacing any statement by that
+ * name. The returned statement is to be filled in by prepare_statement().
+ */
+Statement *statement_cache_add(StatementCache *cache, const char *name,
+                               uint32_t length) {
+  NamedStatement *entry = statement_cache_entry(cache, name, length);
+  if (entry != NULL) {
+    statement_free(&entry->statement);
+    return &entry->statement;
+  }
+
+  if (cache->num_statements == cache->capacity) {
+    cache->capacity = cache->capacity ? cache->capacity * 2 : 8;
+    cache->statements =
+        realloc(cache->statements, cache->capacity * sizeof(NamedStatement));
+  }
+  entry = &cache->statements[cache->num_statements++];
+  entry->name = strndup(name, length);
+  entry->statement.keys = NULL;
+  entry->statement.rows = NULL;
+  return &entry->statement;
+}
+
+/**
+ * Drop a prepared statement.
+ *
+ * @return false if there is no statement by that name
+ */
+bool statement_cache_remove(StatementCache *cache, const char *name,
+                            uint32_t length) {
+  NamedStatement *entry = statement_cache_entry(cache, name, length);
+  if (entry == NULL) {
+    return false;
+  }
+  statement_free(&entry->statement);
+  free(entry->name);
+  *entry = cache->statements[--cache->num_statements];
+  return true;
+}
+
+void statement_cache_free(StatementCache *cache) {
+  for (uint32_t i = 0; i < cache->num_statements; i++) {
+    statement_free(&cache->statements[i].statement);
+    free(cache->statements[i].name);
+  }
+  free(cache->statements);
+  statement_cache_init(cache);
+}
@@ -1,17 +1,35 @@
+#define _GNU_SOURCE // pthread_rwlockattr_setkind_np()
 #include "db.h"
 
-Table *db_open(const char *filename) {
-  Pager *pager = pager_open(filename);
+Table *db_open(const char *filename, uint32_t page_size) {
+  Pager *pager = pager_open(filename, page_size);
 
   Table *table = malloc(sizeof(Table));
   table->pager = pager;
-  table->root_page_num = 0;
 
-  if (pager->num_pages == 0) {
-    // New database file. Initialize page 0 as leaf node.
-    void *root_node = get_page(pager, 0);
+  pthread_rwlockattr_t lock_attributes;
+  pthread_rwlockattr_init(&lock_attributes);
+#ifdef __GLIBC__
+  // A steady stream of selects must not starve the writer
+  pthread_rwlockattr_setkind_np(&lock_attributes,
+                                PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+  pthread_rwlock_init(&table->lock, &lock_attributes);
+  pthread_rwlockattr_destroy(&lock_attributes);
+  void *header = get_page(pager, DB_HEADER_PAGE_NUM);
+  table->root_page_num = *header_root_page_num(header);
+  table->last_leaf_page_num = INVALID_PAGE_NUM;
+  table->scan_threads = 1;
+  table->scan_ordered = true;
+  table->flusher = NULL;
+
+  if (pager->num_pages <= table->root_page_num) {
+    // New database file. Initialize the root page as leaf node.
+    void *root_node = get_page(pager, table->root_page_num);
+    pager_mark_dirty(pager, table->root_page_num);
     initialize_leaf_node(root_node);
     set_node_root(root_node, true);
+    pager_end_writes(pager);
   }
 
   return table;
@@ -24,16 +42,140 @@ Table *db_open(const char *filename) {
  *
  * @param table the table to be searched
  * @param key the key that needs to be searched
- *
- * @return A pointer to the cursor at the given position
+ * @param cursor the cursor to position
  */
-Cursor *table_find(Table *table, uint32_t key) {
+void table_find(Table *table, uint32_t key, Cursor *cursor) {
   uint32_t root_page_num = table->root_page_num;
   void *root_node = get_page(table->pager, root_page_num);
 
   if (get_node_type(root_node) == NODE_LEAF) {
-    return leaf_node_find(table, root_page_num, key);
+    leaf_node_find(table, root_page_num, key, cursor);
   } else {
-    return internal_node_find(table, root_page_num, key);
+    internal_node_find(table, root_page_num, key, cursor);
+  }
+}
+
+/*
+ * One attempt at table_lookup(). Each child is only trusted once its parent
+ * is found unchanged after the child's version has been read, and every
+ * count and offset read from a page is checked against the page's bounds,
+ * since the page may be changing under the reader.
+ */
+static LookupResult table_lookup_once(Table *table, uint32_t key, void *row,
+                                      uint32_t *row_size) {
+  Pager *pager = table->pager;
+  PageRead read;
+  if (!pager_read_optimistic(pager, table->root_page_num, &read)) {
+    return LOOKUP_NOT_CACHED;
+  }
+
+  while (get_node_type(read.page) == NODE_INTERNAL) {
+    uint32_t num_keys = *internal_node_num_keys(read.page);
+    if (num_keys > pager->internal_node_max_keys) {
+      return LOOKUP_CONFLICT;
+    }
+    uint32_t index = key_search(internal_node_key(read.page, 0), num_keys, key);
+    uint32_t child_page_num = index == num_keys
+                                  ? *internal_node_right_child(read.page)
+                                  : *internal_node_cell(read.page, index);
+
+    PageRead parent = read;
+    bool cached = pager_read_optimistic(pager, child_page_num, &read);
+    if (!pager_validate_read(&parent)) {
+      return LOOKUP_CONFLICT;
+    }
+    if (!cached) {
+      return LOOKUP_NOT_CACHED;
+    }
+  }
+  if (get_node_type(read.page) != NODE_LEAF) {
+    return LOOKUP_CONFLICT;
+  }
+
+  uint32_t num_cells = *leaf_node_num_cells(read.page);
+  if (num_cells > (pager->page_size - LEAF_NODE_HEADER_SIZE) /
+                      LEAF_NODE_SLOT_SIZE) {
+    return LOOKUP_CONFLICT;
+  }
+  uint32_t cell_num = key_search(leaf_node_key(read.page, 0), num_cells, key);
+  bool found = cell_num < num_cells &&
+               *(uint32_t *)leaf_node_key(read.page, cell_num) == key;
+  if (found) {
+    uint32_t value_offset = *leaf_node_value_offset(read.page, cell_num);
+    *row_size = *leaf_node_value_size(read.page, cell_num);
+    if (*row_size > ROW_MAX_SIZE ||
+        value_offset + *row_size > pager->page_size) {
+      return LOOKUP_CONFLICT;
+    }
+    memcpy(row, read.page + value_offset, *row_size);
+  }
+
+  if (!pager_validate_read(&read)) {
+    return LOOKUP_CONFLICT;
+  }
+  return found ? LOOKUP_FOUND : LOOKUP_NOT_FOUND;
+}
+
+/**
+ * Look a key up without taking the table's lock, so that point lookups on
+ * many threads neither wait for each other nor write to memory they share.
+ * Pages are read optimistically and checked afterwards (see
+ * pager_read_optimistic()) and read again if a write got in the way, up to
+ * TABLE_LOOKUP_ATTEMPTS times.
+ *
+ * @param table the table to search
+ * @param key the key to look up
+ * @param row filled in with a copy of the serialized row, if found
+ * @param row_size set to the size of the row
+ *
+ * @return LOOKUP_FOUND or LOOKUP_NOT_FOUND, or LOOKUP_CONFLICT or
+ * LOOKUP_NOT_CACHED if the key has to be looked up under the table lock
+ */
+LookupResult table_lookup(Table *table, uint32_t key, void *row,
+                          uint32_t *row_size) {
+  LookupResult result = LOOKUP_CONFLICT;
+  for (uint32_t attempt = 0;
+       attempt < TABLE_LOOKUP_ATTEMPTS && result == LOOKUP_CONFLICT;
+       attempt++) {
+    result = table_lookup_once(table, key, row, row_size);
   }
+  return result;
+}
+
+/**
+ * Position a cursor past the last cell of the right-most leaf if key is
+ * larger than every key in the table, without descending from the root.
+ * Returns false, leaving the cursor alone, when the key is not an append or
+ * the right-most leaf is not known yet.
+ *
+ * @param table the table to be inserted into
+ * @param key the key that is about to be inserted
+ * @param cursor the cursor to position at the end of the table
+ *
+ * @return Whether the cursor was positioned
+ */
+bool table_find_append(Table *table, uint32_t key, Cursor *cursor) {
+  uint32_t page_num = table->last_leaf_page_num;
+  if (page_num == INVALID_PAGE_NUM) {
+    return false;
+  }
+
+  void *node = get_page(table->pager, page_num);
+  // The hint is only trusted while it still names the right-most leaf
+  if (get_node_type(node) != NODE_LEAF || *leaf_node_next_leaf(node) != 0) {
+    table->last_leaf_page_num = INVALID_PAGE_NUM;
+    return false;
+  }
+
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  if (num_cells > 0 &&
+      key <= *(uint32_t *)leaf_node_key(node, num_cells - 1)) {
+    return false;
+  }
+
+  cursor->table = table;
+  cursor->page_num = page_num;
+  cursor->cell_num = num_cells;
+  cursor->end_of_table = true;
+  return true;
 }
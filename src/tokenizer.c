@@ -0,0 +1,153 @@
+#include "db.h"
+
+/*
+ * Tokenizer for statements.
+ *
+ * A Tokenizer walks a statement without writing to it: tokens point into
+ * the text and carry their length, so there is no copy, no NUL to plant and
+ * no hidden state shared between tokenizers (as strtok() has), and a
+ * statement can be tokenized once and kept.
+ *
+ * Words run until whitespace or one of the punctuation characters below and
+ * are numbers when made of digits with an optional leading minus. Strings
+ * in single quotes may hold anything but a single quote. Values, the strings
+ * of an insert or update, are read with tokenizer_next_value() instead and
+ * only end at whitespace, so they may hold punctuation.
+ */
+
+static bool is_space(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static bool is_punctuation(char c) {
+  return c == '(' || c == ')' || c == ',' || c == '=' || c == '*' ||
+         c == '?' || c == '\'';
+}
+
+static void tokenizer_skip_spaces(Tokenizer *tokenizer) {
+  while (is_space(*tokenizer->position)) {
+    tokenizer->position++;
+  }
+}
+
+/* Classify a run of characters as a number, a parameter or a word */
+static TokenType word_type(const char *start, uint32_t length) {
+  if (length == 1 && *start == '?') {
+    return TOKEN_PARAMETER;
+  }
+  uint32_t i = (length > 1 && *start == '-') ? 1 : 0;
+  for (; i < length; i++) {
+    if (start[i] < '0' || start[i] > '9') {
+      return TOKEN_WORD;
+    }
+  }
+  return TOKEN_NUMBER;
+}
+
+void tokenizer_init(Tokenizer *tokenizer, const char *input) {
+  tokenizer->position = input;
+}
+
+const char *tokenizer_rest(Tokenizer *tokenizer) {
+  tokenizer_skip_spaces(tokenizer);
+  return tokenizer->position;
+}
+
+/**
+ * Read the next token of a statement.
+ *
+ * @param tokenizer the tokenizer
+ *
+ * @return the token, of type TOKEN_END once the statement is used up
+ */
+Token tokenizer_next(Tokenizer *tokenizer) {
+  tokenizer_skip_spaces(tokenizer);
+
+  Token token;
+  token.start = tokenizer->position;
+  char c = *token.start;
+  if (c == '\0') {
+    token.type = TOKEN_END;
+    token.length = 0;
+    return token;
+  }
+
+  token.length = 1;
+  switch (c) {
+  case ('('):
+    token.type = TOKEN_LEFT_PAREN;
+    break;
+  case (')'):
+    token.type = TOKEN_RIGHT_PAREN;
+    break;
+  case (','):
+    token.type = TOKEN_COMMA;
+    break;
+  case ('='):
+    token.type = TOKEN_EQUALS;
+    break;
+  case ('*'):
+    token.type = TOKEN_STAR;
+    break;
+  case ('?'):
+    token.type = TOKEN_PARAMETER;
+    break;
+  case ('\''): {
+    // The token is what lies between the quotes
+    const char *end = strchr(token.start + 1, '\'');
+    if (end == NULL) {
+      token.type = TOKEN_INVALID;
+      token.length = strlen(token.start);
+      tokenizer->position += token.length;
+      return token;
+    }
+    token.type = TOKEN_STRING;
+    token.start++;
+    token.length = end - token.start;
+    tokenizer->position = end + 1;
+    return token;
+  }
+  default:
+    while (token.start[token.length] != '\0' &&
+           !is_space(token.start[token.length]) &&
+           !is_punctuation(token.start[token.length])) {
+      token.length++;
+    }
+    token.type = word_type(token.start, token.length);
+    break;
+  }
+
+  tokenizer->position += token.length;
+  return token;
+}
+
+/**
+ * Read the next value of an insert or update: everything up to the next
+ * whitespace. A lone "?" is a parameter.
+ *
+ * @param tokenizer the tokenizer
+ *
+ * @return the value as a TOKEN_WORD, TOKEN_NUMBER or TOKEN_PARAMETER, or a
+ * TOKEN_END once the statement is used up
+ */
+Token tokenizer_next_value(Tokenizer *tokenizer) {
+  tokenizer_skip_spaces(tokenizer);
+
+  Token token;
+  token.start = tokenizer->position;
+  token.length = 0;
+  while (token.start[token.length] != '\0' &&
+         !is_space(token.start[token.length])) {
+    token.length++;
+  }
+  token.type =
+      token.length == 0 ? TOKEN_END : word_type(token.start, token.length);
+
+  tokenizer->position += token.length;
+  return token;
+}
+
+bool token_is(Token *token, const char *word) {
+  return token->type == TOKEN_WORD && strlen(word) == token->length &&
+         strncmp(token->start, word, token->length) == 0;
+}
@@ -37,27 +37,84 @@ void print_tree(Pager *pager, uint32_t page_num, uint32_t indentation_level) {
   }
 }
 
-void print_constants() {
-  printf("ROW_SIZE: %d\n", ROW_SIZE);
+void print_constants(Pager *pager) {
+  printf("PAGE_SIZE: %d\n", pager->page_size);
+  printf("ROW_MAX_SIZE: %d\n", ROW_MAX_SIZE);
   printf("COMMON_NODE_HEADER_SIZE: %d\n", COMMON_NODE_HEADER_SIZE);
   printf("LEAF_NODE_HEADER_SIZE: %d\n", LEAF_NODE_HEADER_SIZE);
-  printf("LEAF_NODE_CELL_SIZE: %d\n", LEAF_NODE_CELL_SIZE);
-  printf("LEAF_NODE_SPACE_FOR_CELLS: %d\n", LEAF_NODE_SPACE_FOR_CELLS);
-  printf("LEAF_NODE_MAX_CELLS: %d\n", LEAF_NODE_MAX_CELLS);
+  printf("LEAF_NODE_SLOT_SIZE: %d\n", LEAF_NODE_SLOT_SIZE);
+  printf("LEAF_NODE_SPACE_FOR_CELLS: %d\n",
+         pager->page_size - LEAF_NODE_HEADER_SIZE);
+  printf("INTERNAL_NODE_MAX_KEYS: %d\n", pager->internal_node_max_keys);
+  printf("KEY_SEARCH: %s\n", key_search_name());
+  printf("PAGE_CHECKSUM: crc32c (%s)\n", crc32c_name());
 }
 
 void print_row(Row *row) {
   printf("(%d, %s, %s)\n", row->id, row->username, row->email);
 }
 
-void serialize_row(Row *source, void *destination) {
-  memcpy(destination + ID_OFFSET, &(source->id), ID_SIZE);
-  memcpy(destination + USERNAME_OFFSET, &(source->username), USERNAME_SIZE);
-  memcpy(destination + EMAIL_OFFSET, &(source->email), EMAIL_SIZE);
+uint32_t row_serialized_size(Row *row) {
+  return ID_SIZE + 2 * ROW_FIELD_LENGTH_SIZE + strlen(row->username) +
+         strlen(row->email);
+}
+
+/*
+ * Write a length-prefixed string and return the bytes taken.
+ */
+static uint32_t serialize_string(const char *source, void *destination) {
+  uint8_t length = strlen(source);
+  *(uint8_t *)destination = length;
+  memcpy(destination + ROW_FIELD_LENGTH_SIZE, source, length);
+  return ROW_FIELD_LENGTH_SIZE + length;
+}
+
+static uint32_t deserialize_string(void *source, char *destination) {
+  uint8_t length = *(uint8_t *)source;
+  memcpy(destination, source + ROW_FIELD_LENGTH_SIZE, length);
+  destination[length] = '\0';
+  return ROW_FIELD_LENGTH_SIZE + length;
+}
+
+/**
+ * Serialize a row in its compact on-disk form.
+ *
+ * @param source the row
+ * @param destination at least row_serialized_size(source) bytes
+ *
+ * @return the number of bytes written
+ */
+uint32_t serialize_row(Row *source, void *destination) {
+  uint32_t offset = ID_OFFSET;
+  memcpy(destination + offset, &(source->id), ID_SIZE);
+  offset += ID_SIZE;
+  offset += serialize_string(source->username, destination + offset);
+  offset += serialize_string(source->email, destination + offset);
+  return offset;
 }
 
 void deserialize_row(void *source, Row *destination) {
-  memcpy(&(destination->id), source + ID_OFFSET, ID_SIZE);
-  memcpy(&(destination->username), source + USERNAME_OFFSET, USERNAME_SIZE);
-  memcpy(&(destination->email), source + EMAIL_OFFSET, EMAIL_SIZE);
-}
\ No newline at end of file
+  uint32_t offset = ID_OFFSET;
+  memcpy(&(destination->id), source + offset, ID_SIZE);
+  offset += ID_SIZE;
+  offset += deserialize_string(source + offset, destination->username);
+  deserialize_string(source + offset, destination->email);
+}
+/**
+ * Find one string column of a serialized row without decoding the others.
+ * Only the length prefixes of the columns before it are read.
+ *
+ * @param source the serialized row
+ * @param column COLUMN_USERNAME or COLUMN_EMAIL
+ * @param length set to the length of the string
+ *
+ * @return the first character of the string, which is not NUL-terminated
+ */
+const char *row_string_column(void *source, Column column, uint8_t *length) {
+  uint8_t *field = source + ID_OFFSET + ID_SIZE;
+  if (column == COLUMN_EMAIL) {
+    field += ROW_FIELD_LENGTH_SIZE + *field;
+  }
+  *length = *field;
+  return (const char *)field + ROW_FIELD_LENGTH_SIZE;
+}
@@ -0,0 +1,300 @@
+#include "db.h"
+
+/*
+ * Write-ahead log.
+ *
+ * The log lives next to the database file in "<filename>-wal" and holds full
+ * page images. Every statement that modifies the tree appends the pages it
+ * dirtied as frames, the last of which is marked as a commit frame. Readers
+ * look a page up in the log before falling back to the main file, and a
+ * checkpoint copies the newest image of every logged page back into the
+ * database file and resets the log.
+ *
+ * WAL Header Layout
+ * -----------------------------------------------------
+ * |  Magic   | Version  | Page size |       Salt      |
+ * | (uint32) | (uint32) |  (uint32) |     (uint32)    |
+ * -----------------------------------------------------
+ *
+ * WAL Frame Layout
+ * -----------------------------------------------------------------------
+ * | Page number | Commit size | Salt     | Checksum  | Checksum | Page  |
+ * |  (uint32)   |  (uint32)   | (uint32) | 1 (uint32)| 2(uint32)| data  |
+ * -----------------------------------------------------------------------
+ *
+ * The commit size is the number of pages in the database after the commit,
+ * or 0 for frames that are not the last frame of a commit. The checksum is
+ * cumulative: it covers this frame and every frame before it, so a torn or
+ * stale frame ends the log on recovery.
+ */
+
+static const uint32_t WAL_MAGIC = 0x7453716c; // "tSql"
+static const uint32_t WAL_VERSION = 1;
+static const uint32_t WAL_HEADER_SIZE = 4 * sizeof(uint32_t);
+static const uint32_t WAL_FRAME_HEADER_SIZE = 5 * sizeof(uint32_t);
+
+static off_t wal_frame_offset(Wal *wal, uint32_t frame_num) {
+  return WAL_HEADER_SIZE +
+         (off_t)frame_num * (WAL_FRAME_HEADER_SIZE + wal->page_size);
+}
+
+static void wal_checksum(uint32_t checksum[2], const void *data,
+                         uint32_t length) {
+  const uint32_t *words = data;
+  for (uint32_t i = 0; i < length / sizeof(uint32_t); i++) {
+    checksum[0] += words[i] + checksum[1];
+    checksum[1] += words[i] + checksum[0];
+  }
+}
+
+static void wal_reserve_index(Wal *wal, uint32_t page_num) {
+  if (page_num < wal->page_frames_capacity) {
+    return;
+  }
+
+  uint32_t capacity =
+      wal->page_frames_capacity ? wal->page_frames_capacity : 64;
+  while (capacity <= page_num) {
+    capacity *= 2;
+  }
+
+  wal->page_frames = realloc(wal->page_frames, capacity * sizeof(uint32_t));
+  for (uint32_t i = wal->page_frames_capacity; i < capacity; i++) {
+    wal->page_frames[i] = INVALID_FRAME_NUM;
+  }
+  wal->page_frames_capacity = capacity;
+}
+
+static void wal_write_header(Wal *wal) {
+  uint32_t header[4] = {WAL_MAGIC, WAL_VERSION, wal->page_size, wal->salt};
+
+  if (ftruncate(wal->file_descriptor, 0) == -1 ||
+      pwrite(wal->file_descriptor, header, WAL_HEADER_SIZE, 0) !=
+          (ssize_t)WAL_HEADER_SIZE) {
+    printf("Error writing WAL header: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+
+  wal->num_frames = 0;
+  wal->committed_frames = 0;
+  wal->checksum[0] = wal->salt;
+  wal->checksum[1] = 0;
+}
+
+/*
+ * Scan the log and index every frame up to the last valid commit frame.
+ * Frames after it belong to a statement that never committed.
+ */
+static void wal_recover(Wal *wal) {
+  uint32_t header[4];
+  if (pread(wal->file_descriptor, header, WAL_HEADER_SIZE, 0) !=
+          (ssize_t)WAL_HEADER_SIZE ||
+      header[0] != WAL_MAGIC || header[1] != WAL_VERSION ||
+      header[2] != wal->page_size) {
+    wal_write_header(wal);
+    return;
+  }
+
+  wal->salt = header[3];
+  wal->checksum[0] = wal->salt;
+  wal->checksum[1] = 0;
+
+  void *page = malloc(wal->page_size);
+  uint32_t frame_header[5];
+  uint32_t *page_nums = NULL;
+  uint32_t num_frames = 0;
+  uint32_t num_committed = 0;
+  uint32_t committed_checksum[2] = {wal->checksum[0], wal->checksum[1]};
+
+  while (true) {
+    off_t offset = wal_frame_offset(wal, num_frames);
+    if (pread(wal->file_descriptor, frame_header, WAL_FRAME_HEADER_SIZE,
+              offset) != (ssize_t)WAL_FRAME_HEADER_SIZE ||
+        pread(wal->file_descriptor, page, wal->page_size,
+              offset + WAL_FRAME_HEADER_SIZE) != (ssize_t)wal->page_size) {
+      break;
+    }
+    if (frame_header[2] != wal->salt) {
+      break;
+    }
+
+    uint32_t checksum[2] = {wal->checksum[0], wal->checksum[1]};
+    wal_checksum(checksum, frame_header, 2 * sizeof(uint32_t));
+    wal_checksum(checksum, page, wal->page_size);
+    if (checksum[0] != frame_header[3] || checksum[1] != frame_header[4]) {
+      break;
+    }
+
+    wal->checksum[0] = checksum[0];
+    wal->checksum[1] = checksum[1];
+    page_nums = realloc(page_nums, (num_frames + 1) * sizeof(uint32_t));
+    page_nums[num_frames++] = frame_header[0];
+
+    if (frame_header[1] != 0) {
+      num_committed = num_frames;
+      committed_checksum[0] = checksum[0];
+      committed_checksum[1] = checksum[1];
+      wal->db_num_pages = frame_header[1];
+    }
+  }
+
+  for (uint32_t i = 0; i < num_committed; i++) {
+    wal_reserve_index(wal, page_nums[i]);
+    wal->page_frames[page_nums[i]] = i;
+  }
+  wal->num_frames = num_committed;
+  wal->committed_frames = num_committed;
+  wal->checksum[0] = committed_checksum[0];
+  wal->checksum[1] = committed_checksum[1];
+
+  free(page_nums);
+  free(page);
+}
+
+Wal *wal_open(const char *db_filename, uint32_t page_size) {
+  Wal *wal = malloc(sizeof(Wal));
+  wal->filename = malloc(strlen(db_filename) + strlen("-wal") + 1);
+  sprintf(wal->filename, "%s-wal", db_filename);
+
+  wal->file_descriptor =
+      open(wal->filename, O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
+  if (wal->file_descriptor == -1) {
+    printf("Unable to open WAL file\n");
+    exit(EXIT_FAILURE);
+  }
+
+  wal->page_size = page_size;
+  wal->salt = (uint32_t)getpid() ^ (uint32_t)time(NULL);
+  wal->db_num_pages = 0;
+  wal->committed_frames = 0;
+  wal->page_frames = NULL;
+  wal->page_frames_capacity = 0;
+  wal->commits_since_sync = 0;
+  wal->commits_per_sync = WAL_DEFAULT_COMMITS_PER_SYNC;
+  clock_gettime(CLOCK_MONOTONIC, &wal->last_sync);
+  wal->auto_checkpoint = WAL_DEFAULT_AUTO_CHECKPOINT;
+  wal->frames_written = 0;
+  wal->syncs = 0;
+
+  wal_recover(wal);
+
+  return wal;
+}
+
+/*
+ * Return the newest frame holding page_num, or INVALID_FRAME_NUM if the page
+ * has not been logged since the last checkpoint.
+ */
+uint32_t wal_find_frame(Wal *wal, uint32_t page_num) {
+  if (page_num >= wal->page_frames_capacity) {
+    return INVALID_FRAME_NUM;
+  }
+  return wal->page_frames[page_num];
+}
+
+void wal_read_frame(Wal *wal, uint32_t frame_num, void *destination) {
+  off_t offset = wal_frame_offset(wal, frame_num) + WAL_FRAME_HEADER_SIZE;
+  if (pread(wal->file_descriptor, destination, wal->page_size, offset) !=
+      (ssize_t)wal->page_size) {
+    printf("Error reading WAL frame %d: %d\n", frame_num, errno);
+    exit(EXIT_FAILURE);
+  }
+}
+
+/*
+ * Append a page image to the log. commit_num_pages is the database size in
+ * pages when this frame completes a commit, or 0 otherwise.
+ */
+void wal_append_frame(Wal *wal, uint32_t page_num, void *page,
+                      uint32_t commit_num_pages) {
+  uint32_t frame_header[5] = {page_num, commit_num_pages, wal->salt, 0, 0};
+
+  wal_checksum(wal->checksum, frame_header, 2 * sizeof(uint32_t));
+  wal_checksum(wal->checksum, page, wal->page_size);
+  frame_header[3] = wal->checksum[0];
+  frame_header[4] = wal->checksum[1];
+
+  struct iovec iov[2] = {{frame_header, WAL_FRAME_HEADER_SIZE},
+                         {page, wal->page_size}};
+  ssize_t bytes_written = pwritev(wal->file_descriptor, iov, 2,
+                                  wal_frame_offset(wal, wal->num_frames));
+  if (bytes_written != (ssize_t)(WAL_FRAME_HEADER_SIZE + wal->page_size)) {
+    printf("Error writing WAL frame: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+
+  wal_reserve_index(wal, page_num);
+  wal->page_frames[page_num] = wal->num_frames++;
+  wal->frames_written++;
+
+  if (commit_num_pages != 0) {
+    wal->db_num_pages = commit_num_pages;
+    wal->committed_frames = wal->num_frames;
+  }
+}
+
+void wal_sync(Wal *wal) {
+  if (wal->commits_since_sync == 0) {
+    return;
+  }
+  if (fdatasync(wal->file_descriptor) == -1) {
+    printf("Error syncing WAL: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+  wal->commits_since_sync = 0;
+  wal->syncs++;
+  clock_gettime(CLOCK_MONOTONIC, &wal->last_sync);
+}
+
+/*
+ * Group commit: a commit frame is durable once the log is synced, and the
+ * log is only synced once every commits_per_sync commits, or at the first
+ * commit more than WAL_MAX_SYNC_DELAY_MS after the last sync. A crash can
+ * lose at most the last commits_per_sync - 1 statements, but never leaves a
+ * torn statement behind. The flusher syncs commits left waiting once the
+ * writer goes quiet.
+ */
+void wal_commit(Wal *wal) {
+  wal->commits_since_sync++;
+  if (wal->commits_since_sync >= wal->commits_per_sync) {
+    wal_sync(wal);
+    return;
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  int64_t elapsed_ms = (now.tv_sec - wal->last_sync.tv_sec) * 1000 +
+                       (now.tv_nsec - wal->last_sync.tv_nsec) / 1000000;
+  if (elapsed_ms >= WAL_MAX_SYNC_DELAY_MS) {
+    wal_sync(wal);
+  }
+}
+
+/*
+ * Start a fresh, empty log. Only safe once every logged page has been
+ * checkpointed into the database file.
+ */
+void wal_reset(Wal *wal) {
+  wal->salt++;
+  wal_write_header(wal);
+  if (fdatasync(wal->file_descriptor) == -1) {
+    printf("Error syncing WAL: %d\n", errno);
+    exit(EXIT_FAILURE);
+  }
+  wal->commits_since_sync = 0;
+  clock_gettime(CLOCK_MONOTONIC, &wal->last_sync);
+
+  for (uint32_t i = 0; i < wal->page_frames_capacity; i++) {
+    wal->page_frames[i] = INVALID_FRAME_NUM;
+  }
+}
+
+void wal_close(Wal *wal, bool remove_file) {
+  close(wal->file_descriptor);
+  if (remove_file) {
+    unlink(wal->filename);
+  }
+  free(wal->page_frames);
+  free(wal->filename);
+  free(wal);
+}
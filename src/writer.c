@@ -0,0 +1,50 @@
+#include "db.h"
+
+/*
+ * Buffered output for result rows.
+ *
+ * Rows are formatted by hand into a Writer's buffer, which goes out with a
+ * single fwrite() once it fills up or the statement is done. That replaces
+ * one printf() (with its format parsing and locking) per row. The buffer is
+ * handed to the same FILE as everything else, so result rows stay in order
+ * with the prompt and status messages.
+ */
+
+void writer_init(Writer *writer, FILE *file) {
+  writer->file = file;
+  writer->length = 0;
+}
+
+void writer_flush(Writer *writer) {
+  if (writer->length > 0) {
+    fwrite(writer->data, 1, writer->length, writer->file);
+    writer->length = 0;
+  }
+}
+
+void writer_bytes(Writer *writer, const void *bytes, uint32_t length) {
+  if (length > WRITER_BUFFER_SIZE - writer->length) {
+    writer_flush(writer);
+    if (length > WRITER_BUFFER_SIZE) {
+      fwrite(bytes, 1, length, writer->file);
+      return;
+    }
+  }
+  memcpy(writer->data + writer->length, bytes, length);
+  writer->length += length;
+}
+
+void writer_string(Writer *writer, const char *string) {
+  writer_bytes(writer, string, strlen(string));
+}
+
+void writer_uint(Writer *writer, uint32_t value) {
+  // Digits are produced backwards, from the right end of a scratch buffer
+  char digits[10];
+  uint32_t start = sizeof(digits);
+  do {
+    digits[--start] = '0' + value % 10;
+    value /= 10;
+  } while (value > 0);
+  writer_bytes(writer, digits + start, sizeof(digits) - start);
+}
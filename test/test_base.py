@@ -1,6 +1,7 @@
 import unittest
 import subprocess
 import os
+import time
 
 class BaseTest(unittest.TestCase):
 
@@ -11,7 +12,7 @@ class BaseTest(unittest.TestCase):
         if os.path.exists(db_file):
             os.remove(db_file)
 
-    def run_repl(self, input_data):
+    def run_repl(self, input_data, args=()):
         """Runs the REPL binary with the provided input and returns the output."""
 
         # If input is a tuple, join the elements with newlines
@@ -22,7 +23,7 @@ class BaseTest(unittest.TestCase):
         input_data_encoded = input_data.encode()
 
         process = subprocess.Popen(
-            ['./tinysql', 'mydb.db'],
+            ['./tinysql', *args, 'mydb.db'],
             stdin=subprocess.PIPE,
             stdout=subprocess.PIPE,
             stderr=subprocess.PIPE
@@ -33,6 +34,38 @@ class BaseTest(unittest.TestCase):
         # Decode the outputs to strings
         return stdout.decode(), stderr.decode()
 
+    def run_repl_paused(self, input_data, rest, seconds):
+        """Runs the REPL on input_data, waits, then gives it the rest."""
+
+        process = subprocess.Popen(
+            ['./tinysql', 'mydb.db'],
+            stdin=subprocess.PIPE,
+            stdout=subprocess.PIPE,
+            stderr=subprocess.PIPE
+        )
+        process.stdin.write(("\n".join(input_data) + "\n").encode())
+        process.stdin.flush()
+        time.sleep(seconds)
+
+        stdout, stderr = process.communicate(input="\n".join(rest).encode())
+        return stdout.decode(), stderr.decode()
+
+    def run_repl_killed(self, input_data, seconds):
+        """Runs the REPL on input_data, waits, then kills it."""
+
+        process = subprocess.Popen(
+            ['./tinysql', 'mydb.db'],
+            stdin=subprocess.PIPE,
+            stdout=subprocess.DEVNULL,
+            stderr=subprocess.DEVNULL
+        )
+        process.stdin.write(("\n".join(input_data) + "\n").encode())
+        process.stdin.flush()
+        time.sleep(seconds)
+
+        process.kill()
+        process.wait()
+
     def assert_output(self, input_data, expected_output):
         """Checks if the REPL output matches the expected output."""
 
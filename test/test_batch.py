@@ -0,0 +1,74 @@
+import os
+
+from .test_base import BaseTest
+
+
+class TestBatch(BaseTest):
+
+    script_file = "script.sql"
+
+    def tearDown(self) -> None:
+        if os.path.exists(self.script_file):
+            os.remove(self.script_file)
+
+    def write_script(self, lines):
+        with open(self.script_file, "w") as f:
+            f.write("\n".join(lines) + "\n")
+
+    def rows(self, ids):
+        return [f"({i}, user{i}, person{i}@example.com)" for i in ids]
+
+    def test_script_prints_only_results_and_errors(self):
+        self.write_script([
+            "-- two rows, one of them twice",
+            "insert 1 user1 person1@example.com",
+            "",
+            "insert 2 user2 person2@example.com",
+            "insert 1 user1 person1@example.com",
+            "select",
+            "bogus",
+        ])
+
+        output, errors = self.run_repl("", args=("-f", self.script_file))
+
+        expected_output = (
+            "Line 5: Error: Duplicate Key.",
+            *self.rows([1, 2]),
+            "Line 7: Unrecognized keyword at start of 'bogus'.",
+        )
+        self.assertEqual(output.strip(), "\n".join(expected_output))
+        self.assertRegex(errors,
+                         r"^Executed 5 statements \(2 failed\) in [0-9.]+s")
+
+    def test_script_from_stdin_stops_at_exit(self):
+        input_data = (
+            "insert 1 user1 person1@example.com",
+            ".exit",
+            "insert 2 user2 person2@example.com\n",
+        )
+        output, errors = self.run_repl(input_data, args=("-f", "-"))
+        self.assertEqual(output, "")
+        self.assertIn("Executed 1 statements (0 failed)", errors)
+
+        self.assert_output(
+            ("select", ".exit\n"),
+            ("tinysql > " + self.rows([1])[0], "Executed.", "tinysql > "),
+        )
+
+    def test_script_larger_than_a_block(self):
+        # Input is read a MiB at a time, so lines straddle block boundaries
+        ids = range(1, 6001)
+        emails = {i: "e" * (i % 100 + 120) + "@example.com" for i in ids}
+        self.write_script([f"insert {i} user{i} {emails[i]}" for i in ids] +
+                          ["select count(*)", "select where id = 4321"])
+        self.assertGreater(os.path.getsize(self.script_file), 1 << 20)
+
+        output, errors = self.run_repl("", args=("-f", self.script_file))
+
+        self.assertEqual(output,
+                         f"(6000)\n(4321, user4321, {emails[4321]})\n")
+        self.assertRegex(errors, r"^Executed 6002 statements \(0 failed\)")
+
+    def test_missing_script(self):
+        output, _ = self.run_repl("", args=("-f", "missing.sql"))
+        self.assertEqual(output, "Error: could not open 'missing.sql'.\n")
@@ -0,0 +1,58 @@
+import os
+
+from .test_base import BaseTest
+
+
+class TestCompress(BaseTest):
+
+    def insert_rows(self, count, compress):
+        input_data = [".compress on"] if compress else []
+        input_data += [f"insert {i} user{i} person{i}@example.com"
+                       for i in range(1, count + 1)]
+        input_data.append(".exit\n")
+        self.run_repl(tuple(input_data), args=("-p", "16384"))
+
+    def disk_usage(self):
+        return os.stat("mydb.db").st_blocks * 512
+
+    def test_compressed_pages_take_less_space(self):
+        self.insert_rows(2000, compress=False)
+        uncompressed = self.disk_usage()
+        self.setUp()
+        self.insert_rows(2000, compress=True)
+        self.assertLess(self.disk_usage(), uncompressed * 2 // 3)
+
+        # Pages are expanded as they are read, whether or not from the mapping
+        output, _ = self.run_repl((
+            "select count(*)",
+            "select where id = 1234",
+            ".mmap on",
+            "select id where id between 1999 and 2005",
+            ".integrity_check",
+            ".exit\n",
+        ))
+        self.assertEqual(output, "\n".join((
+            "tinysql > (2000)",
+            "Executed.",
+            "tinysql > (1234, user1234, person1234@example.com)",
+            "Executed.",
+            "tinysql > tinysql > (1999)",
+            "(2000)",
+            "Executed.",
+            "tinysql > ok",
+            "tinysql > ",
+        )))
+
+    def test_vacuum_compresses_existing_pages(self):
+        self.insert_rows(2000, compress=False)
+        uncompressed = self.disk_usage()
+
+        output, _ = self.run_repl((".compress", ".compress on", ".vacuum",
+                                   ".compress", ".exit\n"))
+        self.assertEqual(output,
+                         "tinysql > off\ntinysql > tinysql > tinysql > on\n"
+                         "tinysql > ")
+        self.assertLess(self.disk_usage(), uncompressed * 2 // 3)
+
+        output, _ = self.run_repl(("select count(*)", ".exit\n"))
+        self.assertIn("(2000)", output)
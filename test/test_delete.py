@@ -0,0 +1,116 @@
+from .test_base import BaseTest
+
+
+class TestDelete(BaseTest):
+
+    def insert_rows(self, ids):
+        return [f"insert {i} user{i} person{i}@example.com" for i in ids]
+
+    def leaf_sizes(self, output):
+        return [int(line.split("size ")[1].rstrip(")"))
+                for line in output.splitlines() if "- leaf" in line]
+
+    def stat(self, output, name):
+        for line in output.splitlines():
+            if line.startswith(name + ": "):
+                return int(line.split(": ")[1])
+
+    def test_delete_row(self):
+        input_data = (
+            *self.insert_rows([1, 2, 3]),
+            "delete where id = 2",
+            "select",
+            ".exit\n",
+        )
+        expected_output = (
+            "tinysql > Executed.",
+            "tinysql > Executed.",
+            "tinysql > Executed.",
+            "tinysql > Executed.",
+            "tinysql > (1, user1, person1@example.com)",
+            "(3, user3, person3@example.com)",
+            "Executed.",
+            "tinysql > ",
+        )
+        self.assert_output(input_data, expected_output)
+
+    def test_delete_missing_key(self):
+        input_data = (
+            *self.insert_rows([1]),
+            "delete where id = 2",
+            ".exit\n",
+        )
+        expected_output = (
+            "tinysql > Executed.",
+            "tinysql > Error: Key not found.",
+            "tinysql > ",
+        )
+        self.assert_output(input_data, expected_output)
+
+    def test_delete_syntax_error(self):
+        input_data = (
+            "delete where id 2",
+            "delete where id = -1",
+            ".exit\n",
+        )
+        expected_output = (
+            "tinysql > Syntax error. Could not parse statement.",
+            "tinysql > ID must be positive.",
+            "tinysql > ",
+        )
+        self.assert_output(input_data, expected_output)
+
+    def test_delete_keeps_leaves_half_full(self):
+        ids = [(i * 37) % 2000 + 1 for i in range(2000)]
+        self.run_repl((*self.insert_rows(ids), ".exit\n"))
+
+        deleted = [i for i in range(1, 2001) if i % 4 != 0]
+        input_data = (
+            *[f"delete where id = {i}" for i in deleted],
+            ".btree",
+            ".exit\n",
+        )
+        output, _ = self.run_repl(input_data)
+        self.assertNotIn("Error", output)
+        # A leaf holds about 100 of these rows, so half full is about 50
+        for size in self.leaf_sizes(output):
+            self.assertGreaterEqual(size, 45)
+
+        output, _ = self.run_repl(("select", ".exit\n"))
+        ids = [int(line.split("(")[1].split(",")[0])
+               for line in output.splitlines() if "@" in line]
+        self.assertEqual(ids, list(range(4, 2001, 4)))
+
+    def test_delete_all_rows_collapses_tree(self):
+        ids = list(range(1, 1001))
+        self.run_repl((*self.insert_rows(ids), ".exit\n"))
+
+        input_data = (
+            *[f"delete where id = {i}" for i in reversed(ids)],
+            ".btree",
+            ".stats",
+            "select",
+            ".exit\n",
+        )
+        output, _ = self.run_repl(input_data)
+        self.assertIn("Tree:\n- leaf (size 0)\n", output)
+        self.assertEqual(self.stat(output, "free pages"),
+                         self.stat(output, "pages") - 2)
+
+    def test_freed_pages_are_reused(self):
+        ids = list(range(1, 1001))
+        self.run_repl((*self.insert_rows(ids), ".exit\n"))
+        output, _ = self.run_repl((
+            *[f"delete where id = {i}" for i in ids],
+            ".stats",
+            ".exit\n",
+        ))
+        num_pages = self.stat(output, "pages")
+
+        output, _ = self.run_repl((
+            *self.insert_rows(ids),
+            ".stats",
+            ".exit\n",
+        ))
+        self.assertEqual(self.stat(output, "pages"), num_pages)
+        self.assertLess(self.stat(output, "free pages"), 3)
@@ -0,0 +1,80 @@
+import os
+
+from .test_base import BaseTest
+
+
+class TestImport(BaseTest):
+
+    import_file = "import.txt"
+
+    def tearDown(self) -> None:
+        if os.path.exists(self.import_file):
+            os.remove(self.import_file)
+
+    def write_import_file(self, ids):
+        with open(self.import_file, "w") as f:
+            for i in ids:
+                f.write(f"{i} user{i} person{i}@example.com\n")
+
+    def rows(self, ids):
+        return [f"({i}, user{i}, person{i}@example.com)" for i in ids]
+
+    def assert_imported(self, ids, expected_ids):
+        self.write_import_file(ids)
+        self.assert_output(
+            (f".import {self.import_file}", ".exit\n"),
+            (f"tinysql > Imported {len(ids)} rows.", "tinysql > "),
+        )
+
+        rows = self.rows(expected_ids)
+        expected_output = (
+            "tinysql > " + rows[0],
+            *rows[1:],
+            "Executed.",
+            "tinysql > ",
+        )
+        self.assert_output(("select", ".exit\n"), expected_output)
+
+    def test_import_sorted_rows(self):
+        self.assert_imported(list(range(1, 201)), range(1, 201))
+
+    def test_import_unsorted_rows(self):
+        self.assert_imported([(i * 37) % 200 + 1 for i in range(200)],
+                             range(1, 201))
+
+    def test_insert_after_import(self):
+        self.write_import_file(range(1, 101))
+        self.run_repl((f".import {self.import_file}", ".exit\n"))
+
+        input_data = (
+            "insert 50 user50 person50@example.com",
+            "insert 101 user101 person101@example.com",
+            "select where id between 99 and 200",
+            ".exit\n",
+        )
+        expected_output = (
+            "tinysql > Error: Duplicate Key.",
+            "tinysql > Executed.",
+            "tinysql > " + self.rows([99])[0],
+            *self.rows([100, 101]),
+            "Executed.",
+            "tinysql > ",
+        )
+        self.assert_output(input_data, expected_output)
+
+    def test_import_rejects_duplicates(self):
+        self.write_import_file([3, 1, 2, 1])
+        self.assert_output(
+            (f".import {self.import_file}", "select", ".exit\n"),
+            ("tinysql > Error: Duplicate Key.", "tinysql > Executed.",
+             "tinysql > "),
+        )
+
+    def test_import_reports_bad_line(self):
+        with open(self.import_file, "w") as f:
+            f.write("1 user1 person1@example.com\n")
+            f.write("-2 user2 person2@example.com\n")
+        self.assert_output(
+            (f".import {self.import_file}", ".exit\n"),
+            ("tinysql > Error: could not parse line 2.", "tinysql > "),
+        )
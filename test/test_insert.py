@@ -199,4 +199,81 @@ class TestInsert(BaseTest):
         "tinysql > ",
         )
         
-        self.assert_output(input_data, expected_output)
\ No newline at end of file
+        self.assert_output(input_data, expected_output)
+    def test_increasing_ids_fill_leaves(self):
+        nodes = self.btree_nodes(300)
+
+        expected_nodes = [
+            "- internal (size 3)",
+            "  - leaf (size 102)",
+            "  - key 102",
+            "  - leaf (size 97)",
+            "  - key 199",
+            "  - leaf (size 97)",
+            "  - key 296",
+            "  - leaf (size 4)",
+        ]
+        self.assertEqual(nodes, expected_nodes)
+
+    def internal_node_max_keys(self):
+        output, _ = self.run_repl((".constants", ".exit\n"))
+        for line in output.splitlines():
+            if line.startswith("INTERNAL_NODE_MAX_KEYS:"):
+                return int(line.split()[-1])
+
+    def btree_nodes(self, num_rows):
+        """Insert ids 1..num_rows and return the tree without the leaf keys."""
+
+        input_data = [f"insert {i} user{i} person{i}@example.com"
+                      for i in range(1, num_rows + 1)]
+        input_data += [".btree", ".exit\n"]
+        output, _ = self.run_repl(tuple(input_data))
+
+        tree = output[output.index("Tree:"):].splitlines()[1:-1]
+        return [line for line in tree if "internal" in line or "leaf" in line
+                or "key" in line]
+
+    def test_internal_nodes_fill_their_page(self):
+        if self.internal_node_max_keys() == 3:
+            self.skipTest("built with TINYSQL_SMALL_FANOUT")
+
+        # 22 leaves still fit under a single root
+        nodes = self.btree_nodes(2000)
+        self.assertEqual(nodes[0], "- internal (size 21)")
+        self.assertEqual(sum("leaf" in node for node in nodes), 22)
+
+    def test_internal_node_split(self):
+        if self.internal_node_max_keys() != 3:
+            self.skipTest("needs TINYSQL_SMALL_FANOUT")
+
+        expected_nodes = [
+            "- internal (size 1)",
+            "  - internal (size 1)",
+            "    - leaf (size 102)",
+            "    - key 102",
+            "    - leaf (size 97)",
+            "  - key 199",
+            "  - internal (size 2)",
+            "    - leaf (size 97)",
+            "    - key 296",
+            "    - leaf (size 97)",
+            "    - key 393",
+            "    - leaf (size 7)",
+        ]
+        self.assertEqual(self.btree_nodes(400), expected_nodes)
+
+    def test_rows_of_different_lengths(self):
+        # Full-length rows among short ones, enough to split several leaves
+        def row(i):
+            if i % 3 == 0:
+                return (i, "u" * 32, "e" * 255)
+            return (i, f"user{i}", f"p{i}@x.io")
+
+        ids = [(i * 7) % 60 + 1 for i in range(60)]
+        input_data = [f"insert {i} {u} {e}" for i, u, e in map(row, ids)]
+        input_data += ["select", ".exit\n"]
+        output, _ = self.run_repl(tuple(input_data))
+
+        rows = [f"({i}, {u}, {e})" for i, u, e in map(row, range(1, 61))]
+        self.assertEqual(output.split("tinysql > ")[-2].splitlines(),
+                         rows + ["Executed."])
@@ -0,0 +1,79 @@
+import struct
+
+from .test_base import BaseTest
+
+PAGE_SIZE = 4096
+NODE_TYPE_OFFSET = 4
+NODE_LEAF = 1
+LEAF_NODE_NEXT_LEAF_OFFSET = 14
+
+
+def crc32c(data):
+    crc = 0xffffffff
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = (crc >> 1) ^ (0x82f63b78 if crc & 1 else 0)
+    return crc ^ 0xffffffff
+
+
+class TestIntegrity(BaseTest):
+
+    def insert_rows(self, count):
+        input_data = [f"insert {i} user{i} person{i}@example.com"
+                      for i in range(1, count + 1)]
+        input_data.append(".exit\n")
+        self.run_repl(tuple(input_data))
+
+    def read_page(self, page_num):
+        with open("mydb.db", "rb") as db:
+            db.seek(page_num * PAGE_SIZE)
+            return bytearray(db.read(PAGE_SIZE))
+
+    def write_page(self, page_num, page):
+        with open("mydb.db", "r+b") as db:
+            db.seek(page_num * PAGE_SIZE)
+            db.write(page)
+
+    def leaf_page_nums(self):
+        page_nums = []
+        for page_num in range(1, 64):
+            page = self.read_page(page_num)
+            if len(page) == PAGE_SIZE and page[NODE_TYPE_OFFSET] == NODE_LEAF:
+                page_nums.append(page_num)
+        return page_nums
+
+    def test_healthy_database(self):
+        self.insert_rows(1000)
+        output, _ = self.run_repl((".integrity_check", ".exit\n"))
+        self.assertEqual(output, "tinysql > ok\ntinysql > ")
+
+    def test_detects_checksum_mismatch(self):
+        self.insert_rows(1000)
+        page_num = self.leaf_page_nums()[1]
+        page = self.read_page(page_num)
+        page[PAGE_SIZE - 1] ^= 1
+        self.write_page(page_num, page)
+
+        output, _ = self.run_repl((".integrity_check", ".exit\n"))
+        self.assertEqual(
+            output,
+            f"tinysql > Page {page_num}: checksum mismatch.\n"
+            "1 problem found.\ntinysql > ")
+
+        # A statement that reads the page stops rather than use it
+        output, _ = self.run_repl(("select", ".exit\n"))
+        self.assertIn(
+            f"Error: page {page_num} is corrupt (checksum mismatch).", output)
+
+    def test_detects_broken_leaf_chain(self):
+        self.insert_rows(1000)
+        page_num = self.leaf_page_nums()[1]
+        page = self.read_page(page_num)
+        struct.pack_into("<I", page, LEAF_NODE_NEXT_LEAF_OFFSET, 0)
+        struct.pack_into("<I", page, 0, crc32c(page[4:]))
+        self.write_page(page_num, page)
+
+        output, _ = self.run_repl((".integrity_check", ".exit\n"))
+        self.assertIn(f"Page {page_num}: next leaf is 0, expected", output)
+        self.assertIn("1 problem found.", output)
@@ -0,0 +1,165 @@
+import ctypes
+import os
+import threading
+
+from .test_base import BaseTest
+
+LIBRARY = "./libtinysql.so"
+
+STEP_ROW, STEP_DONE, STEP_ERROR = 0, 1, 2
+EXECUTE_DUPLICATE_KEY = 1
+PREPARE_SUCCESS, PREPARE_SYNTAX_ERROR = 0, 3
+
+
+class TestLibrary(BaseTest):
+    """Drives the engine in-process through the query API of libtinysql."""
+
+    def setUp(self) -> None:
+        super().setUp()
+        if not os.path.exists(LIBRARY):
+            self.skipTest("needs libtinysql.so, built by make lib")
+
+        lib = ctypes.CDLL(LIBRARY)
+        lib.db_open.restype = ctypes.c_void_p
+        lib.db_open.argtypes = [ctypes.c_char_p, ctypes.c_uint32]
+        lib.db_close.argtypes = [ctypes.c_void_p]
+        lib.query_prepare.argtypes = [ctypes.c_void_p, ctypes.c_char_p,
+                                      ctypes.POINTER(ctypes.c_void_p)]
+        lib.query_bind_int.argtypes = [ctypes.c_void_p, ctypes.c_uint32,
+                                       ctypes.c_int]
+        lib.query_bind_text.argtypes = [ctypes.c_void_p, ctypes.c_uint32,
+                                        ctypes.c_char_p, ctypes.c_uint32]
+        lib.query_step.argtypes = [ctypes.c_void_p]
+        lib.query_result.argtypes = [ctypes.c_void_p]
+        lib.query_column_count.argtypes = [ctypes.c_void_p]
+        lib.query_column_int.restype = ctypes.c_uint32
+        lib.query_column_int.argtypes = [ctypes.c_void_p, ctypes.c_uint32]
+        lib.query_column_text.restype = ctypes.c_void_p
+        lib.query_column_text.argtypes = [ctypes.c_void_p, ctypes.c_uint32,
+                                          ctypes.POINTER(ctypes.c_uint32)]
+        lib.query_reset.argtypes = [ctypes.c_void_p]
+        lib.query_finalize.argtypes = [ctypes.c_void_p]
+        self.lib = lib
+        self.table = lib.db_open(b"mydb.db", 4096)
+
+    def tearDown(self) -> None:
+        self.lib.db_close(self.table)
+
+    def prepare(self, text):
+        query = ctypes.c_void_p()
+        result = self.lib.query_prepare(self.table, text.encode(),
+                                        ctypes.byref(query))
+        self.assertEqual(result, PREPARE_SUCCESS)
+        return query
+
+    def rows(self, query):
+        rows = []
+        while self.lib.query_step(query) == STEP_ROW:
+            row = []
+            for i in range(self.lib.query_column_count(query)):
+                length = ctypes.c_uint32()
+                text = self.lib.query_column_text(query, i,
+                                                  ctypes.byref(length))
+                if text is None:
+                    row.append(self.lib.query_column_int(query, i))
+                else:
+                    row.append(ctypes.string_at(text, length.value).decode())
+            rows.append(tuple(row))
+        return rows
+
+    def test_prepare_bind_and_step(self):
+        insert = self.prepare("insert ? ? ?")
+        for i in (3, 1, 2):
+            self.lib.query_bind_int(insert, 1, i)
+            self.lib.query_bind_text(insert, 2, f"user{i}".encode(), 5)
+            self.lib.query_bind_text(insert, 3, b"a@b", 3)
+            self.assertEqual(self.lib.query_step(insert), STEP_DONE)
+        self.lib.query_reset(insert)
+        self.assertEqual(self.lib.query_step(insert), STEP_ERROR)
+        self.assertEqual(self.lib.query_result(insert), EXECUTE_DUPLICATE_KEY)
+        self.lib.query_finalize(insert)
+
+        select = self.prepare("select email, id where id between 2 and 3")
+        self.assertEqual(self.rows(select), [("a@b", 2), ("a@b", 3)])
+        self.assertEqual(self.lib.query_step(select), STEP_DONE)
+        self.lib.query_reset(select)
+        self.assertEqual(len(self.rows(select)), 2)
+        self.lib.query_finalize(select)
+
+        count = self.prepare("select count(*) where id in (1, 3, 5)")
+        self.assertEqual(self.rows(count), [(2,)])
+        self.lib.query_finalize(count)
+
+    def insert(self, ids):
+        insert = self.prepare("insert ? ? ?")
+        for i in ids:
+            name = f"user{i}".encode()
+            self.lib.query_bind_int(insert, 1, i)
+            self.lib.query_bind_text(insert, 2, name, len(name))
+            self.lib.query_bind_text(insert, 3, b"a@b", 3)
+            self.assertEqual(self.lib.query_step(insert), STEP_DONE)
+        self.lib.query_finalize(insert)
+
+    def test_selects_alongside_inserts(self):
+        self.insert(range(1, 501))
+        errors = []
+
+        def scan():
+            # ctypes lets go of the GIL for the length of each call
+            select = self.prepare("select id, username")
+            for _ in range(20):
+                rows = self.rows(select)
+                self.lib.query_reset(select)
+                ids = [row[0] for row in rows]
+                if ids != sorted(ids) or len(ids) < 500 or any(
+                        name != f"user{i}" for i, name in rows):
+                    errors.append(rows)
+            self.lib.query_finalize(select)
+
+        readers = [threading.Thread(target=scan) for _ in range(4)]
+        for reader in readers:
+            reader.start()
+        self.insert(range(1000, 500, -1))
+        for reader in readers:
+            reader.join()
+
+        self.assertEqual(errors, [])
+        count = self.prepare("select count(*)")
+        self.assertEqual(self.rows(count), [(1000,)])
+        self.lib.query_finalize(count)
+
+    def test_lookups_alongside_deletes(self):
+        self.insert(range(1, 301))
+        errors = []
+
+        def look_up(seed):
+            lookup = self.prepare("select id, username where id = ?")
+            for i in range(2000):
+                key = (i * 7919 + seed) % 300 + 1
+                self.lib.query_bind_int(lookup, 1, key)
+                rows = self.rows(lookup)
+                if rows not in ([], [(key, f"user{key}")]):
+                    errors.append(rows)
+            self.lib.query_finalize(lookup)
+
+        readers = [threading.Thread(target=look_up, args=(seed,))
+                   for seed in range(4)]
+        for reader in readers:
+            reader.start()
+        for _ in range(3):
+            for i in range(1, 301, 2):
+                delete = self.prepare(f"delete where id = {i}")
+                self.assertEqual(self.lib.query_step(delete), STEP_DONE)
+                self.lib.query_finalize(delete)
+            self.insert(range(1, 301, 2))
+        for reader in readers:
+            reader.join()
+
+        self.assertEqual(errors, [])
+
+    def test_prepare_error(self):
+        query = ctypes.c_void_p(1)
+        result = self.lib.query_prepare(self.table, b"select where",
+                                        ctypes.byref(query))
+        self.assertEqual(result, PREPARE_SYNTAX_ERROR)
+        self.assertIsNone(query.value)
@@ -0,0 +1,180 @@
+import os
+
+from .test_base import BaseTest
+
+
+class TestPager(BaseTest):
+
+    def insert_rows(self, ids, cache_size=None):
+        input_data = []
+        if cache_size is not None:
+            input_data.append(f".cache_size {cache_size}")
+        for i in ids:
+            input_data.append(f"insert {i} user{i} person{i}@example.com")
+        input_data.append(".exit\n")
+        self.run_repl(tuple(input_data))
+
+    def read_tree(self):
+        output, _ = self.run_repl((".btree", ".exit\n"))
+        return output
+
+    def test_small_cache_writes_same_tree(self):
+        ids = [(i * 37) % 1009 + 1 for i in range(1009)]
+
+        self.insert_rows(ids)
+        expected_tree = self.read_tree()
+
+        os.remove("mydb.db")
+        self.insert_rows(ids, cache_size=2)
+        actual_tree = self.read_tree()
+
+        self.assertEqual(actual_tree, expected_tree)
+        self.assertIn("- internal", actual_tree)
+        for i in ids:
+            self.assertIn(f"- {i}\n", actual_tree)
+
+    def test_read_only_session_writes_nothing(self):
+        self.insert_rows(range(1, 51))
+        modified_before = os.stat("mydb.db").st_mtime_ns
+
+        output, _ = self.run_repl(("select", ".btree", ".stats", ".exit\n"))
+
+        self.assertIn("pages written: 0", output)
+        self.assertEqual(os.stat("mydb.db").st_mtime_ns, modified_before)
+
+    def test_mmap_select_matches_buffered_select(self):
+        self.insert_rows(range(1, 11))
+
+        expected_output, _ = self.run_repl(("select", ".exit\n"))
+        output, _ = self.run_repl((".mmap on", "select", ".exit\n"))
+
+        self.assertEqual(output, "tinysql > " + expected_output)
+        self.assertIn("(10, user10, person10@example.com)", output)
+
+    def test_prefetch_depth(self):
+        self.insert_rows(range(1, 41))
+
+        output, _ = self.run_repl((
+            ".prefetch",
+            ".prefetch 0",
+            ".prefetch",
+            "select where id between 39 and 40",
+            ".exit\n",
+        ))
+
+        self.assertEqual(output.split("\n")[0], "tinysql > 32")
+        self.assertIn("tinysql > tinysql > 0", output)
+        self.assertIn("(40, user40, person40@example.com)", output)
+
+    def test_prefetch_rejects_bad_depth(self):
+        output, _ = self.run_repl((
+            ".prefetch -1",
+            ".prefetch 4097",
+            ".prefetch 8x",
+            ".prefetch",
+            ".prefetchfoo",
+            ".flusherfoo",
+            ".flusher -1",
+            ".exit\n",
+        ))
+
+        usage = "Usage: .prefetch [PAGES], with PAGES from 0 to 4096\n"
+        self.assertEqual(output, "".join((
+            "tinysql > " + usage,
+            "tinysql > " + usage,
+            "tinysql > " + usage,
+            "tinysql > 32\n",
+            "tinysql > Unrecognized command '.prefetchfoo'\n",
+            "tinysql > Unrecognized command '.flusherfoo'\n",
+            "tinysql > Usage: .flusher [PAGES_PER_SECOND]\n",
+            "tinysql > ",
+        )))
+
+    def test_cache_size(self):
+        input_data = (
+            ".cache_size",
+            ".cache_size 16",
+            ".cache_size",
+            ".exit\n",
+        )
+
+        expected_output = (
+            "tinysql > 400",
+            "tinysql > tinysql > 16",
+            "tinysql > ",
+        )
+
+        self.assert_output(input_data, expected_output)
+
+    def test_flusher_writes_back_in_background(self):
+        output, _ = self.run_repl_paused((
+            ".wal off",
+            ".flusher",
+            ".flusher 1000",
+            ".flusher",
+            *[f"insert {i} user{i} person{i}@example.com"
+              for i in range(1, 301)],
+        ), (".stats", ".flusher 0", ".exit\n"), 0.5)
+
+        self.assertTrue(output.startswith("tinysql > tinysql > 0\n"
+                                          "tinysql > tinysql > 1000\n"))
+        flushed = int(output.split("pages flushed: ")[1].split("\n")[0])
+        self.assertGreater(flushed, 0)
+
+        output, _ = self.run_repl(("select count(*)", ".exit\n"))
+        self.assertIn("(300)", output)
+
+    def test_page_size_is_kept_in_header(self):
+        input_data = [f"insert {i} user{i} person{i}@example.com"
+                      for i in range(1, 101)]
+        input_data.append(".exit\n")
+        self.run_repl(tuple(input_data), args=("-p", "16384"))
+        self.assertEqual(os.path.getsize("mydb.db") % 16384, 0)
+
+        # Reopened without -p, the database still uses 16 KB pages
+        output, _ = self.run_repl((".constants", "select", ".exit\n"))
+        self.assertIn("PAGE_SIZE: 16384", output)
+        self.assertIn("LEAF_NODE_SPACE_FOR_CELLS: 16362", output)
+        self.assertIn("(100, user100, person100@example.com)", output)
+
+    def test_rejects_invalid_page_size(self):
+        output, _ = self.run_repl((".exit\n",), args=("-p", "5000"))
+        self.assertEqual(
+            output.strip(),
+            "Page size must be a power of two from 4096 to 65536.")
+
+    def test_io_backends_write_same_tree(self):
+        ids = [(i * 37) % 1009 + 1 for i in range(1009)]
+        self.insert_rows(ids, cache_size=8)
+        expected_tree = self.read_tree()
+        expected_rows, _ = self.run_repl(("select", ".exit\n"))
+
+        for args in (("-i", "uring"), ("-d",), ("-i", "uring", "-d")):
+            os.remove("mydb.db")
+            input_data = [".cache_size 8"]
+            input_data += [f"insert {i} user{i} person{i}@example.com"
+                           for i in ids]
+            input_data.append(".exit\n")
+            self.run_repl(tuple(input_data), args=args)
+
+            output, _ = self.run_repl((".btree", ".exit\n"), args=args)
+            self.assertEqual(output, expected_tree)
+            output, _ = self.run_repl(
+                (".cache_size 8", "select", ".exit\n"), args=args)
+            self.assertEqual(output, "tinysql > " + expected_rows)
+
+    def test_io_backend_is_reported(self):
+        output, _ = self.run_repl((".io", ".exit\n"))
+        self.assertEqual(output, "tinysql > posix\ntinysql > ")
+
+        # Falls back to what the system supports
+        output, _ = self.run_repl((".io", ".exit\n"), args=("-i", "uring"))
+        self.assertIn(output, ("tinysql > io_uring\ntinysql > ",
+                               "tinysql > posix\ntinysql > "))
+
+    def test_rejects_unknown_io_backend(self):
+        output, _ = self.run_repl((".exit\n",), args=("-i", "aio"))
+        self.assertEqual(
+            output.strip(),
+            "Usage: ./tinysql [-p PAGE_SIZE] [-i posix|uring] [-d] "
+            "[-f SCRIPT] FILENAME")
@@ -0,0 +1,130 @@
+from .test_base import BaseTest
+
+
+class TestPrepare(BaseTest):
+
+    def rows(self, ids):
+        return [f"({i}, user{i}, person{i}@example.com)" for i in ids]
+
+    def test_prepared_insert_and_select(self):
+        input_data = (
+            "prepare add as insert ? ? ?",
+            *[f"execute add {i} user{i} person{i}@example.com"
+              for i in (3, 1, 2)],
+            "prepare range as select where id between ? and ?",
+            "execute range 2 3",
+            "prepare name as select username where id = ?",
+            "execute name 1",
+            ".exit\n",
+        )
+
+        expected_output = (
+            "tinysql > Executed.",
+            "tinysql > Executed.",
+            "tinysql > Executed.",
+            "tinysql > Executed.",
+            "tinysql > Executed.",
+            "tinysql > " + self.rows([2])[0],
+            self.rows([3])[0],
+            "Executed.",
+            "tinysql > Executed.",
+            "tinysql > (user1)",
+            "Executed.",
+            "tinysql > ",
+        )
+
+        self.assert_output(input_data, expected_output)
+
+    def test_prepared_update_and_delete(self):
+        input_data = (
+            "insert 1 user1 person1@example.com",
+            "prepare rename as update 1 ? ?",
+            "execute rename user9 person9@example.com",
+            "prepare remove as delete where id = ?",
+            "execute remove 2",
+            "select",
+            "execute remove 1",
+            "select",
+            ".exit\n",
+        )
+
+        expected_output = (
+            "tinysql > Executed.",
+            "tinysql > Executed.",
+            "tinysql > Executed.",
+            "tinysql > Executed.",
+            "tinysql > Error: Key not found.",
+            "tinysql > (1, user9, person9@example.com)",
+            "Executed.",
+            "tinysql > Executed.",
+            "tinysql > Executed.",
+            "tinysql > ",
+        )
+
+        self.assert_output(input_data, expected_output)
+
+    def test_bound_values_are_checked(self):
+        input_data = (
+            "prepare add as insert ? ? ?",
+            "execute add 1 user1",
+            "execute add 1 user1 person1@example.com extra",
+            "execute add -1 user1 person1@example.com",
+            "execute add one user1 person1@example.com",
+            "execute add 1 " + "u" * 33 + " person1@example.com",
+            "select",
+            ".exit\n",
+        )
+
+        expected_output = (
+            "tinysql > Executed.",
+            "tinysql > Syntax error. Could not parse statement.",
+            "tinysql > Syntax error. Could not parse statement.",
+            "tinysql > ID must be positive.",
+            "tinysql > Syntax error. Could not parse statement.",
+            "tinysql > String is too long.",
+            "tinysql > Executed.",
+            "tinysql > ",
+        )
+
+        self.assert_output(input_data, expected_output)
+
+    def test_unknown_and_deallocated_statements(self):
+        input_data = (
+            "prepare add as insert ? user1 person1@example.com",
+            "deallocate add",
+            "execute add 1",
+            "deallocate add",
+            "prepare bad as frobnicate ?",
+            "execute bad 1",
+            "select where id = ?",
+            ".exit\n",
+        )
+
+        expected_output = (
+            "tinysql > Executed.",
+            "tinysql > Executed.",
+            "tinysql > Error: No prepared statement named 'add'.",
+            "tinysql > Error: No prepared statement named 'add'.",
+            "tinysql > Unrecognized keyword at start of 'frobnicate ?'.",
+            "tinysql > Error: No prepared statement named 'bad'.",
+            "tinysql > Syntax error. Could not parse statement.",
+            "tinysql > ",
+        )
+
+        self.assert_output(input_data, expected_output)
+
+    def test_values_may_hold_punctuation(self):
+        input_data = (
+            "insert 1 a(b)=c d,e*f?",
+            "select where id in(1)",
+            ".exit\n",
+        )
+
+        expected_output = (
+            "tinysql > Executed.",
+            "tinysql > (1, a(b)=c, d,e*f?)",
+            "Executed.",
+            "tinysql > ",
+        )
+
+        self.assert_output(input_data, expected_output)
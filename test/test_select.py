@@ -0,0 +1,277 @@
+from .test_base import BaseTest
+
+
+class TestSelect(BaseTest):
+
+    def insert_rows(self, ids):
+        input_data = [f"insert {i} user{i} person{i}@example.com" for i in ids]
+        input_data.append(".exit\n")
+        self.run_repl(tuple(input_data))
+
+    def rows(self, ids):
+        return [f"({i}, user{i}, person{i}@example.com)" for i in ids]
+
+    def test_select_walks_every_leaf(self):
+        # Out of order, and enough rows to split leaves several times
+        self.insert_rows([(i * 17) % 500 + 1 for i in range(500)])
+
+        rows = self.rows(range(1, 501))
+        expected_output = (
+            "tinysql > " + rows[0],
+            *rows[1:],
+            "Executed.",
+            "tinysql > ",
+        )
+
+        self.assert_output(("select", ".exit\n"), expected_output)
+
+    def test_select_output_larger_than_buffer(self):
+        # Rows are written out in 64 KiB batches; this result is several
+        ids = range(1, 1001)
+        emails = {i: f"{i}" + "e" * 200 for i in ids}
+        input_data = [f"insert {i} user{i} {emails[i]}" for i in ids]
+        input_data += ["select", ".exit\n"]
+
+        rows = [f"({i}, user{i}, {emails[i]})" for i in ids]
+        expected_output = (
+            *["tinysql > Executed."] * len(ids),
+            "tinysql > " + rows[0],
+            *rows[1:],
+            "Executed.",
+            "tinysql > ",
+        )
+
+        self.assert_output(tuple(input_data), expected_output)
+
+    def test_select_range_across_leaves(self):
+        self.insert_rows(range(1, 301))
+
+        rows = self.rows(range(90, 211))
+        expected_output = (
+            "tinysql > " + rows[0],
+            *rows[1:],
+            "Executed.",
+            "tinysql > ",
+        )
+
+        self.assert_output(
+            ("select where id between 90 and 210", ".exit\n"), expected_output
+        )
+
+    def test_select_empty_range(self):
+        self.insert_rows(range(1, 11))
+
+        input_data = (
+            "select where id between 20 and 30",
+            "select where id between 5 and 4",
+            ".exit\n",
+        )
+
+        expected_output = (
+            "tinysql > Executed.",
+            "tinysql > Executed.",
+            "tinysql > ",
+        )
+
+        self.assert_output(input_data, expected_output)
+
+    def test_select_range_syntax_error(self):
+        input_data = (
+            "select where id between 1",
+            ".exit\n",
+        )
+
+        expected_output = (
+            "tinysql > Syntax error. Could not parse statement.",
+            "tinysql > ",
+        )
+
+        self.assert_output(input_data, expected_output)
+
+    def test_select_by_id(self):
+        self.insert_rows(range(1, 301))
+
+        input_data = (
+            "select where id = 150",
+            "select where id = 301",
+            ".exit\n",
+        )
+
+        expected_output = (
+            "tinysql > " + self.rows([150])[0],
+            "Executed.",
+            "tinysql > Executed.",
+            "tinysql > ",
+        )
+
+        self.assert_output(input_data, expected_output)
+
+    def test_select_id_in_list(self):
+        self.insert_rows(range(1, 301))
+
+        # Unsorted, with duplicates and missing ids, across several leaves
+        ids = [250, 3, 120, 3, 999, 1, 121, 300, 0]
+        input_data = (
+            "select where id in (" + ", ".join(map(str, ids)) + ")",
+            ".exit\n",
+        )
+
+        rows = self.rows([1, 3, 120, 121, 250, 300])
+        expected_output = (
+            "tinysql > " + rows[0],
+            *rows[1:],
+            "Executed.",
+            "tinysql > ",
+        )
+
+        self.assert_output(input_data, expected_output)
+
+    def test_select_finds_every_id(self):
+        # Every id present and every gap between them, so lookups land on
+        # each position of every leaf and internal node
+        self.insert_rows([(i * 37) % 600 * 2 + 2 for i in range(600)])
+
+        input_data = (
+            "select where id in (" + ", ".join(map(str, range(1, 1202))) + ")",
+            ".exit\n",
+        )
+
+        rows = self.rows(range(2, 1201, 2))
+        expected_output = (
+            "tinysql > " + rows[0],
+            *rows[1:],
+            "Executed.",
+            "tinysql > ",
+        )
+
+        self.assert_output(input_data, expected_output)
+
+    def test_select_columns(self):
+        self.insert_rows([3, 1, 2])
+
+        input_data = (
+            "select id",
+            "select email, id where id between 2 and 3",
+            "select username where id in (1, 3)",
+            "select * where id = 2",
+            ".exit\n",
+        )
+
+        expected_output = (
+            "tinysql > (1)",
+            "(2)",
+            "(3)",
+            "Executed.",
+            "tinysql > (person2@example.com, 2)",
+            "(person3@example.com, 3)",
+            "Executed.",
+            "tinysql > (user1)",
+            "(user3)",
+            "Executed.",
+            "tinysql > " + self.rows([2])[0],
+            "Executed.",
+            "tinysql > ",
+        )
+
+        self.assert_output(input_data, expected_output)
+
+    def test_select_count(self):
+        # Enough rows for the ranges to start and end inside different leaves
+        self.insert_rows([(i * 17) % 500 + 1 for i in range(500)])
+
+        input_data = (
+            "select count(*)",
+            "select count(*) where id between 37 and 412",
+            "select count(*) where id = 250",
+            "select count(*) where id between 600 and 700",
+            "select count(*) where id in (1, 500, 501, 1)",
+            ".exit\n",
+        )
+
+        expected_output = (
+            "tinysql > (500)",
+            "Executed.",
+            "tinysql > (376)",
+            "Executed.",
+            "tinysql > (1)",
+            "Executed.",
+            "tinysql > (0)",
+            "Executed.",
+            "tinysql > (2)",
+            "Executed.",
+            "tinysql > ",
+        )
+
+        self.assert_output(input_data, expected_output)
+
+    def test_select_columns_syntax_error(self):
+        input_data = (
+            "select name",
+            "select id, id",
+            "select count(*), id",
+            "select * id",
+            ".exit\n",
+        )
+
+        expected_output = (
+            "tinysql > Syntax error. Could not parse statement.",
+            "tinysql > Syntax error. Could not parse statement.",
+            "tinysql > Syntax error. Could not parse statement.",
+            "tinysql > Syntax error. Could not parse statement.",
+            "tinysql > ",
+        )
+
+        self.assert_output(input_data, expected_output)
+
+    def test_select_id_in_syntax_error(self):
+        input_data = (
+            "select where id in ()",
+            "select where id in 1, 2",
+            "select where id = 1 2",
+            "select where id in (1, -2)",
+            ".exit\n",
+        )
+
+        expected_output = (
+            "tinysql > Syntax error. Could not parse statement.",
+            "tinysql > Syntax error. Could not parse statement.",
+            "tinysql > Syntax error. Could not parse statement.",
+            "tinysql > ID must be positive.",
+            "tinysql > ",
+        )
+
+        self.assert_output(input_data, expected_output)
+
+    def test_select_on_threads(self):
+        self.insert_rows([(i * 17) % 1500 + 1 for i in range(1500)])
+
+        input_data = (
+            ".threads",
+            ".threads 4",
+            "select where id between 2 and 1499",
+            "select username where id = 7",
+            ".threads 3 unordered",
+            ".threads",
+            "select id",
+            ".threads 0",
+            ".exit\n",
+        )
+        output, _ = self.run_repl(input_data)
+        lines = output.split("\n")
+
+        rows = self.rows(range(2, 1500))
+        self.assertEqual(lines[0], "tinysql > 1")
+        self.assertEqual(lines[1:1 + len(rows)],
+                         ["tinysql > tinysql > " + rows[0], *rows[1:]])
+        lines = lines[1 + len(rows):]
+        self.assertEqual(lines[:3], ["Executed.", "tinysql > (user7)",
+                                     "Executed."])
+        self.assertEqual(lines[3], "tinysql > tinysql > 3 unordered")
+        ids = sorted(int(line.removeprefix("tinysql > ").strip("()"))
+                     for line in lines[4:4 + 1500])
+        self.assertEqual(ids, list(range(1, 1501)))
+        self.assertEqual(lines[4 + 1500:], [
+            "Executed.",
+            "tinysql > Usage: .threads [N [unordered]], with N from 1 to 32",
+            "tinysql > ",
+        ])
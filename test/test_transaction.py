@@ -0,0 +1,122 @@
+from .test_base import BaseTest
+
+
+class TestTransaction(BaseTest):
+
+    def rows(self, ids):
+        return [f"({i}, user{i}, person{i}@example.com)" for i in ids]
+
+    def values(self, ids):
+        return ", ".join(f"({i}, user{i}, 'person{i}@example.com')"
+                         for i in ids)
+
+    def test_insert_several_rows(self):
+        ids = list(range(1, 201))
+        input_data = (
+            "insert into users values " + self.values(reversed(ids)),
+            "insert into users values (500, 'with spaces', 'a, b')",
+            "select count(*)",
+            "select where id between 99 and 101",
+            "select where id = 500",
+            ".exit\n",
+        )
+
+        expected_output = (
+            "tinysql > Executed.",
+            "tinysql > Executed.",
+            "tinysql > (201)",
+            "Executed.",
+            "tinysql > " + self.rows([99])[0],
+            *self.rows([100, 101]),
+            "Executed.",
+            "tinysql > (500, with spaces, a, b)",
+            "Executed.",
+            "tinysql > ",
+        )
+
+        self.assert_output(input_data, expected_output)
+
+    def test_duplicate_inserts_no_rows(self):
+        input_data = (
+            "insert 5 user5 person5@example.com",
+            "insert into users values " + self.values([1, 2, 5]),
+            "insert into users values " + self.values([3, 4, 3]),
+            "select",
+            ".exit\n",
+        )
+
+        expected_output = (
+            "tinysql > Executed.",
+            "tinysql > Error: Duplicate Key.",
+            "tinysql > Error: Duplicate Key.",
+            "tinysql > " + self.rows([5])[0],
+            "Executed.",
+            "tinysql > ",
+        )
+
+        self.assert_output(input_data, expected_output)
+
+    def test_insert_several_rows_syntax_error(self):
+        input_data = (
+            "insert into people values (1, a, b)",
+            "insert into users values (1, a)",
+            "insert into users values (1, a, b) (2, c, d)",
+            "insert into users values (1, 'a, b)",
+            "insert into users values (?, a, b)",
+            "insert into users values (-1, a, b)",
+            "select",
+            ".exit\n",
+        )
+
+        expected_output = (
+            "tinysql > Syntax error. Could not parse statement.",
+            "tinysql > Syntax error. Could not parse statement.",
+            "tinysql > Syntax error. Could not parse statement.",
+            "tinysql > Syntax error. Could not parse statement.",
+            "tinysql > Syntax error. Could not parse statement.",
+            "tinysql > ID must be positive.",
+            "tinysql > Executed.",
+            "tinysql > ",
+        )
+
+        self.assert_output(input_data, expected_output)
+
+    def test_begin_and_commit(self):
+        input_data = (
+            "commit",
+            "begin",
+            *[f"insert {i} user{i} person{i}@example.com" for i in (2, 1)],
+            "begin",
+            ".checkpoint",
+            "commit",
+            ".checkpoint",
+            ".exit\n",
+        )
+
+        expected_output = (
+            "tinysql > Error: No transaction is active.",
+            "tinysql > Executed.",
+            "tinysql > Executed.",
+            "tinysql > Executed.",
+            "tinysql > Error: Already in a transaction.",
+            "tinysql > Error: .checkpoint is not allowed in a transaction.",
+            "tinysql > Executed.",
+            "tinysql > tinysql > ",
+        )
+
+        self.assert_output(input_data, expected_output)
+
+        self.assert_output(
+            ("select", ".exit\n"),
+            ("tinysql > " + self.rows([1])[0], self.rows([2])[0],
+             "Executed.", "tinysql > "),
+        )
+
+    def test_open_transaction_is_committed_at_exit(self):
+        self.run_repl(("begin", "insert 1 user1 person1@example.com",
+                       ".exit\n"))
+
+        self.assert_output(
+            ("select", ".exit\n"),
+            ("tinysql > " + self.rows([1])[0], "Executed.", "tinysql > "),
+        )
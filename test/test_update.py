@@ -0,0 +1,52 @@
+from .test_base import BaseTest
+
+
+class TestUpdate(BaseTest):
+
+    def test_update_row(self):
+        input_data = (
+            "insert 1 user1 person1@example.com",
+            "insert 2 user2 person2@example.com",
+            "update 1 alice alice@example.com",
+            "select",
+            ".exit\n",
+        )
+        expected_output = (
+            "tinysql > Executed.",
+            "tinysql > Executed.",
+            "tinysql > Executed.",
+            "tinysql > (1, alice, alice@example.com)",
+            "(2, user2, person2@example.com)",
+            "Executed.",
+            "tinysql > ",
+        )
+        self.assert_output(input_data, expected_output)
+
+    def test_update_missing_key(self):
+        input_data = (
+            "update 1 alice alice@example.com",
+            ".exit\n",
+        )
+        expected_output = (
+            "tinysql > Error: Key not found.",
+            "tinysql > ",
+        )
+        self.assert_output(input_data, expected_output)
+
+    def test_update_to_longer_row_splits_leaf(self):
+        ids = list(range(1, 101))
+        input_data = [f"insert {i} u{i} e{i}" for i in ids]
+        long_email = "e" * 255
+        input_data += [f"update {i} {'u' * 32} {long_email}"
+                       for i in range(40, 60)]
+        input_data += ["select", ".btree", ".exit\n"]
+        output, _ = self.run_repl(tuple(input_data))
+
+        self.assertNotIn("Error", output)
+        self.assertIn("- internal", output)
+        rows = [line.replace("tinysql > ", "")
+                for line in output.splitlines()
+                if line.replace("tinysql > ", "").startswith("(")]
+        expected = [f"({i}, u{i}, e{i})" if not 40 <= i < 60
+                    else f"({i}, {'u' * 32}, {long_email})" for i in ids]
+        self.assertEqual(rows, expected)
@@ -0,0 +1,70 @@
+import os
+
+from .test_base import BaseTest
+
+
+class TestVacuum(BaseTest):
+
+    def insert_rows(self, ids):
+        input_data = [f"insert {i} user{i} person{i}@example.com" for i in ids]
+        input_data.append(".exit\n")
+        self.run_repl(tuple(input_data))
+
+    def stat(self, output, name):
+        for line in output.splitlines():
+            if line.startswith(name + ": ") or (" " + name + ": ") in line:
+                return int(line.split(": ")[-1])
+
+    def test_vacuum_compacts_file(self):
+        # Random order leaves half-empty leaves behind after splits
+        self.insert_rows([(i * 37) % 1009 + 1 for i in range(1009)])
+        expected_output, _ = self.run_repl(("select", ".exit\n"))
+        size_before = os.path.getsize("mydb.db")
+
+        output, _ = self.run_repl((".vacuum", ".stats", ".exit\n"))
+        self.assertEqual(self.stat(output, "free pages"), 0)
+        self.assertLess(os.path.getsize("mydb.db"), size_before)
+        self.assertEqual(os.path.getsize("mydb.db"),
+                         self.stat(output, "pages") * 4096)
+
+        output, _ = self.run_repl(("select", ".exit\n"))
+        self.assertEqual(output, expected_output)
+
+    def test_vacuum_many_leaves(self):
+        # Vacuum goes back and forth between the table and its scratch copy
+        # for every page, which must not use up the pager's sessions
+        self.insert_rows(range(1, 10001))
+        output, _ = self.run_repl((".vacuum", ".stats", "select count(*)",
+                                   ".exit\n"))
+        self.assertGreater(self.stat(output, "pages"), 64)
+        self.assertIn("(10000)", output)
+
+    def test_vacuum_fills_leaves(self):
+        self.insert_rows([(i * 37) % 300 + 1 for i in range(300)])
+
+        output, _ = self.run_repl((".vacuum", ".btree", ".exit\n"))
+        nodes = [line.strip() for line in output.splitlines()
+                 if "leaf" in line or "internal" in line]
+        self.assertEqual(nodes, [
+            "- internal (size 3)",
+            "- leaf (size 102)",
+            "- leaf (size 97)",
+            "- leaf (size 97)",
+            "- leaf (size 4)",
+        ])
+
+    def test_vacuum_empty_table(self):
+        input_data = (
+            ".vacuum",
+            "insert 1 user1 person1@example.com",
+            "select",
+            ".exit\n",
+        )
+        expected_output = (
+            "tinysql > tinysql > Executed.",
+            "tinysql > (1, user1, person1@example.com)",
+            "Executed.",
+            "tinysql > ",
+        )
+        self.assert_output(input_data, expected_output)
+        self.assertFalse(os.path.exists("mydb.db-vacuum"))
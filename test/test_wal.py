@@ -0,0 +1,84 @@
+import os
+
+from .test_base import BaseTest
+
+
+class TestWal(BaseTest):
+
+    def setUp(self) -> None:
+        super().setUp()
+        if os.path.exists("mydb.db-wal"):
+            os.remove("mydb.db-wal")
+
+    def test_recovers_statements_without_exit(self):
+        # No .exit: the REPL dies at end of input without closing the db
+        self.run_repl((
+            "insert 1 user1 person1@example.com",
+            "insert 2 user2 person2@example.com\n",
+        ))
+
+        input_data = (
+            "select",
+            ".exit\n",
+        )
+
+        expected_output = (
+            "tinysql > (1, user1, person1@example.com)",
+            "(2, user2, person2@example.com)",
+            "Executed.",
+            "tinysql > ",
+        )
+
+        self.assert_output(input_data, expected_output)
+        self.assertFalse(os.path.exists("mydb.db-wal"))
+
+    def test_torn_frame_drops_only_last_statement(self):
+        self.run_repl((
+            "insert 1 user1 person1@example.com",
+            "insert 2 user2 person2@example.com\n",
+        ))
+        with open("mydb.db-wal", "r+b") as wal:
+            wal.truncate(os.path.getsize("mydb.db-wal") - 100)
+
+        input_data = (
+            "select",
+            ".exit\n",
+        )
+
+        expected_output = (
+            "tinysql > (1, user1, person1@example.com)",
+            "Executed.",
+            "tinysql > ",
+        )
+
+        self.assert_output(input_data, expected_output)
+
+    def test_flusher_checkpoints_idle_log(self):
+        output, _ = self.run_repl_paused((
+            ".flusher 100",
+            "insert 1 user1 person1@example.com",
+            "insert 2 user2 person2@example.com",
+        ), (".stats", "select", ".exit\n"), 0.5)
+
+        self.assertIn("checkpoints: 1\n", output)
+        self.assertIn("(2, user2, person2@example.com)", output)
+        self.assertFalse(os.path.exists("mydb.db-wal"))
+
+    def test_recovers_transaction_evicted_before_commit(self):
+        # The transaction outgrows the cache, so its pages reach the log as
+        # they are evicted and none are left dirty when it commits
+        input_data = [".cache_size 8", "begin"]
+        input_data += [f"insert {i} user{i} person{i}@example.com"
+                       for i in range(1, 3001)]
+        input_data += ["select id where id between 1 and 3000", "commit"]
+        self.run_repl_killed(input_data, 2)
+
+        output, _ = self.run_repl(("select count(*)", ".exit\n"))
+        self.assertIn("(3000)", output)
+
+    def test_commit_syncs_once_the_last_sync_is_old(self):
+        output, _ = self.run_repl_paused(
+            ("insert 1 user1 person1@example.com",),
+            ("insert 2 user2 person2@example.com", ".stats", ".exit\n"), 0.3)
+
+        self.assertIn("wal syncs: 1\n", output)